@@ -19,9 +19,21 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
 #include "bbuf.h"
+#ifdef __GNUG__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 #define GBB_DF_CPTY 32
 
+//pool size classes: 64 << (2 * class) bytes
+#define GBB_POOL_MIN_CLASS_SHIFT 6
+#define GBB_POOL_CLASSES 6
+
+//max free buffers kept for each size class
+#define GBB_POOL_MAX_FREE 256
+
 namespace nds {
 
 // grow_byte_buffer
@@ -286,4 +298,149 @@ size_t g_bbuf::position() const
     return pos_;
 }
 
+// mem_file
+
+mem_file::mem_file() :
+    fd_(-1),
+    len_(0)
+{}
+
+mem_file::~mem_file()
+{
+    if(fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+RetCode mem_file::create(const char *name)
+{
+    if((fd_ = memfd_create(name, MFD_CLOEXEC)) < 0) {
+        return RetCode_SYSERR;
+    }
+    return RetCode_OK;
+}
+
+RetCode mem_file::append(const void *buf, size_t len)
+{
+    size_t written = 0;
+    while(written < len) {
+        ssize_t res = write(fd_, &((const char *)buf)[written], len - written);
+        if(res < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return RetCode_SYSERR;
+        }
+        written += res;
+    }
+    len_ += len;
+    return RetCode_OK;
+}
+
+// g_bbuf_pool
+
+void g_bbuf_deleter::operator()(g_bbuf *bbuf) const
+{
+    g_bbuf_pool::instance().release(bbuf);
+}
+
+g_bbuf_pool &g_bbuf_pool::instance()
+{
+    //never destroyed: buffers can be released by static objects destructed at exit.
+    static g_bbuf_pool *pool = new g_bbuf_pool();
+    return *pool;
+}
+
+g_bbuf_pool::g_bbuf_pool() :
+    klasses_(GBB_POOL_CLASSES),
+    hits_(0),
+    misses_(0)
+{}
+
+g_bbuf_pool::~g_bbuf_pool()
+{
+    for(auto it = klasses_.begin(); it != klasses_.end(); ++it) {
+        for(auto fit = it->free_.begin(); fit != it->free_.end(); ++fit) {
+            delete *fit;
+        }
+    }
+}
+
+int g_bbuf_pool::size_class(size_t capacity)
+{
+    for(int k = 0; k < GBB_POOL_CLASSES; ++k) {
+        if(capacity <= ((size_t)1 << (GBB_POOL_MIN_CLASS_SHIFT + 2*k))) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+g_bbuf_ptr g_bbuf_pool::acquire(size_t capacity)
+{
+    int k = size_class(capacity);
+    if(k < 0) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return g_bbuf_ptr(new g_bbuf(capacity));
+    }
+    klass &kl = klasses_[k];
+    {
+        std::unique_lock<std::mutex> lck(kl.mtx_);
+        if(!kl.free_.empty()) {
+            g_bbuf *bbuf = kl.free_.back();
+            kl.free_.pop_back();
+            lck.unlock();
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return g_bbuf_ptr(bbuf);
+        }
+    }
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return g_bbuf_ptr(new g_bbuf((size_t)1 << (GBB_POOL_MIN_CLASS_SHIFT + 2*k)));
+}
+
+void g_bbuf_pool::release(g_bbuf *bbuf)
+{
+    int k = size_class(bbuf->capcty_);
+    if(k >= 0 && bbuf->capcty_ == ((size_t)1 << (GBB_POOL_MIN_CLASS_SHIFT + 2*k))) {
+        bbuf->reset();
+        klass &kl = klasses_[k];
+        std::unique_lock<std::mutex> lck(kl.mtx_);
+        if(kl.free_.size() < GBB_POOL_MAX_FREE) {
+            kl.free_.push_back(bbuf);
+            return;
+        }
+    }
+    delete bbuf;
+}
+
+g_bslice::g_bslice(g_bbuf_ptr &&buf, const char *ptr, size_t len) :
+    buf_(std::move(buf)),
+    ptr_(ptr),
+    len_(len)
+{}
+
+g_bslice::g_bslice(g_bbuf_ptr &&buf) :
+    ptr_(&buf->buf_[buf->pos_]),
+    len_(buf->available_read())
+{
+    buf_ = std::move(buf);
+}
+
+g_bslice::g_bslice(const char *ptr, size_t len) :
+    ptr_(nullptr),
+    len_(len)
+{
+    g_bbuf_ptr buf = g_bbuf_pool::instance().acquire(len ? len : 1);
+    if(len) {
+        buf->append(ptr, 0, len);
+    }
+    ptr_ = buf->buf_;
+    buf_ = std::move(buf);
+}
+
+std::ostream &operator<<(std::ostream &os, const g_bslice &slice)
+{
+    return os.write(slice.data(), slice.size());
+}
+
 }
@@ -20,6 +20,9 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #pragma once
 #include "nds.h"
+#include <mutex>
+#include <atomic>
+#include <vector>
 
 namespace nds {
 
@@ -134,4 +137,124 @@ struct g_bbuf {
     size_t mark_;
     char *buf_;
 };
+
+/**
+ * An immutable buffer backed by an anonymous memory file (memfd).
+ *
+ * Once written, its content can be sent to any number of sockets with sendfile(),
+ * without being copied in user space; it is never modified after having been shared.
+ */
+struct mem_file {
+    explicit mem_file();
+    ~mem_file();
+
+    RetCode create(const char *name);
+    RetCode append(const void *buffer, size_t length);
+
+    int fd_;
+    size_t len_;
+};
+
+/**
+ * Deleter returning a g_bbuf to the g_bbuf_pool, when it has the capacity of a size class.
+ */
+struct g_bbuf_deleter {
+    void operator()(g_bbuf *) const;
+};
+
+//a g_bbuf owned by a std::unique_ptr, recycled through the g_bbuf_pool.
+typedef std::unique_ptr<g_bbuf, g_bbuf_deleter> g_bbuf_ptr;
+
+/**
+ * A thread-safe pool of g_bbuf objects in power of 4 size classes (64 bytes - 64KB).
+ *
+ * A buffer is acquired with at least the requested capacity and it is recycled
+ * when its g_bbuf_ptr is destroyed, on whatever thread this happens.
+ * Requests greater than the biggest class, or buffers grown beyond the class
+ * they were acquired in, are plainly allocated and freed.
+ */
+struct g_bbuf_pool {
+    static g_bbuf_pool &instance();
+
+    g_bbuf_ptr acquire(size_t capacity);
+    void release(g_bbuf *);
+
+    //the size class fitting capacity, -1 if none.
+    static int size_class(size_t capacity);
+
+    size_t hits() const {
+        return hits_.load(std::memory_order_relaxed);
+    }
+
+    size_t misses() const {
+        return misses_.load(std::memory_order_relaxed);
+    }
+
+    g_bbuf_pool();
+    ~g_bbuf_pool();
+
+    //a free list of a size class
+    struct klass {
+        std::mutex mtx_;
+        std::vector<g_bbuf *> free_;
+    };
+
+    std::vector<klass> klasses_;
+
+    //acquires served by a free list / by the allocator
+    std::atomic<size_t> hits_;
+    std::atomic<size_t> misses_;
+};
+
+/**
+ * A read-only byte range inside a g_bbuf shared by its owners.
+ *
+ * A slice taken over a received packet keeps the packet buffer alive,
+ * so that the bytes are neither copied nor parsed again.
+ */
+struct g_bslice {
+    explicit g_bslice() : ptr_(nullptr), len_(0) {}
+
+    //takes ownership of buf; [ptr, ptr+len) must lie inside it.
+    explicit g_bslice(g_bbuf_ptr &&buf, const char *ptr, size_t len);
+
+    //takes ownership of buf; the slice spans its readable bytes.
+    explicit g_bslice(g_bbuf_ptr &&buf);
+
+    //shares buf with other slices; [ptr, ptr+len) must lie inside it.
+    explicit g_bslice(const std::shared_ptr<g_bbuf> &buf, const char *ptr, size_t len) :
+        buf_(buf), ptr_(ptr), len_(len) {}
+
+    //copies the bytes into a pooled buffer.
+    explicit g_bslice(const char *ptr, size_t len);
+    explicit g_bslice(const std::string &str) : g_bslice(str.data(), str.size()) {}
+
+    const char *data() const {
+        return ptr_;
+    }
+
+    size_t size() const {
+        return len_;
+    }
+
+    bool empty() const {
+        return !len_;
+    }
+
+    std::string str() const {
+        return len_ ? std::string(ptr_, len_) : std::string();
+    }
+
+    std::shared_ptr<g_bbuf> buf_;
+    const char *ptr_;
+    size_t len_;
+};
+
+inline bool operator==(const g_bslice &slice, const std::string &str)
+{
+    return slice.size() == str.size() && !str.compare(0, str.size(), slice.data(), slice.size());
+}
+
+std::ostream &operator<<(std::ostream &os, const g_bslice &slice);
+
 }
@@ -22,6 +22,11 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "nds.h"
 #include <queue>
 #include <thread>
+#include <atomic>
+#include <vector>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 namespace spdlog {
 class logger;
@@ -126,4 +131,256 @@ struct b_qu {
         mutable std::condition_variable cv_;
 };
 
+/**
+ * A lock-free multi producer single consumer queue.
+ *
+ * Producers push concurrently with a CAS on the head of an intrusive stack;
+ * the consumer detaches the whole stack with a single exchange and
+ * consumes the items in FIFO order.
+*/
+template <typename T>
+struct mpsc_qu {
+        mpsc_qu() : head_(nullptr) {}
+
+        ~mpsc_qu() {
+            drain([](T &) {});
+        }
+
+        //returns true if the queue was empty
+        bool put(T &&msg) {
+            node *n = new node(std::move(msg));
+            node *head = head_.load(std::memory_order_relaxed);
+            do {
+                n->next_ = head;
+            } while(!head_.compare_exchange_weak(head, n));
+            return !head;
+        }
+
+        //consumes all the items currently queued; returns the number of consumed items.
+        template <typename F>
+        size_t drain(F consume) {
+            node *head = head_.exchange(nullptr), *fifo = nullptr, *next = nullptr;
+            while(head) {
+                next = head->next_;
+                head->next_ = fifo;
+                fifo = head;
+                head = next;
+            }
+            size_t cnt = 0;
+            while(fifo) {
+                consume(fifo->msg_);
+                next = fifo->next_;
+                delete fifo;
+                fifo = next;
+                ++cnt;
+            }
+            return cnt;
+        }
+
+        bool empty() const {
+            return !head_.load();
+        }
+
+    private:
+        struct node {
+            explicit node(T &&msg) : msg_(std::move(msg)), next_(nullptr) {}
+            T msg_;
+            node *next_;
+        };
+
+        std::atomic<node *> head_;
+};
+
+#define NDS_CACHE_LINE 64
+
+/**
+ * A futex based event count.
+ *
+ * A consumer that found nothing to consume takes a key (prepare_wait), checks its
+ * condition again and then waits on the key; a producer signals after having published
+ * its item. The futex is only touched when a consumer is actually waiting.
+*/
+struct futex_evt_cnt {
+        futex_evt_cnt() : seq_(0), waiters_(0) {}
+
+        uint32_t prepare_wait() {
+            waiters_.fetch_add(1);
+            return seq_.load();
+        }
+
+        void cancel_wait() {
+            waiters_.fetch_sub(1);
+        }
+
+        void wait(uint32_t key) {
+            syscall(SYS_futex, &seq_, FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+            waiters_.fetch_sub(1);
+        }
+
+        void notify() {
+            seq_.fetch_add(1);
+            if(waiters_.load()) {
+                syscall(SYS_futex, &seq_, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+            }
+        }
+
+    private:
+        std::atomic<uint32_t> seq_;
+        std::atomic<uint32_t> waiters_;
+};
+
+/**
+ * A bounded lock-free single producer single consumer ring.
+ *
+ * The capacity is rounded up to a power of two; head and tail are padded on
+ * separate cache lines, alongside with a cached copy of the opposite index,
+ * so that producer and consumer touch each other's line only when needed.
+*/
+template <typename T>
+struct spsc_ring {
+        explicit spsc_ring(size_t capacity = 1024) :
+            head_(0),
+            tail_cache_(0),
+            tail_(0),
+            head_cache_(0) {
+            size_t cap = 1;
+            while(cap < capacity) {
+                cap <<= 1;
+            }
+            mask_ = cap - 1;
+            slots_.resize(cap);
+        }
+
+        //producer side; returns false if the ring is full.
+        bool try_put(T &&msg) {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            if(tail - head_cache_ > mask_) {
+                head_cache_ = head_.load(std::memory_order_acquire);
+                if(tail - head_cache_ > mask_) {
+                    return false;
+                }
+            }
+            slots_[tail & mask_] = std::move(msg);
+            tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        //consumer side; consumes all the items currently available, returns their number.
+        template <typename F>
+        size_t drain(F consume) {
+            size_t head = head_.load(std::memory_order_relaxed);
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            size_t cnt = tail_cache_ - head;
+            for(; head != tail_cache_; ++head) {
+                consume(slots_[head & mask_]);
+                slots_[head & mask_] = T();
+            }
+            head_.store(head, std::memory_order_release);
+            return cnt;
+        }
+
+        bool empty() const {
+            return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+        }
+
+    private:
+        std::vector<T> slots_;
+        size_t mask_;
+
+        //consumer line
+        char pad0_[NDS_CACHE_LINE];
+        std::atomic<size_t> head_;
+        size_t tail_cache_;
+
+        //producer line
+        char pad1_[NDS_CACHE_LINE];
+        std::atomic<size_t> tail_;
+        size_t head_cache_;
+        char pad2_[NDS_CACHE_LINE];
+};
+
+/**
+ * A fan-in queue: one spsc_ring per producer thread, drained by a single consumer.
+ *
+ * Each producer must always put with its own index.
+ * A producer finding its ring full spills into a mutex protected overflow queue, preserving
+ * its FIFO order, so that put never blocks nor loses items.
+ * The consumer drains everything available in one go (get_batch) and sleeps on a futex
+ * only when all rings are empty.
+*/
+template <typename T>
+struct fan_in_qu {
+        explicit fan_in_qu(size_t capacity = 1024) :
+            capacity_(capacity) {}
+
+        //must be called before any put/get_batch.
+        void set_producers(size_t producers) {
+            rings_.clear();
+            for(size_t i = 0; i < producers; ++i) {
+                rings_.emplace_back(new prod_ring(capacity_));
+            }
+        }
+
+        void put(size_t producer, T &&msg) {
+            prod_ring &pr = *rings_[producer];
+            if(!pr.spill_cnt_.load() && pr.ring_.try_put(std::move(msg))) {
+                evt_cnt_.notify();
+                return;
+            }
+            {
+                std::unique_lock<std::mutex> lck(pr.mtx_);
+                pr.spill_.push(std::move(msg));
+                pr.spill_cnt_.store(pr.spill_.size());
+            }
+            evt_cnt_.notify();
+        }
+
+        //moves in out all the items available, waiting for at least one; returns their number.
+        size_t get_batch(std::vector<T> &out) {
+            size_t cnt = 0;
+            while(!(cnt = try_get_batch(out))) {
+                uint32_t key = evt_cnt_.prepare_wait();
+                if((cnt = try_get_batch(out))) {
+                    evt_cnt_.cancel_wait();
+                    break;
+                }
+                evt_cnt_.wait(key);
+            }
+            return cnt;
+        }
+
+        size_t try_get_batch(std::vector<T> &out) {
+            size_t cnt = 0;
+            for(auto it = rings_.begin(); it != rings_.end(); ++it) {
+                prod_ring &pr = **it;
+                cnt += pr.ring_.drain([&](T &msg) {
+                    out.push_back(std::move(msg));
+                });
+                if(pr.spill_cnt_.load()) {
+                    std::unique_lock<std::mutex> lck(pr.mtx_);
+                    cnt += pr.spill_.size();
+                    while(!pr.spill_.empty()) {
+                        out.push_back(std::move(pr.spill_.front()));
+                        pr.spill_.pop();
+                    }
+                    pr.spill_cnt_.store(0);
+                }
+            }
+            return cnt;
+        }
+
+    private:
+        struct prod_ring {
+            explicit prod_ring(size_t capacity) : ring_(capacity), spill_cnt_(0) {}
+            spsc_ring<T> ring_;
+            std::atomic<size_t> spill_cnt_;
+            std::mutex mtx_;
+            std::queue<T> spill_;
+        };
+
+        size_t capacity_;
+        std::vector<std::unique_ptr<prod_ring>> rings_;
+        futex_evt_cnt evt_cnt_;
+};
+
 }
@@ -21,14 +21,53 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifdef __GNUG__
 #include <errno.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #endif
 #include "peer.h"
 
 #define RCV_SND_BUF_SZ 8192
 #define WORD_SZ 4   //word length [byte size]
 
+//bodies at least this long bypass rdn_buff_ when received over TCP
+#define RCV_DIRECT_BDY_SZ RCV_SND_BUF_SZ
+
+//receive buffer of the multicast socket
+#define MCAST_RCVBUF_SZ (4*1024*1024)
+
 namespace nds {
 
+//snd_pkt
+
+int snd_pkt::fill_iov(struct iovec *iov) const
+{
+    if(buf_) {
+        iov[0].iov_base = &buf_->buf_[buf_->pos_];
+        iov[0].iov_len = buf_->available_read();
+        return 1;
+    }
+    int iovcnt = 0;
+    if(off_ < head_.size()) {
+        iov[iovcnt].iov_base = (void *)(head_.data() + off_);
+        iov[iovcnt++].iov_len = head_.size() - off_;
+    }
+    size_t tail_off = off_ > head_.size() ? off_ - head_.size() : 0;
+    if(tail_off < tail_.size()) {
+        iov[iovcnt].iov_base = (void *)(tail_.data() + tail_off);
+        iov[iovcnt++].iov_len = tail_.size() - tail_off;
+    }
+    return iovcnt;
+}
+
+void snd_pkt::advance(size_t amount)
+{
+    if(buf_) {
+        buf_->advance_pos_read(amount);
+    } else {
+        off_ += amount;
+    }
+}
+
 //connection
 
 connection::connection(selector &sel, ConnectionType ct) :
@@ -36,32 +75,25 @@ connection::connection(selector &sel, ConnectionType ct) :
     con_type_(ct),
     status_(ConnectionStatus_DISCONNECTED),
     socket_(INVALID_SOCKET),
+    local_(false),
     pkt_ch_st_(PktChasingStatus_BodyLen),
     bdy_bytelen_(0),
     rdn_buff_(RCV_SND_BUF_SZ),
     acc_snd_buff_(RCV_SND_BUF_SZ),
+    ring_rcv_id_(0),
+    ring_snd_id_(0),
     log_(sel.log_)
 {
     memset(&addr_, 0, sizeof(addr_));
     addr_.sin_family = AF_INET;
+    memset(&rcv_msg_, 0, sizeof(rcv_msg_));
+    memset(&rcv_src_, 0, sizeof(rcv_src_));
+    memset(&snd_msg_, 0, sizeof(snd_msg_));
 }
 
-std::shared_ptr<connection> &connection::self_as_shared_ptr()
+std::shared_ptr<connection> connection::self_as_shared_ptr()
 {
-    if(sel_.mcast_udp_inco_conn_->socket_ == socket_) {
-        return sel_.mcast_udp_inco_conn_;
-    }
-
-    auto it = sel_.inco_conn_map_.find(socket_);
-    if(it != sel_.inco_conn_map_.end()) {
-        return it->second;
-    }
-    it = sel_.outg_conn_map_.find(socket_);
-    if(it != sel_.outg_conn_map_.end()) {
-        return it->second;
-    }
-    log_->critical("self_as_shared_ptr: no such connection, exit");
-    throw;
+    return shared_from_this();
 }
 
 const char *connection::get_host_ip() const
@@ -69,6 +101,9 @@ const char *connection::get_host_ip() const
     if(socket_ == INVALID_SOCKET) {
         return "invalid address";
     }
+    if(local_) {
+        return "local";
+    }
     sockaddr_in saddr;
     socklen_t len = sizeof(saddr);
     getpeername(socket_, (sockaddr *)&saddr, &len);
@@ -77,7 +112,7 @@ const char *connection::get_host_ip() const
 
 unsigned short connection::get_host_port() const
 {
-    if(socket_ == INVALID_SOCKET) {
+    if(socket_ == INVALID_SOCKET || local_) {
         return 0;
     }
     sockaddr_in saddr;
@@ -178,6 +213,12 @@ RetCode connection::establish_multicast(sockaddr_in &params)
             maddr.sin_addr.s_addr = htonl(INADDR_ANY);
             maddr.sin_port = addr_.sin_port;
 
+            //room for bursts of data chunks; the kernel caps it to its maximum.
+            int rcvbuf = MCAST_RCVBUF_SZ;
+            if(setsockopt(socket_, SOL_SOCKET, SO_RCVBUF, (char *)&rcvbuf, sizeof(rcvbuf)) < 0) {
+                log_->warn("setsockopt SO_RCVBUF:{}", errno);
+            }
+
             if(bind(socket_, (struct sockaddr *)&maddr, sizeof(struct sockaddr_in)) < 0) {
                 log_->critical("bind errno:{}", errno);
                 return RetCode_KO;
@@ -208,7 +249,7 @@ RetCode connection::establish_connection()
     return establish_connection(addr_);
 }
 
-RetCode connection::establish_connection(sockaddr_in &params)
+RetCode connection::create_socket(sockaddr_in &params)
 {
     if(con_type_ == ConnectionType_UDP_INGOING ||
             con_type_ == ConnectionType_UDP_OUTGOING) {
@@ -220,31 +261,69 @@ RetCode connection::establish_connection(sockaddr_in &params)
                 htons(params.sin_port));
 
     addr_ = params;
-    RetCode rcode = RetCode_OK;
-    int connect_res = 0;
-    if((socket_ = socket(AF_INET, SOCK_STREAM, 0)) != INVALID_SOCKET) {
-        socklen_t len = sizeof(sockaddr_in);
-        if((connect_res = connect(socket_, (struct sockaddr *)&addr_, len)) != INVALID_SOCKET) {
-            log_->debug("connect OK -> host:{} - port:{}",
-                        inet_ntoa(addr_.sin_addr),
-                        htons(addr_.sin_port));
-        } else {
-            log_->error("connect KO -> host:{} - port:{} - errno:{}",
-                        inet_ntoa(addr_.sin_addr),
-                        htons(addr_.sin_port),
-                        errno);
-        }
-    } else {
+    if((socket_ = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET) {
         log_->critical("errno:{}", errno);
+        return RetCode_KO;
+    }
+    if(set_socket_blocking_mode(false)) {
+        log_->critical("set socket not blocking");
+        close_connection();
+        return RetCode_KO;
     }
+    return RetCode_OK;
+}
 
-    if(!connect_res) {
-        rcode = set_connection_established();
-    } else {
+RetCode connection::establish_connection(sockaddr_in &params)
+{
+    RET_ON_KO(create_socket(params))
+
+    socklen_t len = sizeof(sockaddr_in);
+    if(!connect(socket_, (struct sockaddr *)&addr_, len)) {
+        log_->debug("connect OK -> host:{} - port:{}",
+                    inet_ntoa(addr_.sin_addr),
+                    htons(addr_.sin_port));
+        return set_connection_established();
+    }
+    if(errno == EINPROGRESS) {
+        log_->debug("connect in progress -> host:{} - port:{}",
+                    inet_ntoa(addr_.sin_addr),
+                    htons(addr_.sin_port));
+        status_ = ConnectionStatus_CONNECTING;
+        return RetCode_OK;
+    }
+
+    log_->error("connect KO -> host:{} - port:{} - errno:{}",
+                inet_ntoa(addr_.sin_addr),
+                htons(addr_.sin_port),
+                errno);
+    close_connection();
+    return RetCode_KO;
+}
+
+RetCode connection::complete_connection()
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if(getsockopt(socket_, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+        err = errno;
+    }
+    return complete_connection(err);
+}
+
+RetCode connection::complete_connection(int err)
+{
+    if(err) {
+        log_->error("connect KO -> host:{} - port:{} - errno:{}",
+                    inet_ntoa(addr_.sin_addr),
+                    htons(addr_.sin_port),
+                    err);
         close_connection();
-        rcode = RetCode_KO;
+        return RetCode_KO;
     }
-    return rcode;
+    log_->debug("connect OK -> host:{} - port:{}",
+                inet_ntoa(addr_.sin_addr),
+                htons(addr_.sin_port));
+    return set_connection_established();
 }
 
 RetCode connection::set_connection_established()
@@ -268,6 +347,11 @@ RetCode connection::set_connection_established()
 
 RetCode connection::close_connection()
 {
+    if(sel_.poller_) {
+        sel_.poller_->remove(socket_);
+    } else if(sel_.ring_) {
+        sel_.ring_release(*this);
+    }
     socket_shutdown();
     reset_rdn_outg_rep();
     log_->debug("connection disconnected: host:{}, port:{}",
@@ -292,7 +376,7 @@ void connection::reset_rdn_outg_rep()
     while(!pkt_sending_q_.empty()) {
         pkt_sending_q_.get();
     }
-    cpkt_.release();
+    snd_pkts_.clear();
     acc_snd_buff_.reset();
 }
 
@@ -307,15 +391,50 @@ RetCode connection::send(const std::string &pkt)
     return RetCode_KO;
 }
 
+RetCode connection::send(g_bbuf_ptr &&pkt)
+{
+    if(con_type_ == ConnectionType_TCP_INGOING ||
+            con_type_ == ConnectionType_TCP_OUTGOING) {
+        pkt_sending_q_.put(snd_pkt(std::move(pkt)));
+        sel_.notify(event(SendPacket, self_as_shared_ptr()));
+        return RetCode_OK;
+    } else if(con_type_ == ConnectionType_UDP_OUTGOING) {
+        return send_datagram(&pkt->buf_[pkt->pos_], pkt->available_read());
+    }
+    return RetCode_KO;
+}
+
+RetCode connection::send(const g_bslice &head, const g_bslice &tail)
+{
+    if(con_type_ != ConnectionType_TCP_INGOING &&
+            con_type_ != ConnectionType_TCP_OUTGOING) {
+        return RetCode_KO;
+    }
+    pkt_sending_q_.put(snd_pkt(head, tail));
+    sel_.notify(event(SendPacket, self_as_shared_ptr()));
+    return RetCode_OK;
+}
+
 RetCode connection::send_stream(const std::string &pkt)
 {
     uint sz = (uint)pkt.size();
-    g_bbuf *ppkt = new g_bbuf(sz+4);
+    g_bbuf_ptr ppkt = g_bbuf_pool::instance().acquire(sz+4);
     ppkt->append_uint(sz);
     ppkt->append(pkt.c_str(), 0, sz);
     ppkt->set_read();
-    pkt_sending_q_.put(std::unique_ptr<g_bbuf>(ppkt));
-    sel_.notify(new event(SendPacket, self_as_shared_ptr()));
+    pkt_sending_q_.put(snd_pkt(std::move(ppkt)));
+    sel_.notify(event(SendPacket, self_as_shared_ptr()));
+    return RetCode_OK;
+}
+
+RetCode connection::send_file(const std::shared_ptr<mem_file> &pkt)
+{
+    if(con_type_ != ConnectionType_TCP_INGOING &&
+            con_type_ != ConnectionType_TCP_OUTGOING) {
+        return RetCode_KO;
+    }
+    pkt_sending_q_.put(snd_pkt(pkt));
+    sel_.notify(event(SendPacket, self_as_shared_ptr()));
     return RetCode_OK;
 }
 
@@ -327,88 +446,123 @@ RetCode connection::send_datagram(const std::string &pkt)
     acc_snd_buff_.append_uint(sz);
     acc_snd_buff_.append(pkt.c_str(), 0, sz);
     acc_snd_buff_.set_read();
+    return send_datagram(&acc_snd_buff_.buf_[acc_snd_buff_.pos_], acc_snd_buff_.available_read());
+}
 
+RetCode connection::send_datagram(const char *pkt, size_t len)
+{
     int nbytes = sendto(socket_,
-                        &acc_snd_buff_.buf_[acc_snd_buff_.pos_],
-                        acc_snd_buff_.available_read(),
+                        pkt,
+                        len,
                         0,
                         (struct sockaddr *) &addr_,
                         sizeof(addr_));
     if(nbytes < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return RetCode_SCKWBLK;
+        }
         log_->error("send_datagram - errno:{}", errno);
         return RetCode_KO;
     }
     return RetCode_OK;
 }
 
-RetCode connection::send_acc_buff()
+RetCode connection::aggr_msgs_and_send_pkt()
 {
-    acc_snd_buff_.set_read();
-    if(!acc_snd_buff_.limit_) {
-        return RetCode_BADARG;
-    }
-    RetCode rcode = RetCode_OK;
-    bool stay = true;
-    long bsent = 0, tot_bsent = 0, remaining = (long)acc_snd_buff_.available_read();
-    while(stay) {
-        while(remaining && ((bsent = ::send(socket_,
-                                            &acc_snd_buff_.buf_[acc_snd_buff_.pos_],
-                                            (int)remaining, 0)) > 0)) {
-            acc_snd_buff_.advance_pos_read(bsent);
-            tot_bsent += bsent;
-            remaining -= bsent;
+    struct iovec iov[SND_IOV_MAX];
+    while(true) {
+        pull_snd_pkts();
+        if(snd_pkts_.empty()) {
+            return RetCode_OK;
         }
-        if(remaining) {
-            if((rcode = sckt_hndl_err(bsent)) == RetCode_SCKWBLK) {
-                acc_snd_buff_.set_mark();
-            }
-            stay = false;
-            break;
-        } else {
-            acc_snd_buff_.reset();
-            stay = false;
+
+        if(snd_pkts_.front().file_) {
+            RET_ON_KO(send_file_pkt(snd_pkts_.front()))
+            snd_pkts_.pop_front();
+            continue;
+        }
+
+        long bsent = writev(socket_, iov, fill_snd_iov(iov));
+        if(bsent <= 0) {
+            return sckt_hndl_err(bsent);
+        }
+        snd_pkts_sent(bsent);
+    }
+}
+
+void connection::pull_snd_pkts()
+{
+    //queued packets join the ones still being sent.
+    while(snd_pkts_.size() < SND_IOV_MAX && !pkt_sending_q_.empty()) {
+        snd_pkts_.push_back(pkt_sending_q_.get());
+    }
+}
+
+int connection::fill_snd_iov(struct iovec *iov)
+{
+    //one or two iovecs per packet: small packets are coalesced in a single writev.
+    int iovcnt = 0;
+    for(auto it = snd_pkts_.begin(); it != snd_pkts_.end() && !it->file_ && iovcnt < SND_IOV_MAX - 1; ++it) {
+        iovcnt += it->fill_iov(&iov[iovcnt]);
+    }
+    return iovcnt;
+}
+
+void connection::snd_pkts_sent(size_t bsent)
+{
+    //partial writes: the first packet not completely sent keeps its offset.
+    while(bsent) {
+        size_t avl = snd_pkts_.front().remaining();
+        if(bsent < avl) {
+            snd_pkts_.front().advance(bsent);
             break;
         }
+        bsent -= avl;
+        snd_pkts_.pop_front();
     }
-    return rcode;
 }
 
-RetCode connection::aggr_msgs_and_send_pkt()
+int connection::prep_send_msg()
 {
-    RetCode rcode = RetCode_OK;
-    /*  1
-        try to fill accumulating buffer with current packet and queued messages.
-    */
-    do {
-        acc_snd_buff_.set_read();
-        while(acc_snd_buff_.available_read() < acc_snd_buff_.capacity()) {
-            if(cpkt_ && cpkt_->available_read()) {
-                acc_snd_buff_.set_write();
-                if(!acc_snd_buff_.append_no_rsz(*cpkt_)) {
-                    //accumulating buffer filled.
-                    break;
-                } else {
-                    //current packet has completely read, it can be replaced.
-                }
-            } else {
-                if(!pkt_sending_q_.empty()) {
-                    cpkt_ = pkt_sending_q_.get();
-                    cpkt_->set_read();
-                } else {
-                    //current packet read and empty queue
-                    break;
-                }
-            }
+    memset(&snd_msg_, 0, sizeof(snd_msg_));
+    snd_msg_.msg_iov = snd_iov_;
+    snd_msg_.msg_iovlen = fill_snd_iov(snd_iov_);
+    return (int)snd_msg_.msg_iovlen;
+}
+
+RetCode connection::send_msg_done(int res)
+{
+    if(res <= 0) {
+        errno = -res;
+        return sckt_hndl_err(res ? SOCKET_ERROR : 0);
+    }
+    snd_pkts_sent(res);
+    return RetCode_OK;
+}
+
+RetCode connection::send_file_pkt(snd_pkt &pkt)
+{
+    //the kernel moves the file pages to the socket: no user space copy.
+    while(pkt.remaining()) {
+        long bsent = sendfile(socket_, pkt.file_->fd_, &pkt.file_off_, pkt.remaining());
+        if(bsent <= 0) {
+            return sckt_hndl_err(bsent);
         }
-        /*  2
-            send accumulating buffer
-        */
-    } while(!(rcode = send_acc_buff()) && (cpkt_->available_read() || !pkt_sending_q_.empty()));
-    return rcode;
+    }
+    return RetCode_OK;
+}
+
+bool connection::pending_output()
+{
+    return !snd_pkts_.empty() ||
+           !pkt_sending_q_.empty();
 }
 
 RetCode connection::recv_bytes(char *src_ip)
 {
+    if(recv_body_direct_ready()) {
+        return recv_body_direct();
+    }
     RetCode rcode = RetCode_OK;
     rdn_buff_.set_write();
     long brecv = 0, buf_rem_len = (long)rdn_buff_.remaining();
@@ -424,6 +578,11 @@ RetCode connection::recv_bytes(char *src_ip)
         rdn_buff_.move_pos_write(brecv);
         buf_rem_len -= brecv;
         inet_ntop(AF_INET, &src_addr.sin_addr, src_ip, 16);
+        if(con_type_ == ConnectionType_UDP_INGOING) {
+            //one datagram at a time: a datagram larger than the room left would be truncated,
+            //and each one is delivered with its own source.
+            return rcode;
+        }
     }
     if(brecv<=0) {
         rcode = sckt_hndl_err(brecv);
@@ -431,17 +590,109 @@ RetCode connection::recv_bytes(char *src_ip)
     return rcode;
 }
 
+bool connection::recv_body_direct_ready() const
+{
+    return (con_type_ == ConnectionType_TCP_INGOING || con_type_ == ConnectionType_TCP_OUTGOING) &&
+           pkt_ch_st_ == PktChasingStatus_Body &&
+           curr_rdn_body_ &&
+           curr_rdn_body_->position() < bdy_bytelen_ &&
+           !rdn_buff_.limit();
+}
+
+RetCode connection::recv_body_direct()
+{
+    long brecv = 0;
+    struct iovec iov[2];
+    rdn_buff_.reset();
+    do {
+        size_t bdy_rem = bdy_bytelen_ - curr_rdn_body_->position();
+        iov[0].iov_base = &curr_rdn_body_->buf_[curr_rdn_body_->position()];
+        iov[0].iov_len = bdy_rem;
+        iov[1].iov_base = rdn_buff_.buf_;
+        iov[1].iov_len = rdn_buff_.capacity();
+        if((brecv = readv(socket_, iov, 2)) <= 0) {
+            return sckt_hndl_err(brecv);
+        }
+        if((size_t)brecv > bdy_rem) {
+            //body completed: the next packets are in rdn_buff_.
+            curr_rdn_body_->move_pos_write(bdy_rem);
+            rdn_buff_.move_pos_write(brecv - bdy_rem);
+        } else {
+            curr_rdn_body_->move_pos_write(brecv);
+        }
+    } while(curr_rdn_body_->position() < bdy_bytelen_);
+    return RetCode_OK;
+}
+
+void connection::prep_recv_msg()
+{
+    memset(&rcv_msg_, 0, sizeof(rcv_msg_));
+    rcv_msg_.msg_iov = rcv_iov_;
+    if(recv_body_direct_ready()) {
+        //as recv_body_direct(): the rest of the body, then the next packets.
+        rdn_buff_.reset();
+        rcv_iov_[0].iov_base = &curr_rdn_body_->buf_[curr_rdn_body_->position()];
+        rcv_iov_[0].iov_len = bdy_bytelen_ - curr_rdn_body_->position();
+        rcv_iov_[1].iov_base = rdn_buff_.buf_;
+        rcv_iov_[1].iov_len = rdn_buff_.capacity();
+        rcv_msg_.msg_iovlen = 2;
+        return;
+    }
+    rdn_buff_.set_write();
+    rcv_iov_[0].iov_base = &rdn_buff_.buf_[rdn_buff_.pos_];
+    rcv_iov_[0].iov_len = rdn_buff_.remaining();
+    rcv_msg_.msg_iovlen = 1;
+    if(con_type_ == ConnectionType_UDP_INGOING) {
+        rcv_msg_.msg_name = &rcv_src_;
+        rcv_msg_.msg_namelen = sizeof(rcv_src_);
+    }
+}
+
+RetCode connection::recv_msg_done(int res, char *src_ip)
+{
+    if(res <= 0) {
+        errno = -res;
+        return sckt_hndl_err(res ? SOCKET_ERROR : 0);
+    }
+    inet_ntop(AF_INET, &rcv_src_.sin_addr, src_ip, 16);
+    if(rcv_msg_.msg_iovlen == 2) {
+        size_t bdy_rem = rcv_iov_[0].iov_len;
+        if((size_t)res > bdy_rem) {
+            //body completed: the next packets are in rdn_buff_.
+            curr_rdn_body_->move_pos_write(bdy_rem);
+            rdn_buff_.move_pos_write(res - bdy_rem);
+        } else {
+            curr_rdn_body_->move_pos_write(res);
+        }
+    } else {
+        rdn_buff_.move_pos_write(res);
+    }
+    return RetCode_OK;
+}
+
 RetCode connection::chase_pkt()
 {
     RetCode rcode = RetCode_PARTPKT;
     bool pkt_rdy = false, stay = true;
     rdn_buff_.set_read();
+    if(pkt_ch_st_ == PktChasingStatus_Body &&
+            curr_rdn_body_ &&
+            curr_rdn_body_->position() == bdy_bytelen_) {
+        //body completed by recv_body_direct()
+        curr_rdn_body_->set_read();
+        pkt_ch_st_ = PktChasingStatus_BodyLen;
+        pkt_rdy = true;
+    }
     while(stay && rdn_buff_.available_read() && !pkt_rdy) {
         switch(pkt_ch_st_) {
             case PktChasingStatus_BodyLen:
                 if(rdn_buff_.available_read() >= WORD_SZ) {
                     rdn_buff_.read_uint(&bdy_bytelen_);
                     pkt_ch_st_ = PktChasingStatus_Body;
+                    if(bdy_bytelen_ >= RCV_DIRECT_BDY_SZ) {
+                        //large body: allocated upfront, so that it can be received directly.
+                        curr_rdn_body_ = g_bbuf_pool::instance().acquire(bdy_bytelen_);
+                    }
                 } else {
                     stay = false;
                 }
@@ -449,10 +700,11 @@ RetCode connection::chase_pkt()
             case PktChasingStatus_Body:
                 if(rdn_buff_.available_read()) {
                     if(!curr_rdn_body_) {
-                        curr_rdn_body_.reset(new g_bbuf(bdy_bytelen_));
+                        curr_rdn_body_ = g_bbuf_pool::instance().acquire(bdy_bytelen_);
                     }
-                    rdn_buff_.read(std::min(curr_rdn_body_->remaining(), rdn_buff_.available_read()), *curr_rdn_body_);
-                    if(curr_rdn_body_->remaining()) {
+                    //pooled buffers can be larger than the body: the body length bounds the read.
+                    rdn_buff_.read(std::min(bdy_bytelen_ - curr_rdn_body_->position(), rdn_buff_.available_read()), *curr_rdn_body_);
+                    if(curr_rdn_body_->position() < bdy_bytelen_) {
                         stay = false;
                     } else {
                         curr_rdn_body_->set_read();
@@ -482,16 +734,16 @@ RetCode connection::chase_pkt()
 RetCode connection::recv_pkt(const char *src_ip)
 {
     RetCode rcode = RetCode_OK;
-    sel_.peer_.incoming_evt_q_.put(event(self_as_shared_ptr(),
-                                         std::move(curr_rdn_body_),
-                                         src_ip));
+    sel_.peer_.incoming_evt_q_.put(sel_.shard_id_, event(self_as_shared_ptr(),
+                                                         std::move(curr_rdn_body_),
+                                                         src_ip));
     return rcode;
 }
 
 void connection::on_established()
 {
     if(con_type_ == ConnectionType_TCP_INGOING) {
-        sel_.peer_.incoming_evt_q_.put(event(IncomingConnect, self_as_shared_ptr()));
+        sel_.peer_.incoming_evt_q_.put(sel_.shard_id_, event(IncomingConnect, self_as_shared_ptr()));
     }
 }
 
@@ -19,8 +19,13 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
 #pragma once
-#include "bbuf.h"
+#include "wire.h"
 #include "concurr.h"
+#include <deque>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#define SND_IOV_MAX 64  //max iovecs flushed with a single writev
 
 namespace nds {
 struct peer;
@@ -53,18 +58,55 @@ enum ConnectionType {
  */
 enum ConnectionStatus {
     ConnectionStatus_DISCONNECTED,
+    ConnectionStatus_CONNECTING,        //outgoing TCP connect in progress
     ConnectionStatus_ESTABLISHED,
 };
 
+/**
+ * A packet queued for sending over a TCP connection:
+ * either a buffer owned by the packet,
+ * or a head and a tail slice, shared with other packets and sent from where they are kept,
+ * or a whole mem_file, sent with sendfile().
+ */
+struct snd_pkt {
+    explicit snd_pkt() : off_(0), file_off_(0) {}
+    explicit snd_pkt(g_bbuf_ptr &&buf) : buf_(std::move(buf)), off_(0), file_off_(0) {}
+    explicit snd_pkt(const g_bslice &head, const g_bslice &tail) :
+        head_(head), tail_(tail), off_(0), file_off_(0) {}
+    explicit snd_pkt(const std::shared_ptr<mem_file> &file) : off_(0), file_(file), file_off_(0) {}
+
+    size_t remaining() const {
+        if(file_) {
+            return file_->len_ - (size_t)file_off_;
+        }
+        return buf_ ? buf_->available_read() : head_.size() + tail_.size() - off_;
+    }
+
+    //fills at most 2 iovecs with the bytes still to be sent, returns their number
+    int fill_iov(struct iovec *iov) const;
+
+    //marks amount bytes as sent
+    void advance(size_t amount);
+
+    g_bbuf_ptr buf_;
+    g_bslice head_;
+    g_bslice tail_;
+    //bytes of head_ and tail_ already sent
+    size_t off_;
+    std::shared_ptr<mem_file> file_;
+    //bytes of file_ already sent
+    off_t file_off_;
+};
+
 /**
  * A high-level abstraction of a UDP/TCP connection.
  * It provides methods for read/write from the associated socket.
  */
-struct connection {
+struct connection : public std::enable_shared_from_this<connection> {
 
     connection(selector &sel, ConnectionType ct);
 
-    std::shared_ptr<connection> &self_as_shared_ptr();
+    std::shared_ptr<connection> self_as_shared_ptr();
 
     const char *get_host_ip() const;
     unsigned short get_host_port() const;
@@ -77,9 +119,18 @@ struct connection {
 
     RetCode establish_multicast(sockaddr_in &params);
 
+    //non blocking: on return the connection can be either established or connecting.
     RetCode establish_connection();
     RetCode establish_connection(sockaddr_in &params);
 
+    //creates the non blocking socket of an outgoing connection, without connecting it.
+    RetCode create_socket(sockaddr_in &params);
+
+    //completes a connect in progress, once the socket has been reported writable;
+    //or with the error of a connect completed by the ring (0 on success).
+    RetCode complete_connection();
+    RetCode complete_connection(int err);
+
     RetCode set_connection_established();
     RetCode close_connection();
     RetCode socket_shutdown();
@@ -88,26 +139,63 @@ struct connection {
 
     //receiving, used by both TCP/UDP connections
     RetCode recv_bytes(char *src_ip);
+
+    //TCP only: the rest of a large body is received straight into curr_rdn_body_,
+    //any trailing bytes into rdn_buff_.
+    bool recv_body_direct_ready() const;
+    RetCode recv_body_direct();
     RetCode recv_pkt(const char *src_ip);
     RetCode chase_pkt();
     RetCode read_decode_hdr();
 
-    //accumulating-and-fire sending, only used by TCP connections
-    RetCode send_acc_buff();
+    //ring receiving: rcv_msg_ is set for the next receive (as recv_bytes would do),
+    //then the result of its completion is accounted.
+    void prep_recv_msg();
+    RetCode recv_msg_done(int res, char *src_ip);
+
+    //scatter-gather sending of the queued packets, only used by TCP connections
     RetCode aggr_msgs_and_send_pkt();
+    RetCode send_file_pkt(snd_pkt &);
+
+    //moves the queued packets behind the ones being sent.
+    void pull_snd_pkts();
+
+    //fills iov with the packets being sent up to the first mem_file one, returns the iovecs filled.
+    int fill_snd_iov(struct iovec *iov);
+
+    //marks bsent bytes of the packets being sent as sent.
+    void snd_pkts_sent(size_t bsent);
+
+    //ring sending: snd_msg_ is set with the packets being sent, returns the iovecs filled.
+    int prep_send_msg();
+    RetCode send_msg_done(int res);
+
+    //true if there are bytes still to be sent
+    bool pending_output();
 
     //send a string as a packet
     RetCode send(const std::string &pkt);
 
+    //send an already framed packet
+    RetCode send(g_bbuf_ptr &&pkt);
+
+    //send an already framed packet made of a head followed by a tail,
+    //without copying them; only used by TCP connections
+    RetCode send(const g_bslice &head, const g_bslice &tail = g_bslice());
+
     //send as stream, only used by TCP connections
     RetCode send_stream(const std::string &pkt);
 
+    //send an already framed packet held by a mem_file, only used by TCP connections
+    RetCode send_file(const std::shared_ptr<mem_file> &pkt);
+
     //single datagram sending, only used by UDP connections
     RetCode send_datagram(const std::string &pkt);
+    RetCode send_datagram(const char *pkt, size_t len);
 
     void on_established();
 
-    //parent
+    //parent: the selector owning this connection
     selector &sel_;
 
     ConnectionType con_type_;
@@ -115,19 +203,36 @@ struct connection {
     SOCKET socket_;
     struct sockaddr_in addr_;
 
+    //TCP ingoing only: accepted over the local socket, from a client on this host
+    bool local_;
+
+    //the time point at which a connect in progress is abandoned
+    std::chrono::steady_clock::time_point connect_deadline_;
+
     //reading rep
     PktChasingStatus pkt_ch_st_;
     unsigned int bdy_bytelen_;
     g_bbuf rdn_buff_;
-    std::unique_ptr<g_bbuf> curr_rdn_body_;
+    g_bbuf_ptr curr_rdn_body_;
 
     //packet sending queue
-    b_qu<std::unique_ptr<g_bbuf>> pkt_sending_q_;
-    //current sending packet
-    std::unique_ptr<g_bbuf> cpkt_;
-    //accumulating sending buffer
+    b_qu<snd_pkt> pkt_sending_q_;
+    //packets being sent, each one tracks its sent bytes
+    std::deque<snd_pkt> snd_pkts_;
+    //datagram sending buffer
     g_bbuf acc_snd_buff_;
 
+    //ring only: user data of the receive and of the connect or send in flight, 0 if none
+    uint64_t ring_rcv_id_;
+    uint64_t ring_snd_id_;
+
+    //ring only: headers of the receive and of the send in flight
+    struct msghdr rcv_msg_;
+    struct iovec rcv_iov_[2];
+    struct sockaddr_in rcv_src_;
+    struct msghdr snd_msg_;
+    struct iovec snd_iov_[SND_IOV_MAX];
+
     //logger
     std::shared_ptr<spdlog::logger> log_;
 };
@@ -0,0 +1,58 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "hlc.h"
+#include <algorithm>
+
+namespace nds {
+
+hlc::hlc() :
+    node_id_(0),
+    max_drift_ms_(0),
+    last_(0)
+{}
+
+static uint64_t wall_ms()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+uint64_t hlc::now()
+{
+    uint64_t pt = wall_ms();
+
+    //when the wall clock has not moved past the last timestamp, the logical counter is incremented;
+    //its overflow carries into the milliseconds.
+    last_ = std::max(pt << HLC_LOGICAL_BITS, last_ + 1);
+    return (last_ << HLC_NODE_BITS) | node_id_;
+}
+
+bool hlc::observe(uint64_t ts)
+{
+    //a node with its clock far ahead would drag every clock of the cluster along with it.
+    if(max_drift_ms_ && (ts >> (HLC_LOGICAL_BITS + HLC_NODE_BITS)) > wall_ms() + max_drift_ms_) {
+        return false;
+    }
+    last_ = std::max(last_, ts >> HLC_NODE_BITS);
+    return true;
+}
+
+}
@@ -0,0 +1,77 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+#include "nds.h"
+
+//bit layout of a hybrid logical clock timestamp:
+//[ 44 bits physical milliseconds | 8 bits logical counter | 12 bits node id ]
+#define HLC_NODE_BITS 12
+#define HLC_LOGICAL_BITS 8
+#define HLC_NODE_MASK ((1 << HLC_NODE_BITS) - 1)
+
+namespace nds {
+
+/**
+ * A hybrid logical clock.
+ *
+ * Timestamps generated by a clock are strictly increasing and greater than any timestamp
+ * observed from other nodes: they follow the wall clock when it moves forward,
+ * and the logical counter orders writes made within the same millisecond
+ * or while the wall clock lags behind the cluster.
+ * The node id tells apart timestamps generated by distinct nodes in the same millisecond:
+ * with 12 bits, ids picked at random do collide in a large cluster, so nodes announce theirs
+ * and pick a new one once they hear a node with the same id (see peer::process_alive).
+ * Timestamps are distinct across the cluster only among nodes with distinct ids; id 0 is the one
+ * of the timestamps of JSON-only nodes.
+ */
+struct hlc {
+    explicit hlc();
+
+    //a new timestamp, greater than any generated or observed before.
+    uint64_t now();
+
+    //merges a timestamp received from another node;
+    //false, leaving the clock as it is, if it is more than max_drift_ms_ ahead of the wall clock.
+    bool observe(uint64_t ts);
+
+    void set_node_id(uint16_t node_id) {
+        node_id_ = node_id & HLC_NODE_MASK;
+    }
+
+    //conversions from/to the seconds timestamps used by JSON-only nodes.
+    static uint64_t from_secs(uint32_t secs) {
+        return ((uint64_t)secs * 1000) << (HLC_LOGICAL_BITS + HLC_NODE_BITS);
+    }
+
+    static uint32_t to_secs(uint64_t ts) {
+        return (uint32_t)((ts >> (HLC_LOGICAL_BITS + HLC_NODE_BITS)) / 1000);
+    }
+
+    uint16_t node_id_;
+
+    //how far ahead of the wall clock an observed timestamp can be (0: no limit)
+    uint64_t max_drift_ms_;
+
+    //the last timestamp generated or observed, without node id
+    uint64_t last_;
+};
+
+}
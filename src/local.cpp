@@ -0,0 +1,264 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifdef __GNUG__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#include "local.h"
+
+//results larger than this are considered malformed
+#define LOCAL_RES_MAX_SZ (64*1024*1024)
+
+namespace nds {
+
+local_client::local_client() : socket_(INVALID_SOCKET), timeout_ms_(0) {}
+
+local_client::~local_client()
+{
+    disconnect();
+}
+
+RetCode local_client::connect(const std::string &path, uint32_t timeout_ms)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        return RetCode_BADARG;
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+
+    disconnect();
+    if((socket_ = socket(AF_UNIX, SOCK_STREAM, 0)) == INVALID_SOCKET) {
+        return RetCode_SYSERR;
+    }
+    //a daemon gone while serving a request must not block the client forever.
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    if(setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) ||
+            setsockopt(socket_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv))) {
+        disconnect();
+        return RetCode_SYSERR;
+    }
+    timeout_ms_ = timeout_ms;
+    if(::connect(socket_, (sockaddr *)&addr, sizeof(addr))) {
+        //no socket file or a stale one: no daemon is there.
+        disconnect();
+        return RetCode_UNVRSC;
+    }
+    return RetCode_OK;
+}
+
+void local_client::disconnect()
+{
+    if(socket_ != INVALID_SOCKET) {
+        close(socket_);
+        socket_ = INVALID_SOCKET;
+    }
+}
+
+RetCode local_client::get(const std::string &key, std::string &val, uint64_t &ts)
+{
+    return request(MsgType_LOCAL_GET, key, std::string(), val, ts);
+}
+
+RetCode local_client::set(const std::string &key, const std::string &val, uint64_t &ts)
+{
+    std::string res_val;
+    return request(MsgType_LOCAL_SET, key, val, res_val, ts);
+}
+
+RetCode local_client::set(const std::string &key, const std::string &val, unsigned acks, bool all,
+                          uint32_t timeout_ms, uint64_t &ts, unsigned &acked, uint64_t &latency_us)
+{
+    if(socket_ == INVALID_SOCKET) {
+        return RetCode_BADSTTS;
+    }
+    if(acks > 0xffff) {
+        return RetCode_BADARG;
+    }
+    RET_ON_KO(send_msg(MsgType_LOCAL_SET, key, val, 0, (uint16_t)acks, timeout_ms,
+                       all ? MsgFlag_WRITE_ALL : MsgFlag_WRITE_ACKS))
+
+    //the daemon answers once the write concern is met or its timeout expires.
+    RET_ON_KO(set_recv_timeout(timeout_ms + timeout_ms_))
+    std::string body;
+    msg m;
+    std::vector<kv_rec> recs;
+    RET_ON_KO(recv_msg(MsgType_LOCAL_RESULT, body, m, recs))
+    RET_ON_KO(set_recv_timeout(timeout_ms_))
+
+    std::vector<uint64_t> res;
+    if(recs.size() != 1 || decode_u64s(recs[0].val_, recs[0].val_len_, res) || (!res.empty() && res.size() != 2)) {
+        disconnect();
+        return RetCode_MALFORM;
+    }
+    ts = recs[0].ts_;
+    //a daemon not awaiting write concerns answers as soon as it has the value.
+    acked = res.empty() ? 0 : (unsigned)res[0];
+    latency_us = res.empty() ? 0 : res[1];
+    return (m.flags_ & MsgFlag_UNMET) ? RetCode_TIMEOUT : RetCode_OK;
+}
+
+RetCode local_client::version(uint64_t &ts)
+{
+    std::string res_val;
+    return request(MsgType_LOCAL_VERSION, std::string(), std::string(), res_val, ts);
+}
+
+RetCode local_client::watch(const std::string &key, uint64_t since, const watch_cb &cb)
+{
+    if(socket_ == INVALID_SOCKET) {
+        return RetCode_BADSTTS;
+    }
+    RET_ON_KO(send_msg(MsgType_LOCAL_WATCH, key, std::string(), since))
+
+    //changes can be far apart: only the daemon closing the socket ends the wait.
+    RET_ON_KO(set_recv_timeout(0))
+
+    std::string body;
+    std::vector<kv_rec> recs;
+    while(true) {
+        RET_ON_KO(recv_msg(MsgType_LOCAL_CHANGE, body, recs))
+        for(auto it = recs.begin(); it != recs.end(); ++it) {
+            if(!cb(std::string(it->key_, it->key_len_), std::string(it->val_, it->val_len_), it->ts_)) {
+                disconnect();
+                return RetCode_OK;
+            }
+        }
+    }
+}
+
+RetCode local_client::request(MsgType type, const std::string &key, const std::string &val,
+                              std::string &res_val, uint64_t &res_ts)
+{
+    if(socket_ == INVALID_SOCKET) {
+        return RetCode_BADSTTS;
+    }
+    RET_ON_KO(send_msg(type, key, val, 0))
+
+    std::string body;
+    std::vector<kv_rec> recs;
+    RET_ON_KO(recv_msg(MsgType_LOCAL_RESULT, body, recs))
+    if(recs.size() != 1) {
+        disconnect();
+        return RetCode_MALFORM;
+    }
+    res_val.assign(recs[0].val_, recs[0].val_len_);
+    res_ts = recs[0].ts_;
+    return RetCode_OK;
+}
+
+RetCode local_client::send_msg(MsgType type, const std::string &key, const std::string &val, uint64_t ts,
+                               uint16_t lp, uint64_t hdr_ts, uint16_t flags)
+{
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + WIRE_HDR_SZ + WIRE_KV_HDR_SZ + key.size() + val.size());
+    pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+    RET_ON_KO(append_kv_rec(*pkt, key, val.data(), val.size(), ts))
+    seal_bin_msg(*pkt, type, lp, hdr_ts, flags);
+    return send_all(&pkt->buf_[pkt->pos_], pkt->available_read());
+}
+
+RetCode local_client::recv_msg(MsgType type, std::string &body, std::vector<kv_rec> &recs)
+{
+    msg m;
+    return recv_msg(type, body, m, recs);
+}
+
+RetCode local_client::recv_msg(MsgType type, std::string &body, msg &m, std::vector<kv_rec> &recs)
+{
+    uint32_t bdy_len = 0;
+    RET_ON_KO(recv_all((char *)&bdy_len, sizeof(bdy_len)))
+    if(bdy_len > LOCAL_RES_MAX_SZ) {
+        disconnect();
+        return RetCode_MALFORM;
+    }
+    body.assign(bdy_len, '\0');
+    RET_ON_KO(recv_all(&body[0], bdy_len))
+
+    recs.clear();
+    if(decode_bin_msg(body.data(), body.size(), m) || m.type_ != type ||
+            decode_kv_recs(m.pl_, m.pl_len_, recs)) {
+        disconnect();
+        return RetCode_MALFORM;
+    }
+    return RetCode_OK;
+}
+
+RetCode local_client::set_recv_timeout(uint32_t timeout_ms)
+{
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    if(setsockopt(socket_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))) {
+        disconnect();
+        return RetCode_SYSERR;
+    }
+    return RetCode_OK;
+}
+
+RetCode local_client::send_all(const char *buf, size_t len)
+{
+    while(len) {
+        ssize_t bsent = ::send(socket_, buf, len, MSG_NOSIGNAL);
+        if(bsent < 0 && errno == EINTR) {
+            continue;
+        }
+        if(bsent <= 0) {
+            RetCode rcode = (bsent < 0 && errno == EAGAIN) ? RetCode_TIMEOUT : RetCode_SCKERR;
+            disconnect();
+            return rcode;
+        }
+        buf += bsent;
+        len -= (size_t)bsent;
+    }
+    return RetCode_OK;
+}
+
+RetCode local_client::recv_all(char *buf, size_t len)
+{
+    while(len) {
+        ssize_t brecv = ::recv(socket_, buf, len, 0);
+        if(brecv < 0 && errno == EINTR) {
+            continue;
+        }
+        if(brecv <= 0) {
+            RetCode rcode = brecv ? ((errno == EAGAIN) ? RetCode_TIMEOUT : RetCode_SCKERR) : RetCode_SCKCLO;
+            disconnect();
+            return rcode;
+        }
+        buf += brecv;
+        len -= (size_t)brecv;
+    }
+    return RetCode_OK;
+}
+
+std::string local_socket_path(const std::string &multicast_address, uint16_t multicast_port)
+{
+    std::ostringstream os;
+    os << "/tmp/nds." << multicast_address << "." << multicast_port << ".sock";
+    return os.str();
+}
+
+}
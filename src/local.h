@@ -0,0 +1,96 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+#include <functional>
+#include "wire.h"
+
+namespace nds {
+
+/**
+ * A client of the local API a daemon node serves over a unix domain socket.
+ *
+ * Requests and results are binary messages framed as over TCP, each one with a single
+ * key/value record as payload:
+ *
+ *  - local get: the key; the result has its value and version (empty and 0 if absent).
+ *  - local set: the key and the value; the result has the version assigned to the write.
+ *    A set carrying a write concern is answered once the concern is met or its timeout expires:
+ *    the result value has then the nodes that acknowledged it and the microseconds it took,
+ *    as two u64s, and the result is flagged as unmet on timeout.
+ *  - local version: an empty record; the result has the timestamp of the node.
+ *  - local watch: the key - empty for all the keys - and a version; no result, the daemon
+ *    pushes a local change with the records newer than the version, then one for each
+ *    new value, for as long as the client stays connected.
+ *
+ * A set is spread across the cluster by the daemon, as if it came from a setter node.
+ * Calls are synch: a client is meant to be used by a single thread.
+ */
+struct local_client {
+    //called for each change pushed to a watch; returning false ends it.
+    typedef std::function<bool(const std::string &key, const std::string &val, uint64_t ts)> watch_cb;
+
+    explicit local_client();
+    ~local_client();
+
+    //RetCode_UNVRSC if no daemon is listening on path.
+    RetCode connect(const std::string &path, uint32_t timeout_ms);
+    void disconnect();
+
+    RetCode get(const std::string &key, std::string &val, uint64_t &ts);
+    RetCode set(const std::string &key, const std::string &val, uint64_t &ts);
+
+    //a set waiting for acks nodes, or all the nodes heard lately, to acknowledge it for up to timeout_ms;
+    //RetCode_TIMEOUT if they did not: the write is kept and spread anyway.
+    RetCode set(const std::string &key, const std::string &val, unsigned acks, bool all, uint32_t timeout_ms,
+                uint64_t &ts, unsigned &acked, uint64_t &latency_us);
+    RetCode version(uint64_t &ts);
+
+    //blocks receiving the changes of a key newer than since, the version of the last change
+    //seen by a previous watch; returns RetCode_OK once cb ends it, an error if the daemon goes away.
+    RetCode watch(const std::string &key, uint64_t since, const watch_cb &cb);
+
+    //sends a request and waits for its result.
+    RetCode request(MsgType type, const std::string &key, const std::string &val,
+                    std::string &res_val, uint64_t &res_ts);
+
+    RetCode send_msg(MsgType type, const std::string &key, const std::string &val, uint64_t ts,
+                     uint16_t lp = 0, uint64_t hdr_ts = 0, uint16_t flags = 0);
+
+    //receives a message of the given type and the records it carries, backed by body.
+    RetCode recv_msg(MsgType type, std::string &body, std::vector<kv_rec> &recs);
+    RetCode recv_msg(MsgType type, std::string &body, msg &m, std::vector<kv_rec> &recs);
+
+    //0 waits forever.
+    RetCode set_recv_timeout(uint32_t timeout_ms);
+
+    RetCode send_all(const char *buf, size_t len);
+    RetCode recv_all(char *buf, size_t len);
+
+    SOCKET socket_;
+
+    //the timeout given on connect.
+    uint32_t timeout_ms_;
+};
+
+//the path of the local socket served by the daemon joining a multicast group.
+std::string local_socket_path(const std::string &multicast_address, uint16_t multicast_port);
+
+}
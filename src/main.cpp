@@ -45,6 +45,50 @@ int main(int argc, char *argv[])
                    .doc("listen on the specified port")
                    & clipp::value("listening port", pr.cfg_.listening_port),
 
+                   clipp::option("-m", "--multiplexer")
+                   .doc("specify I/O multiplexer [epoll (default), uring, select]")
+                   & clipp::value("multiplexer", pr.cfg_.multiplexer),
+
+                   clipp::option("-t", "--io-threads")
+                   .doc("specify the number of selector threads TCP connections are spread across [1 (default)]")
+                   & clipp::value("io threads", pr.cfg_.io_threads),
+
+                   clipp::option("-w", "--wire-protocol")
+                   .doc("specify the wire protocol used to send messages [auto (default), binary, json]")
+                   & clipp::value("wire protocol", pr.cfg_.wire_protocol),
+
+                   clipp::option("-M", "--multicast-data")
+                   .set(pr.cfg_.multicast_data, true)
+                   .doc("multicast the value set in chunks to all the nodes at once, instead of letting each node request it"),
+
+                   clipp::option("--mcast-max")
+                   .doc("specify the bytes of the largest value multicast or received in chunks, larger ones are requested over TCP [16777216 (default)]")
+                   & clipp::value("mcast max", pr.cfg_.mcast_max),
+
+                   clipp::option("-i", "--inline-max")
+                   .doc("specify the bytes of the last writes that can ride inside the alive message [1200 (default), 0 disables]")
+                   & clipp::value("inline max", pr.cfg_.inline_max),
+
+                   clipp::option("--max-drift")
+                   .doc("specify the milliseconds a timestamp received can be ahead of the wall clock, farther ones are not followed by the clock [60000 (default), 0 disables]")
+                   & clipp::value("max drift", pr.cfg_.max_drift_ms),
+
+                   clipp::option("-u", "--unix-socket")
+                   .doc("specify the local socket served by a node and tried first by set/get/version [derived from the multicast group (default), none disables]")
+                   & clipp::value("local socket", pr.cfg_.local_socket),
+
+                   clipp::option("-s", "--shm")
+                   .set(pr.cfg_.shm, true)
+                   .doc("publish the store in shared memory (node), read the value from it (get/version)"),
+
+                   clipp::option("--shm-size")
+                   .doc("specify the bytes of the shared memory the store is published in [1048576 (default)]")
+                   & clipp::value("shm size", pr.cfg_.shm_size),
+
+                   clipp::option("-c", "--write-concern")
+                   .doc("specify the other nodes that must acknowledge a value set before it completes [1 (default), N, all, 0 does not wait]")
+                   & clipp::value("write concern", pr.cfg_.write_concern),
+
                    clipp::option("-l", "--log")
                    .doc("specify logging type [console (default), file name")
                    & clipp::value("logging type", pr.cfg_.log_type),
@@ -55,12 +99,29 @@ int main(int argc, char *argv[])
 
                    clipp::option("set")
                    .set(pr.cfg_.get_val, false)
-                   .doc("set the value shared across the cluster")
+                   .doc("set the value of a key shared across the cluster")
+                   & clipp::value("key", pr.cfg_.key)
                    & clipp::value("value", pr.cfg_.val),
 
                    clipp::option("get")
                    .set(pr.cfg_.get_val, true)
-                   .doc("get the value shared across the cluster")
+                   .doc("get the value of a key shared across the cluster")
+                   & clipp::value("key", pr.cfg_.key),
+
+                   clipp::option("version")
+                   .set(pr.cfg_.get_version, true)
+                   .set(pr.cfg_.get_val, false)
+                   .doc("get the timestamp of the cluster"),
+
+                   clipp::option("watch")
+                   .set(pr.cfg_.watch, true)
+                   .set(pr.cfg_.get_val, false)
+                   .doc("print the version and the value of a key each time it changes, through the node running on this host")
+                   & clipp::value("key", pr.cfg_.key),
+
+                   clipp::option("--since")
+                   .doc("specify the version a watch resumes from: only newer values are printed [0 (default)]")
+                   & clipp::value("version", pr.cfg_.watch_since)
                );
 
     if(!clipp::parse(argc, argv, cli)) {
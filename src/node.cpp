@@ -0,0 +1,100 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "node.h"
+
+namespace nds {
+
+node::node() {}
+
+node::~node()
+{
+    stop_node();
+}
+
+RetCode node::start_node(const peer::cfg &cfg)
+{
+    if(th_) {
+        return RetCode_BADSTTS;
+    }
+    pr_.cfg_ = cfg;
+    pr_.cfg_.start_node = true;
+    pr_.cfg_.get_val = false;
+    pr_.cfg_.key.clear();
+    pr_.selector_.srv_sockaddr_in_.sin_port = htons(pr_.cfg_.listening_port);
+
+    RET_ON_KO(pr_.init())
+    RET_ON_KO(pr_.start())
+    RET_ON_KO(pr_.join_cluster())
+    th_.reset(new std::thread([&]() {
+        pr_.serve();
+    }));
+    return RetCode_OK;
+}
+
+RetCode node::stop_node()
+{
+    if(!th_) {
+        return RetCode_OK;
+    }
+    pr_.stop();
+    th_->join();
+    th_.reset();
+    return RetCode_OK;
+}
+
+void node::on_change(const change_cb &cb)
+{
+    pr_.on_change_ = cb;
+}
+
+std::future<api_result> node::get_async(const std::string &key)
+{
+    return request(MsgType_LOCAL_GET, key, std::string());
+}
+
+std::future<api_result> node::set_async(const std::string &key, const std::string &val)
+{
+    return request(MsgType_LOCAL_SET, key, val);
+}
+
+std::future<api_result> node::version_async()
+{
+    return request(MsgType_LOCAL_VERSION, std::string(), std::string());
+}
+
+std::future<api_result> node::request(MsgType type, const std::string &key, const std::string &val)
+{
+    api_req req;
+    req.type_ = type;
+    req.key_ = key;
+    req.val_ = val;
+    std::future<api_result> res = req.res_.get_future();
+    if(!th_) {
+        api_result bad;
+        bad.rcode_ = RetCode_BADSTTS;
+        req.res_.set_value(bad);
+        return res;
+    }
+    pr_.submit(std::move(req));
+    return res;
+}
+
+}
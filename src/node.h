@@ -0,0 +1,64 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+#include "peer.h"
+
+namespace nds {
+
+/**
+ * node
+ *
+ * A NDS daemon node embedded in the process of a service, linking libnds.
+ * start_node() spawns the selector threads and the peer thread, then it returns:
+ * requests are handed over to the peer thread and their results are delivered through futures,
+ * without any process spawn nor IPC.
+ * The change callback is called by the peer thread for each key written, whatever the origin
+ * of the write: it must be set before starting the node and it must not block.
+ */
+struct node {
+    explicit node();
+    ~node();
+
+    //cfg is the one of a daemon node.
+    RetCode start_node(const peer::cfg &cfg);
+    RetCode stop_node();
+
+    void on_change(const change_cb &cb);
+
+    //the value and the version of a key (empty and 0 if absent).
+    std::future<api_result> get_async(const std::string &key);
+
+    //completes once the other nodes of cfg write_concern have acknowledged the write, or with
+    //RetCode_TIMEOUT if they did not within cfg ack_timeout_ms: the write is kept and spread anyway.
+    std::future<api_result> set_async(const std::string &key, const std::string &val);
+
+    //the timestamp of the node.
+    std::future<api_result> version_async();
+
+    std::future<api_result> request(MsgType type, const std::string &key, const std::string &val);
+
+    peer pr_;
+
+    //the peer thread
+    std::unique_ptr<std::thread> th_;
+};
+
+}
@@ -19,14 +19,41 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
 #include "peer.h"
+#include "local.h"
+#include <random>
+#include <algorithm>
 
 #define NDS_INT_AWT_TIMEOUT 1
 
+//data messages at least this long are served from a mem_file with sendfile()
+#define LARGE_DATA_SZ (1024*1024)
+
+//seconds without hearing JSON-only nodes before auto wire protocol switches to binary
+#define JSON_NODE_TTL 60
+
+//seconds a reconciliation is allowed to take before being abandoned
+#define RECONCILE_TIMEOUT 10
+
+//milliseconds without progress before the missing chunks of a transfer are requested again
+#define MCAST_NAK_IVL_MS 500
+
+//max chunks requested by a single negative acknowledgement
+#define MCAST_NAK_MAX 4096
+
+//seconds without progress before a transfer is abandoned to the synch driven by alive messages
+#define MCAST_XFER_TIMEOUT 4
+
+//seconds a complete transfer is kept to repair the ones of other nodes
+#define MCAST_XFER_TTL 30
+
 namespace nds {
 
 /**
  * Protocol keys (starting with:_) and fixed values.
  * Keys/values are put inside a Json message.
+ * Nodes supporting the binary wire protocol (see wire.h) add their wire version (_wv)
+ * to Json messages; they decode both formats and send binary messages only
+ * when no JSON-only node is around (wire protocol auto).
  *
  * An example of alive message (UDP multicast):
  *
@@ -34,7 +61,8 @@ namespace nds {
  *       "_lp" : 31582,
  *       "_pt" : "an",
  *       "_si" : "172.17.0.2",
- *       "_ts" : 1612981749
+ *       "_ts" : 1612981749,
+ *       "_wv" : 1
  *      }
  *
  * An example of Data message (TCP):
@@ -45,10 +73,17 @@ namespace nds {
  *      "_ts" : 1612981862
  *     }
  *
+ * An example of Data Request message (TCP), sent over an already established connection:
+ *
+ *     {
+ *      "_pt" : "dr"
+ *     }
+ *
 */
 const std::string pkt_type              = "_pt";    //packet type
 const std::string pkt_type_alive_node   = "an";     //packet type value: Alive Node (UDP multicast)
 const std::string pkt_type_data         = "dt";     //packet type value: Data (TCP)
+const std::string pkt_type_data_request = "dr";     //packet type value: Data Request (TCP)
 
 //packet source ip: the ip of the outgoing interface of the source host
 const std::string pkt_source_ip         = "_si";
@@ -56,8 +91,18 @@ const std::string pkt_source_ip         = "_si";
 //packet source listening port: the listening port of the source host
 const std::string pkt_listening_port    = "_lp";
 
-const std::string pkt_ts                = "_ts";    //packet timestamp: the timestamp of the packet
+const std::string pkt_ts                = "_ts";    //packet timestamp: the timestamp of the packet, in seconds
+const std::string pkt_hlc               = "_hlc";   //packet hybrid logical clock: the timestamp of the packet, absent for JSON-only nodes
 const std::string pkt_data_value        = "_dv";    //packet data: the value inside a Data packet (TCP)
+const std::string pkt_wire_version      = "_wv";    //packet wire version: absent for JSON-only nodes
+const std::string pkt_shard_versions    = "_sv";    //packet shard versions: the versions of the store shards (UDP)
+const std::string pkt_kv                = "_kv";    //packet key/values: the records inside a Data packet (TCP)
+const std::string pkt_key               = "_k";     //packet key: the key of a record
+const std::string pkt_shard_requests    = "_rq";    //packet shard requests: [shard, since] pairs inside a Data Request packet (TCP)
+const std::string pkt_inline            = "_il";    //packet inline: the records of the last writes inside an Alive packet (UDP)
+const std::string pkt_shard             = "_sh";    //packet shard: the shard of an inlined record
+const std::string pkt_since             = "_sn";    //packet since: the version of the shard before an inlined record
+const std::string pkt_node_id           = "_ni";    //packet node id: the hlc node id of the source of an Alive packet (UDP)
 
 //packet interrupt: a key used to generate events inside the application (interrupts generated by selector/peer thread)
 const std::string pkt_interrupt         = "_ir";
@@ -65,8 +110,12 @@ const std::string pkt_interrupt         = "_ir";
 // peer
 
 peer::peer() :
-    selector_(*this)
-{}
+    selector_(*this),
+    next_shard_idx_(0)
+{
+    Json::CharReaderBuilder builder;
+    json_reader_.reset(builder.newCharReader());
+}
 
 peer::~peer()
 {
@@ -88,14 +137,51 @@ spdlog::level::level_enum peer::cfg::get_spdloglvl() const
     }
 }
 
+std::string peer::cfg::get_local_socket() const
+{
+    if(local_socket == "none") {
+        return std::string();
+    }
+    return local_socket.empty() ? local_socket_path(multicast_address, multicast_port) : local_socket;
+}
+
+std::string peer::cfg::get_shm_name() const
+{
+    return shm_segment_name(multicast_address, multicast_port);
+}
+
 #define NODE_SYNCH_DURATION 2
 
-RetCode peer::init()
+//seconds a node not heard anymore is still waited for by a write concern of all
+#define NODE_SEEN_TIMEOUT 10
+
+//milliseconds a write concern of all waits for other nodes to show up,
+//once the nodes heard have acknowledged the write
+#define WRITE_ALL_SETTLE_MS 50
+
+RetCode peer::cfg::get_write_concern(unsigned &acks, bool &all) const
 {
-    RetCode rcode = RetCode_OK;
+    all = write_concern == "all";
+    if(all) {
+        acks = 0;
+        return RetCode_OK;
+    }
+    char *end = nullptr;
+    unsigned long val = strtoul(write_concern.c_str(), &end, 10);
+    if(write_concern.empty() || *end || val > 0xffff) {
+        return RetCode_BADCFG;
+    }
+    acks = (unsigned)val;
+    return RetCode_OK;
+}
 
-    //logger init
-    std::shared_ptr<spdlog::logger> log;
+std::shared_ptr<spdlog::logger> peer::get_log() const
+{
+    //already made serving a set through the local daemon.
+    std::shared_ptr<spdlog::logger> log = spdlog::get(cfg_.log_type);
+    if(log) {
+        return log;
+    }
     if(cfg_.log_type == "console") {
         log = spdlog::stdout_color_mt("console");
     } else {
@@ -105,10 +191,34 @@ RetCode peer::init()
     log->set_pattern("[%H:%M:%S:%e][%t][%^%l%$]%v");
     log->set_level(cfg_.get_spdloglvl());
     spdlog::flush_every(std::chrono::seconds(2));
-    log_ = log;
+    return log;
+}
+
+RetCode peer::init()
+{
+    RetCode rcode = RetCode_OK;
+
+    //logger init
+    log_ = get_log();
+
+    if((rcode = cfg_.get_write_concern(write_acks_, write_all_))) {
+        log_->error("bad write concern:{}", cfg_.write_concern);
+        return rcode;
+    }
 
-    //selector init
+    //one incoming ring for each selector thread, plus one for the API
+    incoming_evt_q_.set_producers(api_producer() + 1);
+
+    //timestamps generated by distinct nodes in the same millisecond are told apart by their node id
+    renew_node_id();
+    hlc_.max_drift_ms_ = cfg_.max_drift_ms;
+
+    //selectors init
     RET_ON_KO(selector_.init())
+    for(unsigned shard_id = 1; shard_id < cfg_.io_threads; ++shard_id) {
+        io_shards_.emplace_back(new selector(*this, shard_id));
+        RET_ON_KO(io_shards_.back()->init())
+    }
 
     //seconds before this node will auto generate the timestamp
     tp_initial_synch_window_ = std::chrono::system_clock::now() + std::chrono::duration<int>(NODE_SYNCH_DURATION);
@@ -116,37 +226,63 @@ RetCode peer::init()
     return rcode;
 }
 
-RetCode peer::start()
+RetCode peer::start_selector(selector &sel)
+{
+    SelectorStatus current = SelectorStatus_UNDEF;
+
+    log_->debug("start selector:{} thread", sel.shard_id_);
+    sel.start();
+    log_->debug("wait selector:{} go init", sel.shard_id_);
+    sel.await_for_status_reached(SelectorStatus_INIT,
+                                 current,
+                                 NDS_INT_AWT_TIMEOUT,
+                                 0);
+
+    log_->debug("request selector:{} go ready", sel.shard_id_);
+    sel.set_status(SelectorStatus_REQUEST_READY);
+    log_->debug("wait selector:{} go ready", sel.shard_id_);
+    sel.await_for_status_reached(SelectorStatus_READY,
+                                 current,
+                                 NDS_INT_AWT_TIMEOUT,
+                                 0);
+
+    log_->debug("request selector:{} go selecting", sel.shard_id_);
+    sel.set_status(SelectorStatus_REQUEST_SELECT);
+
+    sel.await_for_status_reached(SelectorStatus_SELECT,
+                                 current,
+                                 NDS_INT_AWT_TIMEOUT,
+                                 0);
+
+    log_->debug("selector:{} is selecting", sel.shard_id_);
+    return RetCode_OK;
+}
+
+RetCode peer::stop_selector(selector &sel)
 {
+    log_->debug("request selector:{} to stop", sel.shard_id_);
+    sel.set_status(SelectorStatus_REQUEST_STOP);
+    sel.interrupt();
+
     SelectorStatus current = SelectorStatus_UNDEF;
+    sel.await_for_status_reached(SelectorStatus_STOPPED, current);
+    //the selector thread could still be running after having reported STOPPED.
+    sel.join();
+    log_->debug("selector:{} stopped", sel.shard_id_);
+    sel.set_status(SelectorStatus_INIT);
+    return RetCode_OK;
+}
+
+RetCode peer::start()
+{
     RetCode rcode = RetCode_OK;
     exit_required_ = false;
 
-    log_->debug("start selector thread");
-    selector_.start();
-    log_->debug("wait selector go init");
-    selector_.await_for_status_reached(SelectorStatus_INIT,
-                                       current,
-                                       NDS_INT_AWT_TIMEOUT,
-                                       0);
-
-    log_->debug("request selector go ready");
-    selector_.set_status(SelectorStatus_REQUEST_READY);
-    log_->debug("wait selector go ready");
-    selector_.await_for_status_reached(SelectorStatus_READY,
-                                       current,
-                                       NDS_INT_AWT_TIMEOUT,
-                                       0);
-
-    log_->debug("request selector go selecting");
-    selector_.set_status(SelectorStatus_REQUEST_SELECT);
-
-    selector_.await_for_status_reached(SelectorStatus_SELECT,
-                                       current,
-                                       NDS_INT_AWT_TIMEOUT,
-                                       0);
-
-    log_->debug("selector is selecting");
+    //shards first: the primary selector hands accepted connections over to them.
+    for(auto it = io_shards_.begin(); it != io_shards_.end(); ++it) {
+        RET_ON_KO(start_selector(**it))
+    }
+    RET_ON_KO(start_selector(selector_))
     return rcode;
 }
 
@@ -155,228 +291,1917 @@ RetCode peer::stop()
     RetCode rcode = RetCode_OK;
     exit_required_ = true;
 
-    log_->debug("request selector to stop");
-    selector_.set_status(SelectorStatus_REQUEST_STOP);
-    selector_.interrupt();
-
-    SelectorStatus current = SelectorStatus_UNDEF;
-    selector_.await_for_status_reached(SelectorStatus_STOPPED, current);
-    log_->debug("selector stopped");
-    selector_.set_status(SelectorStatus_INIT);
+    if(!log_) {
+        //served by a local daemon: this node has never been started.
+        return rcode;
+    }
 
+    //primary first: no more connections are accepted and handed over to the shards.
+    stop_selector(selector_);
+    for(auto it = io_shards_.begin(); it != io_shards_.end(); ++it) {
+        stop_selector(**it);
+    }
+    log_->debug("bbuf pool hits:{}, misses:{}",
+                g_bbuf_pool::instance().hits(),
+                g_bbuf_pool::instance().misses());
     return rcode;
 }
 
+selector &peer::next_shard()
+{
+    unsigned idx = next_shard_idx_++ % (unsigned)(io_shards_.size() + 1);
+    return idx ? *io_shards_[idx - 1] : selector_;
+}
+
 RetCode peer::process_incoming_events()
 {
     RetCode rcode = RetCode_OK;
     log_->debug("processing incoming events ...");
 
+    //all the events available are consumed at each wakeup.
+    std::vector<event> evts;
     while(true) {
-        event evt = incoming_evt_q_.get();
-        Json::Value json_evt = evt_to_json(evt);
+        evts.clear();
+        incoming_evt_q_.get_batch(evts);
+        for(auto it = evts.begin(); it != evts.end(); ++it) {
+            if(process_incoming_event(*it) == RetCode_EXIT) {
+                return rcode;
+            }
+        }
+        //once for all the writes of the batch.
+        publish_shm();
+    }
+
+    return rcode;
+}
+
+RetCode peer::process_incoming_event(event &evt)
+{
+    msg m;
+    Json::Value json_evt;
+    if(evt.evt_ == PacketAvailable && decode_evt(evt, m, json_evt)) {
+        log_->error("discarding malformed packet");
+        return RetCode_OK;
+    }
 
-        if(evt.evt_ == Interrupt) {
+    if(evt.evt_ == Interrupt) {
 #if 0
-            log_->trace("peer received an interrupt");
+        log_->trace("peer received an interrupt");
 #endif
-            if(process_node_status() == RetCode_EXIT) {
-                break;
-            }
-        } else if(evt.evt_ == IncomingConnect) {
-            log_->debug("sending data to node");
-            send_data_msg(*evt.conn_);
-        } else if((evt.evt_ == PacketAvailable) && foreign_evt(json_evt)) {
-            //packet from multicast or tcp connection
-            log_->trace("evt:\n{}", json_evt.toStyledString());
-            if(process_foreign_evt(evt, json_evt) == RetCode_EXIT) {
-                break;
-            }
-        } else {
-            log_->debug("evt is from this node, discarding ...");
+        return process_node_status();
+    } else if(evt.evt_ == IncomingConnect) {
+        //JSON-only nodes expect the data as soon as they connect; other nodes send a data request.
+        if(!bin_wire() && !evt.conn_->local_) {
+            send_json_only_data_msg(*evt.conn_);
         }
+    } else if(evt.evt_ == Disconnect && evt.conn_->local_) {
+        process_local_conn_closed(evt);
+    } else if(evt.evt_ == ConnectFailed || evt.evt_ == Disconnect) {
+        process_outg_conn_closed(evt);
+    } else if(evt.evt_ == ApiRequest) {
+        return process_api_reqs();
+    } else if((evt.evt_ == PacketAvailable) && foreign_msg(m, evt.opt_src_ip_)) {
+        //packet from multicast or tcp connection
+        log_->trace("msg type:{}, ver:{}, json:{}, lp:{}, ts:{}, pl_len:{}",
+                    m.type_, m.version_, m.json_, m.lp_, m.ts_, m.pl_len_);
+        return process_foreign_evt(evt, m, json_evt);
+    } else {
+        log_->debug("evt is from this node, discarding ...");
     }
+    return RetCode_OK;
+}
 
-    return rcode;
+RetCode peer::process_foreign_evt(event &evt, const msg &m, const Json::Value &json_evt)
+{
+    if(!m.version_) {
+        log_->debug("message from a JSON-only node");
+        tp_json_node_seen_ = std::chrono::system_clock::now();
+    }
+
+    if(m.type_ == MsgType_ALIVE_NODE) {
+        return m.version_ ? process_alive(evt, m, json_evt) : process_json_only_alive(evt, m);
+    } else if(m.type_ == MsgType_DATA) {
+        return process_data(evt, m, json_evt);
+    } else if(m.type_ == MsgType_DATA_REQUEST) {
+        return process_data_request(evt, m, json_evt);
+    } else if(m.type_ == MsgType_DIGEST_REQUEST && !m.json_) {
+        return process_digest_request(evt, m);
+    } else if(m.type_ == MsgType_DIGEST && !m.json_) {
+        return process_digest(evt, m);
+    } else if(m.type_ == MsgType_RECONCILE_REQUEST && !m.json_) {
+        return process_reconcile_request(evt, m);
+    } else if(m.type_ == MsgType_DATA_ANNOUNCE && !m.json_) {
+        return process_data_announce(evt, m);
+    } else if(m.type_ == MsgType_DATA_CHUNK && !m.json_) {
+        return process_data_chunk(m);
+    } else if(m.type_ == MsgType_DATA_NAK && !m.json_) {
+        return process_data_nak(evt, m);
+    } else if(m.type_ == MsgType_DATA_ACK && !m.json_) {
+        return process_data_ack(evt, m);
+    } else if(m.type_ >= MsgType_LOCAL_GET && m.type_ <= MsgType_LOCAL_VERSION && !m.json_ && evt.conn_->local_) {
+        return process_local_request(evt, m);
+    } else if(m.type_ == MsgType_LOCAL_WATCH && !m.json_ && evt.conn_->local_) {
+        return process_local_watch(evt, m);
+    }
+    log_->error("unk msg type: {}", m.type_);
+    return RetCode_OK;
 }
 
-RetCode peer::process_foreign_evt(event &evt, Json::Value &json_evt)
+RetCode peer::process_alive(event &evt, const msg &m, const Json::Value &json_evt)
 {
-    RetCode rcode = RetCode_OK;
-    std::string ptype = json_evt[pkt_type].asString();
+    uint64_t oth_ts = m.ts_;
+    observe(oth_ts, evt.opt_src_ip_);
+
+    std::vector<uint64_t> oth_vers;
+    std::vector<inline_rec> inl_recs;
+    if(m.json_) {
+        const Json::Value &sv = json_evt[pkt_shard_versions];
+        for(Json::ArrayIndex i = 0; sv.isArray() && i < sv.size(); ++i) {
+            if(!sv[i].isUInt64()) {
+                log_->error("discarding alive evt with bad shard versions");
+                return RetCode_OK;
+            }
+            oth_vers.push_back(sv[i].asUInt64());
+        }
+        const Json::Value &il = json_evt[pkt_inline];
+        for(Json::ArrayIndex i = 0; il.isArray() && i < il.size(); ++i) {
+            inline_rec rec;
+            const char *end = nullptr;
+            if(!il[i].isObject() ||
+                    !il[i][pkt_key].isString() || !il[i][pkt_data_value].isString() ||
+                    !il[i].get(pkt_shard, 0).isUInt() || !il[i].get(pkt_since, 0).isUInt64() ||
+                    !il[i].get(pkt_hlc, 0).isUInt64()) {
+                continue;
+            }
+            rec.req_.shard_ = il[i][pkt_shard].asUInt();
+            rec.req_.since_ = il[i][pkt_since].asUInt64();
+            il[i][pkt_key].getString(&rec.rec_.key_, &end);
+            rec.rec_.key_len_ = end - rec.rec_.key_;
+            il[i][pkt_data_value].getString(&rec.rec_.val_, &end);
+            rec.rec_.val_len_ = end - rec.rec_.val_;
+            rec.rec_.ts_ = il[i][pkt_hlc].asUInt64();
+            inl_recs.push_back(rec);
+        }
+    } else {
+        //the records inlined follow the shard versions and the digest.
+        size_t vers_len = std::min(m.pl_len_, (STORE_SHARDS + 1) * sizeof(uint64_t));
+        if(decode_u64s(m.pl_, vers_len, oth_vers) ||
+                decode_inline_recs(m.pl_ + vers_len, m.pl_len_ - vers_len, inl_recs)) {
+            oth_vers.clear();
+        }
+    }
+    //binary alive messages carry the digest of the store after the shard versions.
+    bool has_digest = !m.json_ && oth_vers.size() == STORE_SHARDS + 1;
+    uint64_t oth_digest = 0;
+    if(has_digest) {
+        oth_digest = oth_vers.back();
+        oth_vers.pop_back();
+    }
+    if(oth_vers.size() != STORE_SHARDS) {
+        log_->error("discarding alive evt with bad shard versions");
+        return RetCode_OK;
+    }
+    //a node holds the writes up to the versions it announces.
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+    std::string node = node_key(evt.opt_src_ip_, m.lp_);
+    node_seen(node, now);
+    ack_writes(node, oth_vers);
+    if(complete_writes(now) == RetCode_EXIT) {
+        return RetCode_EXIT;
+    }
 
-    if(ptype == pkt_type_alive_node) {
-        time_t oth_ts = json_evt[pkt_ts].asUInt();
+    //two nodes with the same node id could generate the same timestamp: both pick a new one.
+    bool has_id = m.json_ ? json_evt.get(pkt_node_id, Json::Value()).isUInt() : (m.flags_ & MsgFlag_NODE_ID) != 0;
+    uint16_t oth_id = m.json_ ? (has_id ? (uint16_t)json_evt[pkt_node_id].asUInt() : 0) : (m.flags_ & HLC_NODE_MASK);
+    if(has_id && oth_id == hlc_.node_id_) {
+        log_->warn("node:{} has the same node id:{}, picking a new one", node, oth_id);
+        renew_node_id();
+    }
 
-        if(!current_node_ts_ && !oth_ts) {
-            log_->debug("discarding alive evt from other newly spawned node: this node is still synching");
-            return RetCode_OK;
+    //a node with the version of a transfer being received can repair it;
+    //the origin announces its version once done multicasting: what is missing by now has been lost.
+    for(auto it = mcast_xfers_.begin(); it != mcast_xfers_.end(); ++it) {
+        mcast_xfer &xfer = it->second;
+        if(!xfer.missing_ || oth_vers[xfer.shard_] < it->first) {
+            continue;
+        }
+        std::pair<std::string, uint16_t> holder(evt.opt_src_ip_, m.lp_);
+        if(std::find(xfer.holders_.begin(), xfer.holders_.end(), holder) == xfer.holders_.end()) {
+            xfer.holders_.push_back(holder);
         }
+        if(now - xfer.last_nak_ >= std::chrono::milliseconds(MCAST_NAK_IVL_MS)) {
+            send_data_nak_msg(it->first, xfer);
+        }
+    }
 
-        if(current_node_ts_ > oth_ts) {
-            if(current_node_ts_ == desired_cluster_ts_) {
-                log_->debug("other node is not updated: [this_ts > other_ts], notifying it ...");
-                send_alive_node_msg();
-            } else {
-                //this node is already synching with the cluster; do not send potentially useless alive.
-            }
-            return RetCode_OK;
-        } else if(current_node_ts_ < oth_ts) {
-            if(desired_cluster_ts_ < oth_ts) {
-                desired_cluster_ts_ = oth_ts;
-                log_->debug("this node is not updated: [this_ts < other_ts], requesting updated data ...");
-                std::shared_ptr<connection> outg_conn(new connection(selector_, ConnectionType_TCP_OUTGOING));
-                outg_conn->set_host_ip(json_evt[pkt_source_ip].asCString());
-                outg_conn->set_host_port(json_evt[pkt_listening_port].asUInt());
-                selector_.notify(new event(ConnectRequest, outg_conn));
+    //a record inlined updates a shard to the version announced if this node has the version it follows.
+    bool adopted = false;
+    for(auto it = inl_recs.begin(); it != inl_recs.end(); ++it) {
+        unsigned shard = it->req_.shard_;
+        std::string key(it->rec_.key_, it->rec_.key_len_);
+        if(shard >= STORE_SHARDS || store::shard_of(key) != shard || !wants_shard(shard) || synch_conns_[shard] ||
+                store_.version(shard) < it->req_.since_ || store_.version(shard) >= it->rec_.ts_) {
+            continue;
+        }
+        if(!put(key, g_bslice(it->rec_.val_, it->rec_.val_len_), it->rec_.ts_)) {
+            log_->debug("adopted the inlined record of shard:{}", shard);
+            adopted = true;
+        }
+    }
+
+    //shards are synched only when the other node has a newer version of them.
+    std::vector<shard_req> reqs;
+    bool oth_behind = oth_ts < current_node_ts_;
+    for(unsigned shard = 0; shard < STORE_SHARDS; ++shard) {
+        uint64_t this_ver = store_.version(shard);
+        if(oth_vers[shard] > this_ver) {
+            if(wants_shard(shard) && oth_vers[shard] > desired_shard_ts_[shard]) {
+                desired_shard_ts_[shard] = oth_vers[shard];
+                shard_req req;
+                req.shard_ = shard;
+                req.since_ = this_ver;
+                reqs.push_back(req);
             } else {
-                //already requested to someone else, do nothing
+                //already requested to someone else, or not kept by this node
             }
-        } else {
-            //equals, do nothing
+        } else if(oth_vers[shard] < this_ver) {
+            oth_behind = true;
         }
+    }
 
-    } else if(ptype == pkt_type_data) {
-        time_t data_ts = json_evt[pkt_ts].asUInt();
-        if(data_ts > current_node_ts_) {
-            data_ = json_evt[pkt_data_value].asString();
-            current_node_ts_ = data_ts;
+    if(!reqs.empty()) {
+        log_->debug("this node is not updated on {} shards, requesting updated data ...", reqs.size());
+        desired_cluster_ts_ = std::max(desired_cluster_ts_, oth_ts);
+        return request_data(evt.opt_src_ip_, m.lp_, true, reqs);
+    }
+    if(synching()) {
+        //this node is already synching with the cluster; do not send potentially useless alive.
+        return RetCode_OK;
+    }
+    if(adopted) {
+        desired_cluster_ts_ = current_node_ts_ = std::max(current_node_ts_, oth_ts);
+        if(cfg_.get_val) {
+            //the key got is in the only shard a getter keeps: it is updated.
+            return RetCode_EXIT;
+        }
+        //as after a synch: the writer, and the nodes not updated, learn the version adopted.
+        return send_alive_node_msg();
+    }
+    if(oth_behind) {
+        log_->debug("other node is not updated, notifying it ...");
+        return send_alive_node_msg();
+    }
+    if(has_digest && oth_digest != store_.digest() && cfg_.start_node && bin_wire() && !reconcile_conn_) {
+        //same versions, different keys: the nodes missed each other's writes.
+        log_->debug("same versions but different digests, reconciling ...");
+        start_reconcile(evt.opt_src_ip_, m.lp_);
+    }
+    //same versions: this node catches up with the timestamp of the other node.
+    desired_cluster_ts_ = current_node_ts_ = std::max(current_node_ts_, oth_ts);
+    return RetCode_OK;
+}
+
+RetCode peer::process_json_only_alive(event &evt, const msg &m)
+{
+    //a JSON-only node has just the value of the default key.
+    uint64_t oth_ts = m.ts_;
+    observe(oth_ts, evt.opt_src_ip_);
+    unsigned shard = store::shard_of(STORE_DEFAULT_KEY);
+    const store::entry *e = store_.get(STORE_DEFAULT_KEY);
+    uint64_t this_ts = e ? e->ts_ : 0;
+
+    if(this_ts > oth_ts) {
+        if(!synching()) {
+            log_->debug("JSON-only node is not updated: [this_ts > other_ts], notifying it ...");
+            return send_alive_node_msg();
+        }
+    } else if(this_ts < oth_ts && wants_shard(shard) && oth_ts > desired_shard_ts_[shard]) {
+        log_->debug("this node is not updated: [this_ts < other_ts], requesting updated data ...");
+        desired_shard_ts_[shard] = oth_ts;
+        desired_cluster_ts_ = std::max(desired_cluster_ts_, oth_ts);
+        shard_req req;
+        req.shard_ = shard;
+        req.since_ = this_ts;
+        return request_data(evt.opt_src_ip_, m.lp_, false, std::vector<shard_req>(1, req));
+    }
+    return RetCode_OK;
+}
 
-            if(cfg_.get_val) {
-                return RetCode_EXIT;
+RetCode peer::process_data(event &evt, const msg &m, const Json::Value &json_evt)
+{
+    observe(m.ts_, inet_ntoa(evt.conn_->addr_.sin_addr));
+
+    //JSON-only nodes (and nodes that could be talking to them) send just the default key.
+    bool json_only_fmt = m.json_ && !json_evt.isMember(pkt_kv);
+    std::vector<kv_rec> recs;
+    if(json_only_fmt) {
+        kv_rec rec;
+        rec.key_ = STORE_DEFAULT_KEY;
+        rec.key_len_ = strlen(STORE_DEFAULT_KEY);
+        rec.val_ = m.pl_;
+        rec.val_len_ = m.pl_len_;
+        rec.ts_ = m.ts_;
+        recs.push_back(rec);
+    } else if(m.json_) {
+        const Json::Value &kv = json_evt[pkt_kv];
+        for(Json::ArrayIndex i = 0; kv.isArray() && i < kv.size(); ++i) {
+            kv_rec rec;
+            const char *end = nullptr;
+            if(!kv[i].isObject() ||
+                    !kv[i][pkt_key].isString() || !kv[i][pkt_data_value].isString() ||
+                    !kv[i].get(pkt_hlc, 0).isUInt64()) {
+                log_->error("discarding malformed data record");
+                continue;
             }
+            kv[i][pkt_key].getString(&rec.key_, &end);
+            rec.key_len_ = end - rec.key_;
+            kv[i][pkt_data_value].getString(&rec.val_, &end);
+            rec.val_len_ = end - rec.val_;
+            rec.ts_ = kv[i][pkt_hlc].asUInt64();
+            recs.push_back(rec);
+        }
+    } else if(decode_kv_recs(m.pl_, m.pl_len_, recs)) {
+        log_->error("discarding malformed data evt");
+        return RetCode_OK;
+    }
+
+    //values are kept inside the packet they have been received with.
+    std::shared_ptr<g_bbuf> pkt;
+    if(!m.json_) {
+        pkt = std::move(evt.opt_rdn_pkt_);
+    }
+    size_t stored = 0;
+    for(auto it = recs.begin(); it != recs.end(); ++it) {
+        g_bslice val = pkt ? g_bslice(pkt, it->val_, it->val_len_) : g_bslice(it->val_, it->val_len_);
+        if(!put(std::string(it->key_, it->key_len_), std::move(val), it->ts_)) {
+            ++stored;
         }
-        if(data_ts < desired_cluster_ts_) {
-            //data received is earlier than cluster one, notify cluster
-            send_alive_node_msg();
+    }
+
+    //pooled connections stay open, ready for later data requests.
+    auto pit = conn_pool_.find(pool_key(*evt.conn_));
+    bool pooled = pit != conn_pool_.end() && pit->second.conn_ == evt.conn_;
+    if(!pooled) {
+        evt.conn_->sel_.notify(event(Disconnect, evt.conn_));
+    }
+    if(json_only_fmt && m.version_) {
+        //sent in case this node were JSON-only: the response to the data request follows.
+        return RetCode_OK;
+    }
+    if(!m.json_ && (m.flags_ & MsgFlag_RECONCILE)) {
+        if(evt.conn_ != reconcile_conn_) {
+            return RetCode_OK;
         }
-        evt.conn_->close_connection();
-    } else {
-        log_->error("unk pkt_type: {}", ptype);
+        reconcile_stored_ += stored;
+        return reconcile_step_done();
+    }
+    if(pooled && m.version_ && stored) {
+        //the node that sent the data learns this node holds it, without waiting for its alive.
+        send_data_ack_msg(*evt.conn_, recs);
     }
 
-    return rcode;
+    bool was_synching = synching(), stale = false;
+    end_synch(evt.conn_, stale);
+    if(stale) {
+        //data received is earlier than cluster one, notify cluster
+        return send_alive_node_msg();
+    }
+    if(was_synching && !synching()) {
+        desired_cluster_ts_ = current_node_ts_ = std::max(current_node_ts_, desired_cluster_ts_);
+        if(cfg_.get_val) {
+            return RetCode_EXIT;
+        }
+        //let the nodes not updated with the data just received know it.
+        return send_alive_node_msg();
+    }
+    return RetCode_OK;
 }
 
-RetCode peer::process_node_status()
+RetCode peer::process_data_request(event &evt, const msg &m, const Json::Value &json_evt)
 {
-    RetCode rcode = RetCode_OK;
-    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
-
-    if(exit_required_) {
-        return RetCode_EXIT;
+    std::vector<shard_req> reqs;
+    if(m.json_) {
+        const Json::Value &rq = json_evt[pkt_shard_requests];
+        for(Json::ArrayIndex i = 0; rq.isArray() && i < rq.size(); ++i) {
+            if(!rq[i].isArray() || rq[i].size() < 2 || !rq[i][0].isUInt() || !rq[i][1].isUInt64()) {
+                log_->error("discarding malformed data request evt");
+                return RetCode_OK;
+            }
+            shard_req req;
+            req.shard_ = rq[i][0].asUInt();
+            req.since_ = rq[i][1].asUInt64();
+            reqs.push_back(req);
+        }
+    } else if(decode_shard_reqs(m.pl_, m.pl_len_, reqs)) {
+        log_->error("discarding malformed data request evt");
+        return RetCode_OK;
+    }
+    for(auto it = reqs.begin(); it != reqs.end(); ++it) {
+        if(it->shard_ >= STORE_SHARDS) {
+            log_->error("discarding data request evt for bad shard:{}", it->shard_);
+            return RetCode_OK;
+        }
+    }
+    if(m.lp_) {
+        //a node requesting data will acknowledge it.
+        node_seen(node_key(inet_ntoa(evt.conn_->addr_.sin_addr), m.lp_), std::chrono::system_clock::now());
     }
+    log_->debug("sending data of {} shards to node", reqs.size());
+    return send_data_msg(*evt.conn_, reqs);
+}
 
-    if(!cfg_.start_node && now > tp_initial_synch_window_) {
-        //"pure" setter or getter nodes must shutdown.
-        return RetCode_EXIT;
+RetCode peer::process_digest_request(event &evt, const msg &m)
+{
+    std::vector<unsigned> nodes;
+    if(decode_u16s(m.pl_, m.pl_len_, nodes)) {
+        log_->error("discarding malformed digest request evt");
+        return RetCode_OK;
+    }
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + WIRE_HDR_SZ + nodes.size() *
+                                                     (WIRE_DIGEST_HDR_SZ + STORE_BUCKETS * sizeof(uint64_t)));
+    pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+    std::vector<uint64_t> digests;
+    for(auto it = nodes.begin(); it != nodes.end(); ++it) {
+        digests.clear();
+        if(*it >= store::tree_nodes() || store_.children(*it, digests)) {
+            log_->error("discarding digest request evt for bad node:{}", *it);
+            return RetCode_OK;
+        }
+        append_digest_rec(*pkt, *it, digests.data(), digests.size());
     }
+    seal_bin_msg(*pkt, MsgType_DIGEST, 0, 0);
+    return evt.conn_->send(std::move(pkt));
+}
 
-    //if no other node has still responded to initial alive, the node generates itself the timestamp
-    if(!current_node_ts_ && !desired_cluster_ts_ && now > tp_initial_synch_window_) {
-        desired_cluster_ts_ = current_node_ts_ = gen_ts();
-        log_->debug("auto generated timestamp: {}", current_node_ts_);
-        send_alive_node_msg();
+RetCode peer::process_digest(event &evt, const msg &m)
+{
+    if(evt.conn_ != reconcile_conn_) {
+        return RetCode_OK;
+    }
+    std::vector<digest_rec> recs;
+    if(decode_digest_recs(m.pl_, m.pl_len_, recs)) {
+        log_->error("discarding malformed digest evt");
+        end_reconcile();
+        return RetCode_OK;
     }
 
-    return rcode;
+    //only the children whose digest differs are walked down.
+    std::vector<unsigned> nodes, leaves;
+    std::vector<uint64_t> digests;
+    for(auto it = recs.begin(); it != recs.end(); ++it) {
+        digests.clear();
+        if(it->node_ >= store::tree_nodes() || store_.children(it->node_, digests) ||
+                digests.size() != it->digests_.size()) {
+            log_->error("discarding digest evt for bad node:{}", it->node_);
+            end_reconcile();
+            return RetCode_OK;
+        }
+        for(unsigned i = 0; i < digests.size(); ++i) {
+            if(digests[i] == it->digests_[i]) {
+                continue;
+            }
+            if(!it->node_) {
+                nodes.push_back(store::shard_node(i));
+            } else {
+                leaves.push_back(store::bucket_node(it->node_ - 1, i));
+            }
+        }
+    }
+    log_->debug("{} shards and {} buckets differ", nodes.size(), leaves.size());
+    if(!nodes.empty()) {
+        RET_ON_KO(send_digest_request_msg(*reconcile_conn_, nodes))
+    }
+    if(!leaves.empty()) {
+        RET_ON_KO(send_reconcile_request_msg(*reconcile_conn_, leaves))
+    }
+    return reconcile_step_done();
 }
 
-int peer::run()
+RetCode peer::process_reconcile_request(event &evt, const msg &m)
 {
-    RetCode rcode = RetCode_OK;
-    selector_.srv_sockaddr_in_.sin_port = htons(cfg_.listening_port);
+    std::vector<leaf_rec> recs;
+    if(decode_leaf_recs(m.pl_, m.pl_len_, recs)) {
+        log_->error("discarding malformed reconcile request evt");
+        return RetCode_OK;
+    }
 
-    if((rcode = init())) {
-        return rcode;
+    //the records of the leaves the requester misses, or has older.
+    std::vector<std::pair<const std::string *, const store::entry *>> out;
+    std::unordered_map<std::string, uint64_t> oth_keys;
+    for(auto it = recs.begin(); it != recs.end(); ++it) {
+        if(!store::leaf_node(it->node_) || it->node_ >= store::tree_nodes()) {
+            log_->error("discarding reconcile request evt for bad node:{}", it->node_);
+            return RetCode_OK;
+        }
+        oth_keys.clear();
+        for(auto kit = it->keys_.begin(); kit != it->keys_.end(); ++kit) {
+            oth_keys[std::string(kit->key_, kit->key_len_)] = kit->ts_;
+        }
+        size_t first = out.size();
+        store_.leaf_entries(it->node_, out);
+        for(size_t i = first; i < out.size();) {
+            auto oit = oth_keys.find(*out[i].first);
+            if(oit != oth_keys.end() && oit->second >= out[i].second->ts_) {
+                out[i] = out.back();
+                out.pop_back();
+            } else {
+                ++i;
+            }
+        }
     }
-    if((rcode = start())) {
-        return rcode;
+
+    size_t sz = 4 + WIRE_HDR_SZ;
+    for(auto it = out.begin(); it != out.end(); ++it) {
+        sz += WIRE_KV_HDR_SZ + it->first->size() + it->second->val_.size();
+    }
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(sz);
+    pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+    uint64_t max_ts = 0;
+    for(auto it = out.begin(); it != out.end(); ++it) {
+        append_kv_rec(*pkt, *it->first, it->second->val_.data(), it->second->val_.size(), it->second->ts_);
+        max_ts = std::max(max_ts, it->second->ts_);
     }
+    seal_bin_msg(*pkt, MsgType_DATA, 0, max_ts, MsgFlag_RECONCILE);
+    log_->debug("sending {} keys to reconciling node", out.size());
+    return evt.conn_->send(std::move(pkt));
+}
 
-    if(!cfg_.val.empty()) {
-        data_ = cfg_.val;
-        desired_cluster_ts_ = current_node_ts_ = gen_ts();
+RetCode peer::process_data_announce(event &evt, const msg &m)
+{
+    chunk ch;
+    if(decode_announce(m.pl_, m.pl_len_, ch) || ch.shard_ >= STORE_SHARDS) {
+        log_->error("discarding malformed data announce evt");
+        return RetCode_OK;
+    }
+    if(evt.conn_->con_type_ != ConnectionType_UDP_INGOING ||
+            mcast_xfers_.find(m.ts_) != mcast_xfers_.end() ||
+            !wants_shard(ch.shard_) || store_.version(ch.shard_) >= m.ts_) {
+        return RetCode_OK;
+    }
+    //the transfers being received hold at most mcast-max bytes:
+    //the alive of the origin makes this node request the value over TCP.
+    size_t receiving = ch.total_;
+    for(auto it = mcast_xfers_.begin(); it != mcast_xfers_.end(); ++it) {
+        if(it->second.missing_) {
+            receiving += it->second.total_;
+        }
+    }
+    if(receiving > cfg_.mcast_max) {
+        log_->warn("ignoring multicast transfer of {} bytes, mcast-max:{}", ch.total_, cfg_.mcast_max);
+        return RetCode_OK;
     }
 
-    if((rcode = send_alive_node_msg())) {
-        return rcode;
+    //the transfer is awaited like a synch: the alive of the origin does not trigger a data request.
+    log_->debug("receiving multicast transfer of {} chunks", ch.count_);
+    mcast_xfer &xfer = mcast_xfers_[m.ts_];
+    xfer.shard_ = ch.shard_;
+    xfer.buf_ = g_bbuf_pool::instance().acquire(ch.total_);
+    xfer.total_ = ch.total_;
+    xfer.got_.assign(ch.count_, false);
+    xfer.missing_ = ch.count_;
+    xfer.holders_.push_back(std::make_pair(std::string(evt.opt_src_ip_), m.lp_));
+    xfer.last_progress_ = std::chrono::system_clock::now();
+    desired_shard_ts_[ch.shard_] = std::max(desired_shard_ts_[ch.shard_], m.ts_);
+    return RetCode_OK;
+}
+
+RetCode peer::process_data_chunk(const msg &m)
+{
+    chunk ch;
+    if(decode_chunk(m.pl_, m.pl_len_, ch) || ch.shard_ >= STORE_SHARDS) {
+        log_->error("discarding malformed data chunk evt");
+        return RetCode_OK;
+    }
+    //only the chunks of a transfer announced, with its shard and size, are accepted.
+    auto it = mcast_xfers_.find(m.ts_);
+    if(it == mcast_xfers_.end()) {
+        return RetCode_OK;
+    }
+    mcast_xfer &xfer = it->second;
+    if(!xfer.missing_ || ch.shard_ != xfer.shard_ || ch.total_ != xfer.total_ || xfer.got_[ch.seq_]) {
+        return RetCode_OK;
+    }
+    memcpy(&xfer.buf_->buf_[(size_t)ch.seq_ * WIRE_CHUNK_SZ], ch.data_, ch.len_);
+    xfer.got_[ch.seq_] = true;
+    xfer.last_progress_ = std::chrono::system_clock::now();
+    if(--xfer.missing_) {
+        return RetCode_OK;
     }
+    return complete_mcast_xfer(m.ts_, xfer);
+}
 
-    process_incoming_events();
+RetCode peer::process_data_nak(event &evt, const msg &m)
+{
+    std::vector<uint32_t> seqs;
+    if(decode_u32s(m.pl_, m.pl_len_, seqs)) {
+        log_->error("discarding malformed data nak evt");
+        return RetCode_OK;
+    }
+    auto it = mcast_xfers_.find(m.ts_);
+    if(it == mcast_xfers_.end() || it->second.missing_ || !it->second.buf_) {
+        log_->debug("not holding the transfer, ignoring data nak");
+        return RetCode_OK;
+    }
+    const mcast_xfer &xfer = it->second;
+    log_->debug("repairing {} chunks of multicast transfer", seqs.size());
+    uint16_t lp = ntohs(selector_.srv_sockaddr_in_.sin_port);
+    for(auto sit = seqs.begin(); sit != seqs.end(); ++sit) {
+        if(*sit >= xfer.got_.size()) {
+            continue;
+        }
+        RET_ON_KO(evt.conn_->send(encode_chunk_msg(lp, m.ts_, xfer.shard_, *sit, xfer.buf_->buf_, xfer.total_)))
+    }
+    return RetCode_OK;
+}
 
-    if(!exit_required_) {
-        stop();
+RetCode peer::process_local_request(event &evt, const msg &m)
+{
+    std::vector<kv_rec> recs;
+    if(decode_kv_recs(m.pl_, m.pl_len_, recs) || recs.size() != 1) {
+        log_->error("discarding malformed local request");
+        return RetCode_OK;
+    }
+    std::string key(recs[0].key_, recs[0].key_len_);
+    g_bslice val;
+    uint64_t ts = 0;
+    RET_ON_KO(serve_local(m.type_, key, g_bslice(recs[0].val_, recs[0].val_len_), val, ts))
+
+    if(m.type_ == MsgType_LOCAL_SET && (m.flags_ & (MsgFlag_WRITE_ACKS | MsgFlag_WRITE_ALL))) {
+        //answered once its write concern is met, as a write made through the API.
+        uint32_t timeout_ms = m.ts_ ? (uint32_t)std::min<uint64_t>(m.ts_, UINT32_MAX) : cfg_.ack_timeout_ms;
+        track_write(key, ts, m.lp_, (m.flags_ & MsgFlag_WRITE_ALL) != 0, timeout_ms,
+                    std::promise<api_result>(), evt.conn_);
+        return complete_writes(std::chrono::system_clock::now());
     }
 
-#ifndef G_TEST
-    std::cout << data_ << std::endl;
-#endif
-    return rcode;
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + WIRE_HDR_SZ + WIRE_KV_HDR_SZ + key.size() + val.size());
+    pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+    append_kv_rec(*pkt, key, val.data(), val.size(), ts);
+    seal_bin_msg(*pkt, MsgType_LOCAL_RESULT, 0, 0);
+    return evt.conn_->send(std::move(pkt));
 }
 
-bool peer::foreign_evt(const Json::Value &json_evt)
+RetCode peer::process_local_watch(event &evt, const msg &m)
 {
-    return (json_evt[pkt_listening_port].asUInt() != ntohs(selector_.srv_sockaddr_in_.sin_port)) &&
-           (selector_.hintfs_.find(json_evt[pkt_source_ip].asString()) == selector_.hintfs_.end());
+    std::vector<kv_rec> recs;
+    if(decode_kv_recs(m.pl_, m.pl_len_, recs) || recs.size() != 1) {
+        log_->error("discarding malformed local watch");
+        return RetCode_OK;
+    }
+    watcher w;
+    w.conn_ = evt.conn_;
+    w.key_.assign(recs[0].key_, recs[0].key_len_);
+    uint64_t since = recs[0].ts_;
+
+    //the values the client has missed, oldest first, so that it can resume from any of them.
+    typedef std::pair<const std::string *, const store::entry *> rec_ref;
+    std::vector<rec_ref> missed;
+    size_t len = 0;
+    for(auto sit = store_.shards_.begin(); sit != store_.shards_.end(); ++sit) {
+        if(sit->version_ <= since) {
+            continue;
+        }
+        for(auto it = sit->entries_.begin(); it != sit->entries_.end(); ++it) {
+            if(it->second.ts_ > since && (w.key_.empty() || w.key_ == it->first)) {
+                missed.push_back(std::make_pair(&it->first, &it->second));
+                len += WIRE_KV_HDR_SZ + it->first.size() + it->second.val_.size();
+            }
+        }
+    }
+    log_->debug("local client watching key:[{}] since:{}, missed:{}", w.key_, since, missed.size());
+    watchers_.push_back(std::move(w));
+    if(missed.empty()) {
+        return RetCode_OK;
+    }
+    std::sort(missed.begin(), missed.end(), [](const rec_ref &a, const rec_ref &b) {
+        return a.second->ts_ < b.second->ts_;
+    });
+
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + WIRE_HDR_SZ + len);
+    pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+    for(auto it = missed.begin(); it != missed.end(); ++it) {
+        RET_ON_KO(append_kv_rec(*pkt, *it->first, it->second->val_.data(), it->second->val_.size(), it->second->ts_))
+    }
+    seal_bin_msg(*pkt, MsgType_LOCAL_CHANGE, 0, 0);
+    return evt.conn_->send(std::move(pkt));
 }
 
-RetCode peer::send_data_msg(connection &conn)
+RetCode peer::process_local_conn_closed(event &evt)
 {
-    Json::Value data_msg = build_data_msg();
-    return send_packet(data_msg, conn);
+    watchers_.erase(std::remove_if(watchers_.begin(), watchers_.end(), [&](const watcher &w) {
+        return w.conn_ == evt.conn_;
+    }), watchers_.end());
+    return RetCode_OK;
 }
 
-Json::Value peer::build_data_msg() const
+RetCode peer::process_api_reqs()
 {
-    Json::Value data_msg;
-    data_msg[pkt_type] = pkt_type_data;
-    data_msg[pkt_data_value] = data_;
-    data_msg[pkt_ts] = current_node_ts_;
-    return data_msg;
+    api_q_.drain([&](api_req &req) {
+        api_result res;
+        g_bslice val;
+        res.rcode_ = serve_local(req.type_, req.key_, g_bslice(req.val_), val, res.ts_);
+        if(req.type_ == MsgType_LOCAL_SET && !res.rcode_) {
+            track_write(req.key_, res.ts_, write_acks_, write_all_, cfg_.ack_timeout_ms, std::move(req.res_));
+            return;
+        }
+        res.val_ = val.str();
+        req.res_.set_value(res);
+    });
+    //a write concern of 0 is met at once.
+    return complete_writes(std::chrono::system_clock::now());
 }
 
-RetCode peer::send_alive_node_msg()
+RetCode peer::process_data_ack(event &evt, const msg &m)
 {
-    Json::Value alive_node_msg = build_alive_node_msg();
-    return send_packet(alive_node_msg, selector_.mcast_udp_outg_conn_);
+    std::vector<shard_req> reqs;
+    if(decode_shard_reqs(m.pl_, m.pl_len_, reqs)) {
+        log_->error("discarding malformed data ack evt");
+        return RetCode_OK;
+    }
+    std::vector<uint64_t> oth_vers(STORE_SHARDS, 0);
+    for(auto it = reqs.begin(); it != reqs.end(); ++it) {
+        if(it->shard_ >= STORE_SHARDS) {
+            log_->error("discarding data ack evt for bad shard:{}", it->shard_);
+            return RetCode_OK;
+        }
+        oth_vers[it->shard_] = it->since_;
+    }
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+    std::string node = node_key(inet_ntoa(evt.conn_->addr_.sin_addr), m.lp_);
+    node_seen(node, now);
+    ack_writes(node, oth_vers);
+    return complete_writes(now);
 }
 
-Json::Value peer::build_alive_node_msg() const
+RetCode peer::process_outg_conn_closed(event &evt)
 {
-    Json::Value alive_node_msg;
-    alive_node_msg[pkt_type] = pkt_type_alive_node;
-    alive_node_msg[pkt_listening_port] = ntohs(selector_.srv_sockaddr_in_.sin_port);
-    alive_node_msg[pkt_ts] = current_node_ts_;
-    return alive_node_msg;
+    auto it = conn_pool_.find(pool_key(*evt.conn_));
+    if(it != conn_pool_.end() && it->second.conn_ == evt.conn_) {
+        conn_pool_.erase(it);
+    }
+    bool stale = false;
+    end_synch(evt.conn_, stale);
+    if(evt.conn_ == reconcile_conn_) {
+        log_->debug("connection to node lost, reconciliation aborted");
+        end_reconcile();
+    }
+    if(stale) {
+        //synch aborted, as when a setter exits once its write concern is met:
+        //the updated nodes answer the alive of this node, and data is requested again.
+        log_->debug("connection to node lost, synch aborted");
+        return send_alive_node_msg();
+    }
+    return RetCode_OK;
 }
 
-RetCode peer::send_packet(const Json::Value &pkt, connection &conn)
+bool peer::wants_shard(unsigned shard) const
 {
-    std::ostringstream os;
-    os << pkt;
-    return conn.send(os.str());
+    if(cfg_.start_node) {
+        return true;
+    }
+    return cfg_.get_val && shard == store::shard_of(cfg_.key);
 }
 
-uint32_t peer::gen_ts() const
+bool peer::synching() const
 {
-    return (uint32_t)::time(0);
+    for(auto it = synch_conns_.begin(); it != synch_conns_.end(); ++it) {
+        if(*it) {
+            return true;
+        }
+    }
+    for(auto it = mcast_xfers_.begin(); it != mcast_xfers_.end(); ++it) {
+        if(it->second.missing_) {
+            return true;
+        }
+    }
+    return false;
 }
 
-Json::Value peer::evt_to_json(const event &evt)
+void peer::end_synch(const std::shared_ptr<connection> &conn, bool &stale)
 {
-    Json::Value jpkt;
-    if(evt.evt_ == Interrupt) {
-        jpkt[pkt_interrupt] = "";
-    } else if(evt.opt_rdn_pkt_) {
-        std::string pkts(evt.opt_rdn_pkt_->buf_, evt.opt_rdn_pkt_->available_read());
-        std::istringstream istr(pkts);
-        istr >> jpkt;
-        if(jpkt[pkt_type].asString() == pkt_type_alive_node) {
-            jpkt[pkt_source_ip] = evt.opt_src_ip_;
+    for(unsigned shard = 0; shard < STORE_SHARDS; ++shard) {
+        if(synch_conns_[shard] != conn) {
+            continue;
+        }
+        synch_conns_[shard].reset();
+        if(store_.version(shard) < desired_shard_ts_[shard]) {
+            desired_shard_ts_[shard] = store_.version(shard);
+            stale = true;
         }
     }
-    return jpkt;
+    if(stale && !synching()) {
+        desired_cluster_ts_ = current_node_ts_;
+    }
+}
+
+RetCode peer::start_reconcile(const std::string &host, uint16_t port)
+{
+    RET_ON_KO(get_pooled_conn(host, port, reconcile_conn_))
+    reconcile_pending_ = 0;
+    reconcile_stored_ = 0;
+    reconcile_diverged_ = false;
+    tp_reconcile_ = std::chrono::system_clock::now();
+    RetCode rcode = send_digest_request_msg(*reconcile_conn_, std::vector<unsigned>(1, 0));
+    if(rcode) {
+        end_reconcile();
+    }
+    return rcode;
+}
+
+RetCode peer::reconcile_step_done()
+{
+    if(reconcile_pending_ && --reconcile_pending_) {
+        return RetCode_OK;
+    }
+    size_t stored = reconcile_stored_;
+    bool diverged = reconcile_diverged_;
+    end_reconcile();
+    log_->debug("reconciliation done, {} keys received", stored);
+    if(diverged) {
+        //the other node could miss the keys of this node: let it compare the digests in turn.
+        return send_alive_node_msg();
+    }
+    return RetCode_OK;
+}
+
+void peer::end_reconcile()
+{
+    reconcile_conn_.reset();
+    reconcile_pending_ = 0;
+    reconcile_stored_ = 0;
+    reconcile_diverged_ = false;
+}
+
+RetCode peer::send_digest_request_msg(connection &conn, const std::vector<unsigned> &nodes)
+{
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + WIRE_HDR_SZ + nodes.size() * sizeof(uint16_t));
+    pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+    append_u16s(*pkt, nodes.data(), nodes.size());
+    seal_bin_msg(*pkt, MsgType_DIGEST_REQUEST, 0, 0);
+    RET_ON_KO(conn.send(std::move(pkt)))
+    ++reconcile_pending_;
+    return RetCode_OK;
+}
+
+RetCode peer::send_reconcile_request_msg(connection &conn, const std::vector<unsigned> &leaves)
+{
+    //the keys this node has in the buckets that differ, with their versions.
+    std::vector<std::pair<const std::string *, const store::entry *>> entries;
+    size_t sz = 4 + WIRE_HDR_SZ + leaves.size() * WIRE_LEAF_HDR_SZ;
+    for(auto it = leaves.begin(); it != leaves.end(); ++it) {
+        store_.leaf_entries(*it, entries);
+    }
+    for(auto it = entries.begin(); it != entries.end(); ++it) {
+        sz += WIRE_KEY_VER_HDR_SZ + it->first->size();
+    }
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(sz);
+    pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+    for(auto it = leaves.begin(); it != leaves.end(); ++it) {
+        entries.clear();
+        store_.leaf_entries(*it, entries);
+        append_leaf_hdr(*pkt, *it, entries.size());
+        for(auto eit = entries.begin(); eit != entries.end(); ++eit) {
+            append_key_ver(*pkt, *eit->first, eit->second->ts_);
+        }
+    }
+    seal_bin_msg(*pkt, MsgType_RECONCILE_REQUEST, 0, 0);
+    RET_ON_KO(conn.send(std::move(pkt)))
+    ++reconcile_pending_;
+    reconcile_diverged_ = true;
+    return RetCode_OK;
+}
+
+RetCode peer::multicast_data(unsigned shard, uint64_t ts)
+{
+    //the keys of the shard written at ts, in a data message that is kept to repair the transfer.
+    std::vector<shard_req> reqs(1);
+    reqs[0].shard_ = shard;
+    reqs[0].since_ = ts - 1;
+    g_bbuf_ptr buf = encode_data_msg(reqs, true);
+    if(buf->available_read() > cfg_.mcast_max) {
+        //the nodes request it over TCP on the alive of this node.
+        log_->debug("not multicasting {} bytes of data, mcast-max:{}", buf->available_read(), cfg_.mcast_max);
+        return RetCode_OK;
+    }
+    mcast_xfer &xfer = mcast_xfers_[ts];
+    xfer.shard_ = shard;
+    xfer.buf_ = std::move(buf);
+    xfer.total_ = xfer.buf_->available_read();
+    xfer.got_.assign((xfer.total_ + WIRE_CHUNK_SZ - 1) / WIRE_CHUNK_SZ, true);
+    xfer.last_progress_ = std::chrono::system_clock::now();
+
+    log_->debug("multicasting {} chunks of data", xfer.got_.size());
+    uint16_t lp = ntohs(selector_.srv_sockaddr_in_.sin_port);
+    g_bbuf_ptr ann = encode_announce_msg(lp, ts, shard, xfer.total_);
+    RET_ON_KO(send_mcast(&ann->buf_[ann->pos_], ann->available_read()))
+    //the primary selector paces the chunks, and the alive following them.
+    return selector_.send_mcast_chunks(xfer.buf_, xfer.total_, ts, shard);
+}
+
+RetCode peer::complete_mcast_xfer(uint64_t ts, mcast_xfer &xfer)
+{
+    msg dm;
+    std::vector<kv_rec> recs;
+    xfer.buf_->advance_pos_write(xfer.total_);
+    xfer.buf_->set_read();
+    if(xfer.total_ < 4 ||
+            decode_bin_msg(&xfer.buf_->buf_[4], xfer.total_ - 4, dm) ||
+            dm.type_ != MsgType_DATA ||
+            decode_kv_recs(dm.pl_, dm.pl_len_, recs)) {
+        //let the synch driven by alive messages fetch the keys.
+        log_->error("discarding malformed multicast transfer");
+        xfer.buf_.reset();
+        if(!synch_conns_[xfer.shard_]) {
+            desired_shard_ts_[xfer.shard_] = store_.version(xfer.shard_);
+        }
+        return RetCode_OK;
+    }
+
+    //values are kept inside the transfer buffer, which can repair the transfers of other nodes.
+    for(auto it = recs.begin(); it != recs.end(); ++it) {
+        put(std::string(it->key_, it->key_len_), g_bslice(xfer.buf_, it->val_, it->val_len_), it->ts_);
+    }
+    log_->debug("multicast transfer of {} keys completed", recs.size());
+    desired_cluster_ts_ = std::max(desired_cluster_ts_, ts);
+    if(!synching()) {
+        desired_cluster_ts_ = current_node_ts_ = std::max(current_node_ts_, desired_cluster_ts_);
+        if(cfg_.get_val) {
+            return RetCode_EXIT;
+        }
+        //as after a synch: the writer learns the version received.
+        return send_alive_node_msg();
+    }
+    return RetCode_OK;
+}
+
+RetCode peer::send_data_nak_msg(uint64_t ts, mcast_xfer &xfer)
+{
+    if(xfer.holders_.empty()) {
+        return RetCode_KO;
+    }
+    std::vector<uint32_t> seqs;
+    for(uint32_t seq = 0; seq < xfer.got_.size() && seqs.size() < MCAST_NAK_MAX; ++seq) {
+        if(!xfer.got_[seq]) {
+            seqs.push_back(seq);
+        }
+    }
+    const std::pair<std::string, uint16_t> &holder = xfer.holders_[xfer.holder_ % xfer.holders_.size()];
+    std::shared_ptr<connection> conn;
+    RET_ON_KO(get_pooled_conn(holder.first, holder.second, conn))
+    xfer.last_nak_ = std::chrono::system_clock::now();
+
+    log_->debug("requesting {} missing chunks to {}:{}", seqs.size(), holder.first, holder.second);
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + WIRE_HDR_SZ + seqs.size() * sizeof(uint32_t));
+    pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+    append_u32s(*pkt, seqs.data(), seqs.size());
+    seal_bin_msg(*pkt, MsgType_DATA_NAK, 0, ts);
+    return conn->send(std::move(pkt));
+}
+
+void peer::check_mcast_xfers(std::chrono::system_clock::time_point now)
+{
+    bool abandoned = false;
+    for(auto it = mcast_xfers_.begin(); it != mcast_xfers_.end();) {
+        mcast_xfer &xfer = it->second;
+        if(!xfer.missing_) {
+            if(now - xfer.last_progress_ > std::chrono::seconds(MCAST_XFER_TTL)) {
+                it = mcast_xfers_.erase(it);
+            } else {
+                ++it;
+            }
+            continue;
+        }
+        if(now - xfer.last_progress_ > std::chrono::seconds(MCAST_XFER_TIMEOUT)) {
+            log_->debug("multicast transfer abandoned with {} chunks missing", xfer.missing_);
+            if(!synch_conns_[xfer.shard_]) {
+                desired_shard_ts_[xfer.shard_] = store_.version(xfer.shard_);
+            }
+            it = mcast_xfers_.erase(it);
+            abandoned = true;
+            continue;
+        }
+        if(now - xfer.last_nak_ >= std::chrono::milliseconds(MCAST_NAK_IVL_MS) &&
+                now - xfer.last_progress_ >= std::chrono::milliseconds(MCAST_NAK_IVL_MS)) {
+            //the last request has not been answered: try the next holder.
+            if(xfer.last_nak_ > xfer.last_progress_) {
+                ++xfer.holder_;
+            }
+            send_data_nak_msg(it->first, xfer);
+        }
+        ++it;
+    }
+    if(abandoned && !synching()) {
+        //nodes with newer shard versions will answer with their alive.
+        desired_cluster_ts_ = current_node_ts_;
+        send_alive_node_msg();
+    }
+}
+
+std::string peer::pool_key(const std::string &host, uint16_t port) const
+{
+    std::ostringstream os;
+    os << host << ':' << port;
+    return os.str();
+}
+
+std::string peer::pool_key(const connection &conn) const
+{
+    return pool_key(inet_ntoa(conn.addr_.sin_addr), ntohs(conn.addr_.sin_port));
+}
+
+RetCode peer::request_data(const std::string &host, uint16_t port, bool poolable,
+                           const std::vector<shard_req> &reqs)
+{
+    if(!poolable) {
+        //JSON-only nodes do not understand data requests: one connection for each synch,
+        //they send their value as soon as they accept it.
+        std::shared_ptr<connection> outg_conn(new connection(next_shard(), ConnectionType_TCP_OUTGOING));
+        outg_conn->set_host_ip(host.c_str());
+        outg_conn->set_host_port(port);
+        for(auto it = reqs.begin(); it != reqs.end(); ++it) {
+            synch_conns_[it->shard_] = outg_conn;
+        }
+        return outg_conn->sel_.notify(event(ConnectRequest, outg_conn));
+    }
+
+    std::shared_ptr<connection> conn;
+    RET_ON_KO(get_pooled_conn(host, port, conn))
+    for(auto it = reqs.begin(); it != reqs.end(); ++it) {
+        synch_conns_[it->shard_] = conn;
+    }
+    return send_data_request_msg(*conn, reqs);
+}
+
+RetCode peer::get_pooled_conn(const std::string &host, uint16_t port, std::shared_ptr<connection> &out)
+{
+    pooled_conn &pc = conn_pool_[pool_key(host, port)];
+    pc.last_use_ = std::chrono::system_clock::now();
+    if(pc.conn_) {
+        //warm connection: requests are sent right away.
+        log_->debug("reusing pooled connection to {}:{}", host, port);
+    } else {
+        //a new connection: requests are sent as soon as it is established.
+        std::shared_ptr<connection> outg_conn(new connection(next_shard(), ConnectionType_TCP_OUTGOING));
+        outg_conn->set_host_ip(host.c_str());
+        outg_conn->set_host_port(port);
+        pc.conn_ = outg_conn;
+        RET_ON_KO(outg_conn->sel_.notify(event(ConnectRequest, outg_conn)))
+    }
+    out = pc.conn_;
+    return RetCode_OK;
+}
+
+void peer::evict_idle_conns(std::chrono::system_clock::time_point now)
+{
+    for(auto it = conn_pool_.begin(); it != conn_pool_.end();) {
+        if(std::find(synch_conns_.begin(), synch_conns_.end(), it->second.conn_) == synch_conns_.end() &&
+                it->second.conn_ != reconcile_conn_ &&
+                now - it->second.last_use_ > std::chrono::seconds(cfg_.conn_idle_timeout)) {
+            log_->debug("closing idle pooled connection to {}", it->first);
+            it->second.conn_->sel_.notify(event(Disconnect, it->second.conn_));
+            it = conn_pool_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+RetCode peer::process_node_status()
+{
+    RetCode rcode = RetCode_OK;
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+
+    if(exit_required_) {
+        return RetCode_EXIT;
+    }
+
+    if(!cfg_.start_node && now > tp_initial_synch_window_ && pending_writes_.empty()) {
+        //"pure" setter or getter nodes must shutdown, a setter once its write has completed or expired.
+        return RetCode_EXIT;
+    }
+
+    //if no other node has still responded to initial alive, the node generates itself the timestamp
+    if(!current_node_ts_ && !desired_cluster_ts_ && now > tp_initial_synch_window_) {
+        desired_cluster_ts_ = current_node_ts_ = gen_ts();
+        log_->debug("auto generated timestamp: {}", current_node_ts_);
+        send_alive_node_msg();
+    }
+
+    if(reconcile_conn_ && now - tp_reconcile_ > std::chrono::seconds(RECONCILE_TIMEOUT)) {
+        //the other node could not know reconciliation messages.
+        log_->debug("reconciliation timed out");
+        end_reconcile();
+    }
+
+    check_mcast_xfers(now);
+    evict_idle_conns(now);
+    for(auto it = nodes_seen_.begin(); it != nodes_seen_.end();) {
+        if(now - it->second > std::chrono::seconds(NODE_SEEN_TIMEOUT)) {
+            it = nodes_seen_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    //a node no longer heard is not waited for anymore.
+    if((rcode = complete_writes(now)) == RetCode_EXIT) {
+        return rcode;
+    }
+    expire_writes(now, false);
+    if(!cfg_.start_node && set_res_.valid() && pending_writes_.empty()) {
+        return RetCode_EXIT;
+    }
+    shm_.beat();
+    return rcode;
+}
+
+int peer::run()
+{
+    RetCode rcode = RetCode_OK;
+
+    if(cfg_.watch) {
+        if((rcode = run_watch()) == RetCode_UNVRSC) {
+#ifndef G_TEST
+            std::cerr << "no node is running on this host" << std::endl;
+#endif
+        }
+        return rcode;
+    }
+
+    //a setter or a getter joins the cluster only if no daemon is running on this host.
+    if(cfg_.start_node || run_local(rcode)) {
+        if((rcode = run_node())) {
+            return rcode;
+        }
+    } else if(rcode) {
+        //a set served by the daemon fails if its write concern has not been met.
+        return rcode;
+    }
+
+#ifndef G_TEST
+    if(cfg_.get_version) {
+        std::cout << current_node_ts_ << std::endl;
+    } else {
+        std::cout << store_.value(cfg_.key) << std::endl;
+    }
+#endif
+    return rcode;
+}
+
+RetCode peer::run_node()
+{
+    RetCode rcode = RetCode_OK;
+    selector_.srv_sockaddr_in_.sin_port = htons(cfg_.listening_port);
+
+    RET_ON_KO(init())
+    RET_ON_KO(start())
+    RET_ON_KO(join_cluster())
+    serve();
+
+    if(set_res_.valid()) {
+        //a setter fails if its write concern has not been met.
+        rcode = set_res_.get().rcode_;
+    }
+
+    if(!exit_required_) {
+        stop();
+    }
+    return rcode;
+}
+
+void peer::serve()
+{
+    process_incoming_events();
+    shm_.close();
+    watchers_.clear();
+    //the requests made through the API are over.
+    expire_writes(std::chrono::system_clock::now(), true);
+    api_q_.drain([](api_req &req) {
+        api_result res;
+        res.rcode_ = RetCode_ABORT;
+        req.res_.set_value(res);
+    });
+}
+
+RetCode peer::join_cluster()
+{
+    if(cfg_.start_node && cfg_.shm) {
+        RetCode res = shm_.open(cfg_.get_shm_name(), cfg_.shm_size);
+        if(res) {
+            log_->warn("shared memory:{} is not published by this node, res:{}", cfg_.get_shm_name(), res);
+        }
+    }
+
+    if(!cfg_.get_val && !cfg_.key.empty()) {
+        uint64_t ts = 0;
+        write(cfg_.key, g_bslice(cfg_.val), ts);
+        if(!cfg_.start_node && (write_acks_ || write_all_)) {
+            //a setter exits as soon as its write concern is met.
+            std::promise<api_result> res;
+            set_res_ = res.get_future();
+            track_write(cfg_.key, ts, write_acks_, write_all_, cfg_.ack_timeout_ms, std::move(res));
+        }
+    }
+    return send_alive_node_msg();
+}
+
+RetCode peer::run_local(RetCode &write_res)
+{
+    if(cfg_.shm && (cfg_.get_val || cfg_.get_version) && !run_shm()) {
+        return RetCode_OK;
+    }
+    std::string path = cfg_.get_local_socket();
+    if(path.empty()) {
+        return RetCode_UNVRSC;
+    }
+    local_client cli;
+    RET_ON_KO(cli.connect(path, cfg_.connect_timeout_ms))
+
+    std::string val;
+    uint64_t ts = 0;
+    if(cfg_.get_version) {
+        RET_ON_KO(cli.version(ts))
+    } else if(cfg_.get_val) {
+        RET_ON_KO(cli.get(cfg_.key, val, ts))
+    } else if(!cfg_.key.empty()) {
+        //the write concern is awaited by the daemon; a bad one is reported joining the cluster.
+        RET_ON_KO(cfg_.get_write_concern(write_acks_, write_all_))
+        std::shared_ptr<spdlog::logger> log = get_log();
+        unsigned acks = 0;
+        uint64_t latency_us = 0;
+        write_res = cli.set(cfg_.key, cfg_.val, write_acks_, write_all_, cfg_.ack_timeout_ms, ts, acks, latency_us);
+        if(write_res == RetCode_TIMEOUT) {
+            log->warn("write ts:{} acknowledged by {} nodes only, write concern:{}", ts, acks, cfg_.write_concern);
+        } else if(write_res) {
+            return write_res;
+        } else {
+            log->info("write ts:{} acknowledged by {} nodes in {} us", ts, acks, latency_us);
+        }
+        val = cfg_.val;
+    }
+
+    //this node ends up as if it had synched with the cluster.
+    if(ts && !cfg_.get_version) {
+        store_.put(cfg_.key, g_bslice(val), ts);
+    }
+    desired_cluster_ts_ = current_node_ts_ = ts;
+    return RetCode_OK;
+}
+
+RetCode peer::run_watch()
+{
+    std::string path = cfg_.get_local_socket();
+    if(path.empty()) {
+        return RetCode_UNVRSC;
+    }
+    local_client cli;
+    RET_ON_KO(cli.connect(path, cfg_.connect_timeout_ms))
+    return cli.watch(cfg_.key, cfg_.watch_since, [](const std::string &, const std::string &val, uint64_t ts) {
+#ifndef G_TEST
+        //the version printed can be passed as --since to resume watching from it.
+        std::cout << ts << " " << val << std::endl;
+#endif
+        return true;
+    });
+}
+
+bool peer::foreign_msg(const msg &m, const char *src_ip)
+{
+    if(m.type_ != MsgType_ALIVE_NODE && m.type_ != MsgType_DATA_ANNOUNCE && m.type_ != MsgType_DATA_CHUNK) {
+        //TCP messages always come from other nodes.
+        return true;
+    }
+    return (m.lp_ != ntohs(selector_.srv_sockaddr_in_.sin_port)) &&
+           (selector_.hintfs_.find(src_ip) == selector_.hintfs_.end());
+}
+
+bool peer::bin_wire() const
+{
+    if(cfg_.wire_protocol == "binary") {
+        return true;
+    }
+    if(cfg_.wire_protocol != "auto") {
+        return false;
+    }
+    return std::chrono::system_clock::now() - tp_json_node_seen_ > std::chrono::seconds(JSON_NODE_TTL);
+}
+
+RetCode peer::send_data_msg(connection &conn, const std::vector<shard_req> &reqs)
+{
+    //a request for all the keys of every shard not empty gets the same message as a full one.
+    std::array<bool, STORE_SHARDS> whole = {};
+    for(auto it = reqs.begin(); it != reqs.end(); ++it) {
+        whole[it->shard_] = !it->since_;
+    }
+    bool full = true;
+    for(unsigned shard = 0; shard < STORE_SHARDS && full; ++shard) {
+        full = whole[shard] || store_.shards_[shard].entries_.empty();
+    }
+    if(!full) {
+        return conn.send(encode_data_msg(reqs, bin_wire()));
+    }
+
+    //nodes joining the cluster request all the shards: they share the same message.
+    const data_msg_enc &enc = get_full_data_msg();
+    if(enc.file_) {
+        return conn.send_file(enc.file_);
+    }
+    return conn.send(enc.pkt_);
+}
+
+RetCode peer::send_json_only_data_msg(connection &conn)
+{
+    const store::entry *e = store_.get(STORE_DEFAULT_KEY);
+    if(!e) {
+        return RetCode_OK;
+    }
+    Json::Value data_msg;
+    data_msg[pkt_type] = pkt_type_data;
+    data_msg[pkt_data_value] = Json::Value(e->val_.data(), e->val_.data() + e->val_.size());
+    data_msg[pkt_ts] = hlc::to_secs(e->ts_);
+    data_msg[pkt_hlc] = (Json::UInt64)e->ts_;
+    data_msg[pkt_wire_version] = WIRE_VERSION;
+    return conn.send(encode_json_msg(data_msg));
+}
+
+const peer::data_msg_enc &peer::get_full_data_msg()
+{
+    bool bin = bin_wire();
+    if(full_data_msg_.gen_ == store_.gen_ && full_data_msg_.bin_ == bin &&
+            (full_data_msg_.file_ || !full_data_msg_.pkt_.empty())) {
+        return full_data_msg_;
+    }
+
+    //the message is encoded once for each version of the store and wire format;
+    //the previous one is freed once the connections sending it are done.
+    full_data_msg_ = data_msg_enc();
+    full_data_msg_.gen_ = store_.gen_;
+    full_data_msg_.bin_ = bin;
+    std::vector<shard_req> reqs(STORE_SHARDS);
+    for(unsigned shard = 0; shard < STORE_SHARDS; ++shard) {
+        reqs[shard].shard_ = shard;
+    }
+    g_bbuf_ptr pkt = encode_data_msg(reqs, bin);
+    if(pkt->available_read() >= LARGE_DATA_SZ && !encode_data_file(*pkt, full_data_msg_.file_)) {
+        return full_data_msg_;
+    }
+    full_data_msg_.pkt_ = g_bslice(std::move(pkt));
+    return full_data_msg_;
+}
+
+g_bbuf_ptr peer::encode_data_msg(const std::vector<shard_req> &reqs, bool bin) const
+{
+    //only the keys newer than the version the requester already has.
+    uint64_t max_ts = 0;
+    if(bin) {
+        //the buffer is sized upfront: the records of a full store could be large.
+        size_t sz = 4 + WIRE_HDR_SZ;
+        for(auto rit = reqs.begin(); rit != reqs.end(); ++rit) {
+            const store::shard &sh = store_.shards_[rit->shard_];
+            for(auto it = sh.entries_.begin(); it != sh.entries_.end(); ++it) {
+                if(it->second.ts_ > rit->since_) {
+                    sz += WIRE_KV_HDR_SZ + it->first.size() + it->second.val_.size();
+                }
+            }
+        }
+        g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(sz);
+        pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+        for(auto rit = reqs.begin(); rit != reqs.end(); ++rit) {
+            const store::shard &sh = store_.shards_[rit->shard_];
+            for(auto it = sh.entries_.begin(); it != sh.entries_.end(); ++it) {
+                if(it->second.ts_ > rit->since_) {
+                    append_kv_rec(*pkt, it->first, it->second.val_.data(), it->second.val_.size(), it->second.ts_);
+                    max_ts = std::max(max_ts, it->second.ts_);
+                }
+            }
+        }
+        seal_bin_msg(*pkt, MsgType_DATA, 0, max_ts);
+        return pkt;
+    }
+
+    Json::Value data_msg;
+    Json::Value &kv = data_msg[pkt_kv] = Json::Value(Json::arrayValue);
+    for(auto rit = reqs.begin(); rit != reqs.end(); ++rit) {
+        const store::shard &sh = store_.shards_[rit->shard_];
+        for(auto it = sh.entries_.begin(); it != sh.entries_.end(); ++it) {
+            if(it->second.ts_ > rit->since_) {
+                const g_bslice &val = it->second.val_;
+                Json::Value &rec = kv.append(Json::Value());
+                rec[pkt_key] = it->first;
+                rec[pkt_data_value] = Json::Value(val.data(), val.data() + val.size());
+                rec[pkt_hlc] = (Json::UInt64)it->second.ts_;
+                max_ts = std::max(max_ts, it->second.ts_);
+            }
+        }
+    }
+    data_msg[pkt_type] = pkt_type_data;
+    data_msg[pkt_hlc] = (Json::UInt64)max_ts;
+    data_msg[pkt_wire_version] = WIRE_VERSION;
+    return encode_json_msg(data_msg);
+}
+
+RetCode peer::encode_data_file(const g_bbuf &pkt, std::shared_ptr<mem_file> &out) const
+{
+    std::shared_ptr<mem_file> data_file(new mem_file());
+    RetCode rcode = RetCode_OK;
+    if((rcode = data_file->create("nds-data")) ||
+            (rcode = data_file->append(&pkt.buf_[pkt.pos_], pkt.limit() - pkt.pos_))) {
+        log_->error("data mem_file KO errno:{}, falling back to buffered send", errno);
+        return rcode;
+    }
+    out = data_file;
+    return RetCode_OK;
+}
+
+RetCode peer::put(const std::string &key, g_bslice &&val, uint64_t ts)
+{
+    if(!store_.put(key, std::move(val), ts)) {
+        return RetCode_KO;
+    }
+    current_node_ts_ = std::max(current_node_ts_, ts);
+    const g_bslice &stored = store_.get(key)->val_;
+    if(on_change_) {
+        on_change_(key, stored, ts);
+    }
+    notify_watchers(key, stored, ts);
+    return RetCode_OK;
+}
+
+void peer::notify_watchers(const std::string &key, const g_bslice &val, uint64_t ts)
+{
+    //encoded once, shared by all the clients watching the key.
+    g_bslice change;
+    for(auto it = watchers_.begin(); it != watchers_.end(); ++it) {
+        if(!it->key_.empty() && it->key_ != key) {
+            continue;
+        }
+        if(!change.size()) {
+            g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + WIRE_HDR_SZ + WIRE_KV_HDR_SZ + key.size() + val.size());
+            pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+            append_kv_rec(*pkt, key, val.data(), val.size(), ts);
+            seal_bin_msg(*pkt, MsgType_LOCAL_CHANGE, 0, 0);
+            change = g_bslice(std::move(pkt));
+        }
+        if(it->conn_->send(change)) {
+            log_->debug("local client watching key:[{}] is gone", it->key_);
+        }
+    }
+}
+
+RetCode peer::serve_local(MsgType type, const std::string &key, g_bslice &&val, g_bslice &res_val, uint64_t &ts)
+{
+    if(type == MsgType_LOCAL_GET) {
+        const store::entry *e = store_.get(key);
+        if(e) {
+            res_val = e->val_;
+            ts = e->ts_;
+        }
+    } else if(type == MsgType_LOCAL_SET) {
+        RET_ON_KO(write(key, std::move(val), ts))
+        RET_ON_KO(send_alive_node_msg())
+        //the client could read the shared memory as soon as it gets the result.
+        publish_shm();
+    } else {
+        ts = current_node_ts_;
+    }
+    return RetCode_OK;
+}
+
+void peer::submit(api_req &&req)
+{
+    //the peer thread is woken up once for all the requests it has still to drain.
+    if(api_q_.put(std::move(req))) {
+        std::unique_lock<std::mutex> lck(api_mtx_);
+        incoming_evt_q_.put(api_producer(), event(ApiRequest));
+    }
+}
+
+std::string peer::node_key(const std::string &host, uint16_t port) const
+{
+    std::ostringstream os;
+    os << host << ':' << port;
+    return os.str();
+}
+
+void peer::node_seen(const std::string &node, std::chrono::system_clock::time_point now)
+{
+    auto res = nodes_seen_.insert(std::make_pair(node, now));
+    if(res.second) {
+        tp_node_new_ = now;
+    } else {
+        res.first->second = now;
+    }
+}
+
+void peer::track_write(const std::string &key, uint64_t ts, unsigned acks, bool all, uint32_t timeout_ms,
+                       std::promise<api_result> &&res, const std::shared_ptr<connection> &local_conn)
+{
+    pending_write pw;
+    pw.shard_ = store::shard_of(key);
+    pw.ts_ = ts;
+    pw.start_ = std::chrono::system_clock::now();
+    pw.deadline_ = pw.start_ + std::chrono::milliseconds(timeout_ms);
+    pw.res_ = std::move(res);
+    pw.need_ = acks;
+    pw.all_ = all;
+    pw.local_conn_ = local_conn;
+    if(local_conn) {
+        pw.key_ = key;
+    }
+    pending_writes_.push_back(std::move(pw));
+    //a node alone completes its write once no other node has answered it.
+    if(all) {
+        selector_.interrupt_peer_in(NODE_SYNCH_DURATION * 1000 + 1);
+    }
+    selector_.interrupt_peer_in(timeout_ms + 1);
+}
+
+void peer::ack_writes(const std::string &node, const std::vector<uint64_t> &oth_vers)
+{
+    for(auto it = pending_writes_.begin(); it != pending_writes_.end(); ++it) {
+        if(oth_vers[it->shard_] >= it->ts_) {
+            it->acks_.insert(node);
+        }
+    }
+}
+
+RetCode peer::complete_writes(std::chrono::system_clock::time_point now)
+{
+    //the nodes answering the write at about the same time as the ones heard so far.
+    std::chrono::system_clock::time_point settled = tp_node_new_ + std::chrono::milliseconds(WRITE_ALL_SETTLE_MS);
+    bool settling = false;
+    for(auto it = pending_writes_.begin(); it != pending_writes_.end();) {
+        bool met = it->all_ ? !it->acks_.empty() : it->acks_.size() >= it->need_;
+        for(auto nit = nodes_seen_.begin(); met && it->all_ && nit != nodes_seen_.end(); ++nit) {
+            met = it->acks_.find(nit->first) != it->acks_.end();
+        }
+        //a node that no other node has answered within the synch window is the whole cluster;
+        //an explicit number of nodes is waited for anyway, as the others could be partitioned away.
+        bool alone = !met && it->all_ && now - it->start_ >= std::chrono::seconds(NODE_SYNCH_DURATION);
+        for(auto nit = nodes_seen_.begin(); alone && nit != nodes_seen_.end(); ++nit) {
+            alone = nit->second < it->start_;
+        }
+        met = met || alone;
+        if(met && it->all_ && now < settled) {
+            met = false;
+            settling = true;
+        }
+        if(!met) {
+            ++it;
+            continue;
+        }
+        api_result res;
+        res.ts_ = it->ts_;
+        res.acks_ = (unsigned)it->acks_.size();
+        res.latency_us_ = std::chrono::duration_cast<std::chrono::microseconds>(now - it->start_).count();
+        log_->info("write ts:{} acknowledged by {} nodes in {} us", res.ts_, res.acks_, res.latency_us_);
+        finish_write(*it, res);
+        it = pending_writes_.erase(it);
+    }
+    if(settling) {
+        selector_.interrupt_peer_in((uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>
+                                    (settled - now).count() + 1);
+    }
+    if(!cfg_.start_node && set_res_.valid() &&
+            set_res_.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        return RetCode_EXIT;
+    }
+    return RetCode_OK;
+}
+
+void peer::finish_write(pending_write &pw, const api_result &res)
+{
+    if(!pw.local_conn_) {
+        pw.res_.set_value(res);
+        return;
+    }
+    //the nodes that acknowledged the write and the time it took them, as the result value.
+    uint64_t vals[2] = {htole64(res.acks_), htole64(res.latency_us_)};
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + WIRE_HDR_SZ + WIRE_KV_HDR_SZ + pw.key_.size() + sizeof(vals));
+    pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+    append_kv_rec(*pkt, pw.key_, (const char *)vals, sizeof(vals), res.ts_);
+    seal_bin_msg(*pkt, MsgType_LOCAL_RESULT, 0, 0, res.rcode_ ? MsgFlag_UNMET : MsgFlag_NONE);
+    if(pw.local_conn_->send(std::move(pkt))) {
+        log_->debug("local client waiting for write ts:{} is gone", res.ts_);
+    }
+}
+
+void peer::expire_writes(std::chrono::system_clock::time_point now, bool all)
+{
+    for(auto it = pending_writes_.begin(); it != pending_writes_.end();) {
+        if(!all && now < it->deadline_) {
+            ++it;
+            continue;
+        }
+        //the write is kept and spread anyway.
+        api_result res;
+        res.rcode_ = RetCode_TIMEOUT;
+        res.ts_ = it->ts_;
+        res.acks_ = (unsigned)it->acks_.size();
+        res.latency_us_ = std::chrono::duration_cast<std::chrono::microseconds>(now - it->start_).count();
+        if(it->all_) {
+            log_->warn("write ts:{} acknowledged by {} nodes only, write concern:all", res.ts_, res.acks_);
+        } else {
+            log_->warn("write ts:{} acknowledged by {} nodes only, write concern:{}", res.ts_, res.acks_, it->need_);
+        }
+        finish_write(*it, res);
+        it = pending_writes_.erase(it);
+    }
+    if(!pending_writes_.empty()) {
+        //not to wait for the periodic interrupt, up to 2 seconds late.
+        std::chrono::system_clock::time_point deadline = pending_writes_.front().deadline_;
+        for(auto it = pending_writes_.begin(); it != pending_writes_.end(); ++it) {
+            deadline = std::min(deadline, it->deadline_);
+        }
+        selector_.interrupt_peer_in((uint32_t)std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>
+                                                                (deadline - now).count()) + 1);
+    }
+}
+
+RetCode peer::send_data_ack_msg(connection &conn, const std::vector<kv_rec> &recs)
+{
+    //the versions now held of the shards received.
+    std::vector<bool> acked(STORE_SHARDS, false);
+    std::vector<shard_req> vers;
+    for(auto it = recs.begin(); it != recs.end(); ++it) {
+        shard_req ver;
+        ver.shard_ = store::shard_of(it->key_, it->key_len_);
+        if(acked[ver.shard_]) {
+            continue;
+        }
+        acked[ver.shard_] = true;
+        ver.since_ = store_.version(ver.shard_);
+        vers.push_back(ver);
+    }
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + WIRE_HDR_SZ + vers.size() * WIRE_SHARD_REQ_SZ);
+    pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+    for(auto it = vers.begin(); it != vers.end(); ++it) {
+        append_shard_req(*pkt, *it);
+    }
+    seal_bin_msg(*pkt, MsgType_DATA_ACK, ntohs(selector_.srv_sockaddr_in_.sin_port), current_node_ts_);
+    return conn.send(std::move(pkt));
+}
+
+RetCode peer::run_shm()
+{
+    shm_reader rd;
+    RET_ON_KO(rd.open(cfg_.get_shm_name()))
+
+    std::string val;
+    uint64_t ts = 0, node_ts = 0;
+    if(cfg_.get_version) {
+        RET_ON_KO(rd.version(node_ts))
+    } else {
+        RET_ON_KO(rd.get(cfg_.key, val, ts, node_ts))
+        if(ts) {
+            store_.put(cfg_.key, g_bslice(val), ts);
+        }
+    }
+    desired_cluster_ts_ = current_node_ts_ = node_ts;
+    return RetCode_OK;
+}
+
+void peer::publish_shm()
+{
+    if(shm_.publish(store_, current_node_ts_) == RetCode_OVRSZ) {
+        log_->warn("the store does not fit in shared memory:{}, shm-size:{}", cfg_.get_shm_name(), cfg_.shm_size);
+    }
+}
+
+RetCode peer::write(const std::string &key, g_bslice &&val, uint64_t &ts)
+{
+    ts = gen_ts();
+    size_t val_len = val.size();
+    RET_ON_KO(put(key, std::move(val), ts))
+    desired_cluster_ts_ = std::max(desired_cluster_ts_, ts);
+    //the value reaches the nodes before the alive that would make each of them request it,
+    //unless small enough to ride inside the alive; JSON-only nodes do not survive binary datagrams.
+    if(cfg_.multicast_data && bin_wire() &&
+            WIRE_SHARD_REQ_SZ + WIRE_KV_HDR_SZ + key.size() + val_len > cfg_.inline_max) {
+        multicast_data(store::shard_of(key), ts);
+    }
+    return RetCode_OK;
+}
+
+RetCode peer::send_data_request_msg(connection &conn, const std::vector<shard_req> &reqs)
+{
+    if(bin_wire()) {
+        g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + WIRE_HDR_SZ + reqs.size() * WIRE_SHARD_REQ_SZ);
+        pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+        for(auto it = reqs.begin(); it != reqs.end(); ++it) {
+            append_shard_req(*pkt, *it);
+        }
+        //the listening port tells the node that will be acknowledged.
+        seal_bin_msg(*pkt, MsgType_DATA_REQUEST, ntohs(selector_.srv_sockaddr_in_.sin_port), 0);
+        return conn.send(std::move(pkt));
+    }
+    Json::Value data_req_msg;
+    Json::Value &rq = data_req_msg[pkt_shard_requests] = Json::Value(Json::arrayValue);
+    for(auto it = reqs.begin(); it != reqs.end(); ++it) {
+        Json::Value &req = rq.append(Json::Value(Json::arrayValue));
+        req.append(it->shard_);
+        req.append((Json::UInt64)it->since_);
+    }
+    data_req_msg[pkt_type] = pkt_type_data_request;
+    data_req_msg[pkt_listening_port] = ntohs(selector_.srv_sockaddr_in_.sin_port);
+    data_req_msg[pkt_wire_version] = WIRE_VERSION;
+    return send_packet(data_req_msg, conn);
+}
+
+RetCode peer::send_alive_node_msg()
+{
+    //the beacon is encoded once for each version of the store: a binary one has just its timestamp patched.
+    bool bin = bin_wire();
+    uint16_t lp = ntohs(selector_.srv_sockaddr_in_.sin_port);
+    if(!alive_msg_ || alive_msg_bin_ != bin ||
+            (!bin && (alive_msg_ts_ != current_node_ts_ || alive_msg_gen_ != store_.gen_))) {
+        if(bin) {
+            g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + WIRE_HDR_SZ + (STORE_SHARDS + 1) * sizeof(uint64_t) +
+                                                             cfg_.inline_max);
+            pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+            append_alive_payload(*pkt);
+            seal_bin_msg(*pkt, MsgType_ALIVE_NODE, lp, current_node_ts_, MsgFlag_NODE_ID | hlc_.node_id_);
+            alive_msg_ = std::move(pkt);
+        } else {
+            alive_msg_ = encode_json_msg(build_alive_node_msg());
+        }
+        alive_msg_bin_ = bin;
+    } else if(bin) {
+        if(alive_msg_gen_ != store_.gen_) {
+            //the inlined records change the length of the payload: the buffer is reused.
+            alive_msg_->set_pos_write(4 + WIRE_HDR_SZ);
+            append_alive_payload(*alive_msg_);
+            seal_bin_msg(*alive_msg_, MsgType_ALIVE_NODE, lp, current_node_ts_, MsgFlag_NODE_ID | hlc_.node_id_);
+        } else if(alive_msg_ts_ != current_node_ts_) {
+            patch_bin_ts(&alive_msg_->buf_[alive_msg_->pos_ + 4], current_node_ts_);
+        }
+    }
+    alive_msg_ts_ = current_node_ts_;
+    alive_msg_gen_ = store_.gen_;
+    return send_mcast(&alive_msg_->buf_[alive_msg_->pos_], alive_msg_->available_read());
+}
+
+void peer::observe(uint64_t ts, const std::string &from)
+{
+    if(!hlc_.observe(ts)) {
+        log_->warn("ts:{} from {} is more than {} ms ahead of the wall clock, not followed", ts, from, cfg_.max_drift_ms);
+    }
+}
+
+void peer::renew_node_id()
+{
+    //0 is the node id of the timestamps of JSON-only nodes.
+    std::random_device rd;
+    uint16_t node_id = hlc_.node_id_;
+    while(node_id == hlc_.node_id_ || !node_id) {
+        node_id = (uint16_t)(rd() & HLC_NODE_MASK);
+    }
+    hlc_.set_node_id(node_id);
+    //the beacon announcing the old one is encoded again.
+    alive_msg_.reset();
+}
+
+RetCode peer::send_mcast(const char *pkt, size_t len)
+{
+    return selector_.send_mcast(pkt, len);
+}
+
+RetCode peer::append_alive_payload(g_bbuf &pkt) const
+{
+    RET_ON_KO(append_u64s(pkt, store_.versions().data(), STORE_SHARDS))
+    uint64_t digest = store_.digest();
+    RET_ON_KO(append_u64s(pkt, &digest, 1))
+    std::vector<unsigned> shards = inline_shards();
+    for(auto it = shards.begin(); it != shards.end(); ++it) {
+        const store::shard &sh = store_.shards_[*it];
+        const store::entry *e = store_.get(sh.last_key_);
+        shard_req req;
+        req.shard_ = *it;
+        req.since_ = sh.prev_version_;
+        RET_ON_KO(append_shard_req(pkt, req))
+        RET_ON_KO(append_kv_rec(pkt, sh.last_key_, e->val_.data(), e->val_.size(), e->ts_))
+    }
+    return RetCode_OK;
+}
+
+std::vector<unsigned> peer::inline_shards() const
+{
+    std::vector<unsigned> shards;
+    for(unsigned shard = 0; shard < STORE_SHARDS; ++shard) {
+        if(store_.version(shard)) {
+            shards.push_back(shard);
+        }
+    }
+    std::sort(shards.begin(), shards.end(), [&](unsigned a, unsigned b) {
+        return store_.version(a) > store_.version(b);
+    });
+
+    //the most recent writes first, as long as they fit.
+    size_t budget = cfg_.inline_max;
+    std::vector<unsigned> out;
+    for(auto it = shards.begin(); it != shards.end(); ++it) {
+        const store::shard &sh = store_.shards_[*it];
+        const store::entry *e = store_.get(sh.last_key_);
+        size_t sz = WIRE_SHARD_REQ_SZ + WIRE_KV_HDR_SZ + sh.last_key_.size() + e->val_.size();
+        if(sz <= budget) {
+            out.push_back(*it);
+            budget -= sz;
+        }
+    }
+    return out;
+}
+
+Json::Value peer::build_alive_node_msg() const
+{
+    //JSON-only nodes read the timestamp of the default key.
+    const store::entry *e = store_.get(STORE_DEFAULT_KEY);
+    Json::Value alive_node_msg;
+    alive_node_msg[pkt_type] = pkt_type_alive_node;
+    alive_node_msg[pkt_listening_port] = ntohs(selector_.srv_sockaddr_in_.sin_port);
+    alive_node_msg[pkt_ts] = hlc::to_secs(e ? e->ts_ : 0);
+    alive_node_msg[pkt_hlc] = (Json::UInt64)current_node_ts_;
+    Json::Value &sv = alive_node_msg[pkt_shard_versions] = Json::Value(Json::arrayValue);
+    for(unsigned shard = 0; shard < STORE_SHARDS; ++shard) {
+        sv.append((Json::UInt64)store_.version(shard));
+    }
+    std::vector<unsigned> shards = inline_shards();
+    if(!shards.empty()) {
+        Json::Value &il = alive_node_msg[pkt_inline] = Json::Value(Json::arrayValue);
+        for(auto it = shards.begin(); it != shards.end(); ++it) {
+            const store::shard &sh = store_.shards_[*it];
+            const store::entry *ie = store_.get(sh.last_key_);
+            Json::Value &rec = il.append(Json::Value());
+            rec[pkt_shard] = *it;
+            rec[pkt_since] = (Json::UInt64)sh.prev_version_;
+            rec[pkt_key] = sh.last_key_;
+            rec[pkt_data_value] = Json::Value(ie->val_.data(), ie->val_.data() + ie->val_.size());
+            rec[pkt_hlc] = (Json::UInt64)ie->ts_;
+        }
+    }
+    alive_node_msg[pkt_node_id] = hlc_.node_id_;
+    alive_node_msg[pkt_wire_version] = WIRE_VERSION;
+    return alive_node_msg;
+}
+
+RetCode peer::send_packet(const Json::Value &pkt, connection &conn)
+{
+    std::ostringstream os;
+    os << pkt;
+    return conn.send(os.str());
+}
+
+uint64_t peer::gen_ts()
+{
+    return hlc_.now();
+}
+
+RetCode peer::decode_evt(const event &evt, msg &m, Json::Value &json_evt)
+{
+    const char *body = evt.opt_rdn_pkt_->buf_;
+    size_t len = evt.opt_rdn_pkt_->available_read();
+    if(is_bin_msg(body, len)) {
+        return decode_bin_msg(body, len, m);
+    }
+
+    std::string errs;
+    if(!json_reader_->parse(body, body + len, &json_evt, &errs)) {
+        log_->error("json parse KO: {}", errs);
+        return RetCode_MALFORM;
+    }
+    //jsoncpp throws on fields of the wrong type: such messages are dropped as malformed.
+    if(!json_evt.isObject() ||
+            !json_evt.get(pkt_wire_version, 0).isUInt() ||
+            !json_evt.get(pkt_type, "").isString() ||
+            !json_evt.get(pkt_listening_port, 0).isUInt() ||
+            !json_evt.get(pkt_hlc, 0).isUInt64() ||
+            !json_evt.get(pkt_ts, 0).isUInt()) {
+        log_->error("json message with fields of bad type");
+        return RetCode_MALFORM;
+    }
+    m.json_ = true;
+    m.version_ = (uint8_t)json_evt.get(pkt_wire_version, 0).asUInt();
+    std::string ptype = json_evt.get(pkt_type, "").asString();
+    if(ptype == pkt_type_alive_node) {
+        m.type_ = MsgType_ALIVE_NODE;
+    } else if(ptype == pkt_type_data) {
+        m.type_ = MsgType_DATA;
+    } else if(ptype == pkt_type_data_request) {
+        m.type_ = MsgType_DATA_REQUEST;
+    }
+    m.lp_ = (uint16_t)json_evt.get(pkt_listening_port, 0).asUInt();
+    //JSON-only nodes carry just the seconds.
+    if(json_evt.isMember(pkt_hlc)) {
+        m.ts_ = json_evt[pkt_hlc].asUInt64();
+    } else {
+        m.ts_ = hlc::from_secs(json_evt.get(pkt_ts, 0).asUInt());
+    }
+    const Json::Value &dv = json_evt[pkt_data_value];
+    if(dv.isString()) {
+        const char *begin = nullptr, *end = nullptr;
+        dv.getString(&begin, &end);
+        m.pl_ = begin;
+        m.pl_len_ = end - begin;
+    }
+    return RetCode_OK;
 }
 
 
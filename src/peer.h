@@ -20,9 +20,43 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #pragma once
 #include "selector.h"
+#include "hlc.h"
+#include "store.h"
+#include "shm.h"
+#include <map>
+#include <future>
+#include <functional>
 
 namespace nds {
 
+/**
+ * The result of a request made through the API of an embedded node (see node.h):
+ * a value and its version, or just a version.
+ */
+struct api_result {
+    RetCode rcode_ = RetCode_OK;
+    std::string val_;
+    uint64_t ts_ = 0;
+
+    //writes: the nodes that acknowledged it and the time it took them
+    unsigned acks_ = 0;
+    uint64_t latency_us_ = 0;
+};
+
+/**
+ * A request made through the API of an embedded node, handed over to the peer thread.
+ * The type is one of the local message types: get, set or version.
+ */
+struct api_req {
+    MsgType type_ = MsgType_UNDEF;
+    std::string key_;
+    std::string val_;
+    std::promise<api_result> res_;
+};
+
+//called by the peer thread for each key written
+typedef std::function<void(const std::string &key, const g_bslice &val, uint64_t ts)> change_cb;
+
 /**
  * peer
  *
@@ -50,13 +84,75 @@ struct peer {
         std::string multicast_address = "232.232.200.82";
         uint16_t multicast_port = 8745;
         uint16_t listening_port = 31582;
+        std::string key;
         std::string val;
         bool get_val = true;
 
+        //get the timestamp of the cluster instead of a value
+        bool get_version = false;
+
+        //print the values of the key as they change, the ones newer than watch_since first;
+        //needs a daemon node running on this host
+        bool watch = false;
+        uint64_t watch_since = 0;
+
+        //unix domain socket served by a daemon node and tried first by setters and getters;
+        //empty: derived from the multicast group, none: disabled
+        std::string local_socket;
+
+        //a daemon node publishes its store in shared memory, getters read from it
+        bool shm = false;
+
+        //bytes of the shared memory segment
+        uint32_t shm_size = 1024 * 1024;
+
+        //time a write made through the API waits for its write concern
+        uint32_t ack_timeout_ms = 3000;
+
+        //the other nodes that must acknowledge a write before it completes:
+        //0 does not wait, N that many nodes, all every node heard lately
+        std::string write_concern = "1";
+
+        //I/O multiplexer used by the selectors [epoll, uring, select]
+        std::string multiplexer = "epoll";
+
+        //number of selector threads (shards) TCP connections are spread across
+        unsigned io_threads = 1;
+
+        //wire protocol used to send messages [auto, binary, json]
+        std::string wire_protocol = "auto";
+
+        //time allowed to an outgoing TCP connect to complete
+        uint32_t connect_timeout_ms = 3000;
+
+        //seconds a pooled connection toward another node is kept open while unused
+        uint32_t conn_idle_timeout = 30;
+
+        //values set by this node are multicast in chunks to all the nodes at once
+        bool multicast_data = false;
+
+        //bytes of the largest transfer multicast or accepted from the group; larger values are requested over TCP
+        uint32_t mcast_max = 16 * 1024 * 1024;
+
+        //bytes of the last writes that can ride inside the alive message (0 disables)
+        uint32_t inline_max = 1200;
+
+        //milliseconds a timestamp received can be ahead of the wall clock and still be followed (0: no limit)
+        uint32_t max_drift_ms = 60000;
+
         std::string log_type = "console";
         std::string log_level = "info";
 
         spdlog::level::level_enum get_spdloglvl() const;
+
+        //the path of the local socket, empty if disabled
+        std::string get_local_socket() const;
+
+        //the name of the shared memory segment
+        std::string get_shm_name() const;
+
+        //RetCode_BADCFG if the write concern is neither a number nor all.
+        RetCode get_write_concern(unsigned &acks, bool &all) const;
     };
 
     //ctor & dtor
@@ -65,62 +161,367 @@ struct peer {
 
     int run();
 
+    //runs this node joining the cluster.
+    RetCode run_node();
+
+    //sends the first alive message, after the write of a setter.
+    RetCode join_cluster();
+
+    //processes the incoming events until exit is required.
+    void serve();
+
+    //serves a setter or a getter through the local socket of the daemon running on this host;
+    //RetCode_UNVRSC if there is none. A set not meeting its write concern sets write_res.
+    RetCode run_local(RetCode &write_res);
+
+    //prints the changes of a key pushed by the daemon running on this host, until it goes away;
+    //RetCode_UNVRSC if there is none.
+    RetCode run_watch();
+
+    //serves a getter reading the store published in shared memory by the daemon running on this host.
+    RetCode run_shm();
+
+    //publishes the store in shared memory, if changed.
+    void publish_shm();
+
     /*machine state methods*/
 
     RetCode init();
+    std::shared_ptr<spdlog::logger> get_log() const;
     RetCode start();
     RetCode stop();
+    RetCode start_selector(selector &);
+    RetCode stop_selector(selector &);
     RetCode process_incoming_events();
+    RetCode process_incoming_event(event &evt);
     RetCode process_node_status();
 
-    //tells if it is an event generated by a foreign host or internal to the process
-    bool foreign_evt(const Json::Value &json_evt);
+    //tells if it is a message generated by a foreign host or internal to the process
+    bool foreign_msg(const msg &m, const char *src_ip);
+
+    RetCode process_foreign_evt(event &evt, const msg &m, const Json::Value &json_evt);
+    RetCode process_alive(event &evt, const msg &m, const Json::Value &json_evt);
+    RetCode process_json_only_alive(event &evt, const msg &m);
+    RetCode process_data(event &evt, const msg &m, const Json::Value &json_evt);
+    RetCode process_data_request(event &evt, const msg &m, const Json::Value &json_evt);
+    RetCode process_digest_request(event &evt, const msg &m);
+    RetCode process_digest(event &evt, const msg &m);
+    RetCode process_reconcile_request(event &evt, const msg &m);
+    RetCode process_data_announce(event &evt, const msg &m);
+    RetCode process_data_chunk(const msg &m);
+    RetCode process_data_nak(event &evt, const msg &m);
+    RetCode process_local_request(event &evt, const msg &m);
+    RetCode process_local_watch(event &evt, const msg &m);
+    RetCode process_local_conn_closed(event &evt);
+    RetCode process_data_ack(event &evt, const msg &m);
+    RetCode process_api_reqs();
+    RetCode process_outg_conn_closed(event &evt);
+
+    /*synch*/
+
+    //true if this node keeps the keys of the shard: daemons keep all the shards,
+    //getters only the shard of the key they get, setters none.
+    bool wants_shard(unsigned shard) const;
+
+    //true if data has been requested for at least a shard.
+    bool synching() const;
+
+    //ends the synch of the shards requested on conn, once data has been received or conn lost.
+    void end_synch(const std::shared_ptr<connection> &conn, bool &stale);
+
+    /*reconciliation*/
+
+    //walks the digest tree of another node with the same versions but a different digest,
+    //down to the buckets where they diverge, and pulls the keys this node misses there.
+    RetCode start_reconcile(const std::string &host, uint16_t port);
+
+    //accounts a response to a reconciliation request; ends it when none is pending.
+    RetCode reconcile_step_done();
+    void end_reconcile();
+
+    RetCode send_digest_request_msg(connection &conn, const std::vector<unsigned> &nodes);
+    RetCode send_reconcile_request_msg(connection &conn, const std::vector<unsigned> &leaves);
+
+    /*multicast data transfers*/
+
+    struct mcast_xfer;
+
+    //multicasts, in chunks, the keys of a shard written at ts.
+    RetCode multicast_data(unsigned shard, uint64_t ts);
+
+    //stores the keys of a transfer whose chunks have all been received.
+    RetCode complete_mcast_xfer(uint64_t ts, mcast_xfer &xfer);
 
-    RetCode process_foreign_evt(event &evt, Json::Value &json_evt);
+    //requests the missing chunks of a transfer to a node holding it.
+    RetCode send_data_nak_msg(uint64_t ts, mcast_xfer &xfer);
+
+    //repairs stalled transfers, abandons the hopeless ones and forgets the old ones.
+    void check_mcast_xfers(std::chrono::system_clock::time_point now);
+
+    /*connection pool*/
+
+    std::string pool_key(const std::string &host, uint16_t port) const;
+    std::string pool_key(const connection &conn) const;
+
+    //the pooled connection toward a node, connecting it if needed.
+    RetCode get_pooled_conn(const std::string &host, uint16_t port, std::shared_ptr<connection> &out);
+
+    //requests the data of some shards to a node, reusing the pooled connection toward it when available;
+    //JSON-only nodes are not poolable and they just send their value.
+    RetCode request_data(const std::string &host, uint16_t port, bool poolable,
+                         const std::vector<shard_req> &reqs);
+    void evict_idle_conns(std::chrono::system_clock::time_point now);
 
     /*alive message (UDP)*/
 
     RetCode send_alive_node_msg();
     Json::Value build_alive_node_msg() const;
 
+    //picks a node id other than the current one, announced by the next alive message.
+    void renew_node_id();
+
+    //merges into the clock a timestamp received from another node, unless it is too far ahead.
+    void observe(uint64_t ts, const std::string &from);
+
+    //writes - synch - a datagram to the multicast group.
+    RetCode send_mcast(const char *pkt, size_t len);
+
+    //the shard versions followed by the digest of the store and the records inlined.
+    RetCode append_alive_payload(g_bbuf &pkt) const;
+
+    //the shards whose last write rides inside the alive message, the most recent first.
+    std::vector<unsigned> inline_shards() const;
+
     /*data message (TCP)*/
 
-    RetCode send_data_msg(connection &conn);
-    Json::Value build_data_msg() const;
+    RetCode send_data_msg(connection &conn, const std::vector<shard_req> &reqs);
+    RetCode send_data_request_msg(connection &conn, const std::vector<shard_req> &reqs);
+
+    //the value of the default key in the format of JSON-only nodes,
+    //sent as soon as a node connects if they could be around.
+    RetCode send_json_only_data_msg(connection &conn);
+
+    //the data message with all the shards of the current version of the store,
+    //encoded once and shared by all the connections serving it.
+    struct data_msg_enc;
+    const data_msg_enc &get_full_data_msg();
+    g_bbuf_ptr encode_data_msg(const std::vector<shard_req> &reqs, bool bin) const;
+    RetCode encode_data_file(const g_bbuf &pkt, std::shared_ptr<mem_file> &out) const;
+    RetCode put(const std::string &key, g_bslice &&val, uint64_t ts);
+
+    //writes a key on behalf of a setter: the caller is expected to send the alive message then.
+    RetCode write(const std::string &key, g_bslice &&val, uint64_t &ts);
+
+    //pushes a change to the local clients watching its key.
+    void notify_watchers(const std::string &key, const g_bslice &val, uint64_t ts);
+
+    //serves a local get, set or version, either from the local socket or from the API.
+    RetCode serve_local(MsgType type, const std::string &key, g_bslice &&val, g_bslice &res_val, uint64_t &ts);
+
+    /*API of an embedded node: called by threads other than the peer one*/
+
+    //queues a request for the peer thread.
+    void submit(api_req &&req);
+
+    size_t api_producer() const {
+        return std::max(cfg_.io_threads, 1u);
+    }
+
+    /*write acknowledgements*/
+
+    //the address a node is known by: the one it sends its alive messages from and its listening port.
+    std::string node_key(const std::string &host, uint16_t port) const;
+
+    //a node heard, through its alive messages, its data requests or its acknowledgements.
+    void node_seen(const std::string &node, std::chrono::system_clock::time_point now);
+
+    //awaits the write concern for a write of this node - acks nodes or all the nodes heard lately -
+    //then sets its result, or answers the local client that made it.
+    void track_write(const std::string &key, uint64_t ts, unsigned acks, bool all, uint32_t timeout_ms,
+                     std::promise<api_result> &&res, const std::shared_ptr<connection> &local_conn = nullptr);
+
+    //sets the result of a write, or sends it to the local client that made it.
+    struct pending_write;
+    void finish_write(pending_write &pw, const api_result &res);
+
+    //accounts the acknowledgement of a node holding the given shard versions.
+    void ack_writes(const std::string &node, const std::vector<uint64_t> &oth_vers);
+
+    //completes the writes meeting the write concern;
+    //RetCode_EXIT once the write of a setter node is completed.
+    RetCode complete_writes(std::chrono::system_clock::time_point now);
+
+    //completes the writes not acknowledged in time, or all of them when exiting.
+    void expire_writes(std::chrono::system_clock::time_point now, bool all);
+
+    //acknowledges the data just stored to the node that sent it.
+    RetCode send_data_ack_msg(connection &conn, const std::vector<kv_rec> &recs);
 
     RetCode send_packet(const Json::Value &pkt, connection &conn);
 
-    uint32_t gen_ts() const;
+    uint64_t gen_ts();
+
+    //the selector that will own the next TCP connection (round-robin)
+    selector &next_shard();
+
+    //decodes the packet of an event, either binary or JSON (json_evt holds the parsed JSON)
+    RetCode decode_evt(const event &evt, msg &m, Json::Value &json_evt);
 
-    Json::Value evt_to_json(const event &evt);
+    //true if messages are sent with the binary wire protocol
+    bool bin_wire() const;
 
     //the configuration
     cfg cfg_;
 
-    //the selector object owned by this peer.
+    //the primary selector object owned by this peer.
     //selector_ will spawn its own thread.
+    //it owns multicast sockets and the listening socket.
     selector selector_;
 
+    //additional selector shards, each one with its own thread, owning only TCP connections.
+    std::vector<std::unique_ptr<selector>> io_shards_;
+    std::atomic<unsigned> next_shard_idx_;
+
     std::mutex mtx_;
     std::condition_variable cv_;
 
-    //the incoming queue used by the selector thread to send events to the peer thread
-    b_qu<event> incoming_evt_q_;
+    //the incoming queue used by the selector threads to send events to the peer thread;
+    //each selector puts on its own ring, indexed by its shard id.
+    fan_in_qu<event> incoming_evt_q_;
 
     //the time point at which this node will generate itself the timestamp;
     //this will happen if no other node will respond to initial alive sent by this node.
     //not daemon nodes ("pure" setter or getter nodes) will shutdown at this time point.
     std::chrono::system_clock::time_point tp_initial_synch_window_;
 
+    //the clock generating the timestamps of this node
+    hlc hlc_;
+
     //the currently timestamp set by this node
-    uint32_t current_node_ts_ = 0;
+    uint64_t current_node_ts_ = 0;
 
     //the desired timestamp this node would like to reach.
     //a successful synch with the cluster will transit desired_cluster_ts_ into current_node_ts_.
-    uint32_t desired_cluster_ts_ = 0;
+    uint64_t desired_cluster_ts_ = 0;
+
+    //a pooled outgoing TCP connection toward another node
+    struct pooled_conn {
+        std::shared_ptr<connection> conn_;
+        std::chrono::system_clock::time_point last_use_;
+    };
+
+    //outgoing TCP connections kept open toward other nodes, keyed by host:listening port.
+    //accessed by peer thread only.
+    std::unordered_map<std::string, pooled_conn> conn_pool_;
+
+    //the keys shared across the cluster;
+    //values received with binary data messages lie inside the packet buffers.
+    store store_;
+
+    //for each shard: the version this node would like to reach and
+    //the connection its data has been requested on, if a synch is in progress.
+    std::array<uint64_t, STORE_SHARDS> desired_shard_ts_ = {};
+    std::array<std::shared_ptr<connection>, STORE_SHARDS> synch_conns_;
+
+    //the connection a reconciliation is in progress on, the requests still unanswered,
+    //the keys stored so far, whether some bucket differs and when it started.
+    std::shared_ptr<connection> reconcile_conn_;
+    unsigned reconcile_pending_ = 0;
+    size_t reconcile_stored_ = 0;
+    bool reconcile_diverged_ = false;
+    std::chrono::system_clock::time_point tp_reconcile_;
+
+    //a multicast data transfer, either being received or kept to repair the ones of other nodes
+    struct mcast_xfer {
+        unsigned shard_ = 0;
+        //the whole framed data message; its values are kept inside it once stored
+        std::shared_ptr<g_bbuf> buf_;
+        size_t total_ = 0;
+        std::vector<bool> got_;
+        uint32_t missing_ = 0;
+        //the nodes missing chunks are requested to: the origin first, then the nodes announcing the version
+        std::vector<std::pair<std::string, uint16_t>> holders_;
+        unsigned holder_ = 0;
+        std::chrono::system_clock::time_point last_progress_;
+        std::chrono::system_clock::time_point last_nak_;
+    };
+
+    //multicast data transfers, keyed by the timestamp of their data message
+    std::map<uint64_t, mcast_xfer> mcast_xfers_;
+
+    //an encoded data message, immutable once built
+    struct data_msg_enc {
+        //store generation and format it has been built for
+        uint64_t gen_ = 0;
+        bool bin_ = false;
+        //the whole framed message, either in a buffer or, when large, in a mem_file
+        g_bslice pkt_;
+        std::shared_ptr<mem_file> file_;
+    };
+
+    //the data message with all the shards, invalidated when the store changes
+    data_msg_enc full_data_msg_;
+
+    //the framed alive message, the timestamp, the store generation and the format it has been encoded with
+    g_bbuf_ptr alive_msg_;
+    uint64_t alive_msg_ts_ = 0;
+    uint64_t alive_msg_gen_ = 0;
+    bool alive_msg_bin_ = false;
+
+    //the last time a JSON-only node has been heard (never: epoch)
+    std::chrono::system_clock::time_point tp_json_node_seen_;
+
+    //the store published in shared memory, for the readers on this host
+    shm_publisher shm_;
+
+    //requests made through the API, and the mutex serializing their producers on the incoming queue
+    mpsc_qu<api_req> api_q_;
+    std::mutex api_mtx_;
+
+    //a write made by this node, awaiting its write concern
+    struct pending_write {
+        unsigned shard_ = 0;
+        uint64_t ts_ = 0;
+        std::chrono::system_clock::time_point start_;
+        std::chrono::system_clock::time_point deadline_;
+        std::unordered_set<std::string> acks_;
+        std::promise<api_result> res_;
+
+        //the write concern
+        unsigned need_ = 0;
+        bool all_ = false;
+
+        //the local client waiting for the result instead of res_, with the key it wrote
+        std::shared_ptr<connection> local_conn_;
+        std::string key_;
+    };
+    std::vector<pending_write> pending_writes_;
+
+    //the parsed write concern
+    unsigned write_acks_ = 1;
+    bool write_all_ = false;
+
+    //the nodes heard lately, with the last time they have been heard: a write concern of all waits for them
+    std::map<std::string, std::chrono::system_clock::time_point> nodes_seen_;
+
+    //the last time a node has been heard for the first time
+    std::chrono::system_clock::time_point tp_node_new_;
+
+    //the write of a setter node: it exits once completed
+    std::future<api_result> set_res_;
+
+    //set before starting the node
+    change_cb on_change_;
+
+    //a local client the changes of a key - of all the keys if empty - are pushed to
+    struct watcher {
+        std::shared_ptr<connection> conn_;
+        std::string key_;
+    };
+    std::vector<watcher> watchers_;
 
-    //the value shared across the cluser
-    std::string data_;
+    //the JSON reader, reused for all the JSON packets
+    std::unique_ptr<Json::CharReader> json_reader_;
 
     //exit required
     bool exit_required_ = false;
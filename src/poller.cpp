@@ -0,0 +1,518 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifdef __GNUG__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include "poller.h"
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_EXT_ARG
+#define NDS_IO_URING
+#endif
+#endif
+#endif
+#ifdef NDS_IO_URING
+#include <poll.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+#endif
+
+#define EPOLL_MAX_EVTS 256
+#define URING_ENTRIES 256
+#define URING_CQ_ENTRIES 4096
+
+namespace nds {
+
+//select_poller
+
+select_poller::select_poller()
+{
+    FD_ZERO(&read_FDs_);
+    FD_ZERO(&write_FDs_);
+}
+
+RetCode select_poller::init()
+{
+    return RetCode_OK;
+}
+
+RetCode select_poller::add(SOCKET sckt, int interest)
+{
+    if(sckt < 0 || sckt >= FD_SETSIZE) {
+        return RetCode_OVRSZ;
+    }
+    interests_[sckt] = interest;
+    return RetCode_OK;
+}
+
+RetCode select_poller::modify(SOCKET sckt, int interest)
+{
+    auto it = interests_.find(sckt);
+    if(it == interests_.end()) {
+        return RetCode_NOTFOUND;
+    }
+    it->second = interest;
+    return RetCode_OK;
+}
+
+RetCode select_poller::remove(SOCKET sckt)
+{
+    return interests_.erase(sckt) ? RetCode_OK : RetCode_NOTFOUND;
+}
+
+int select_poller::wait(std::vector<poll_evt> &ready, int timeout_ms)
+{
+    ready.clear();
+    FD_ZERO(&read_FDs_);
+    FD_ZERO(&write_FDs_);
+
+    int nfds = -1;
+    for(auto it = interests_.begin(); it != interests_.end(); ++it) {
+        if(it->second & PollFlag_READ) {
+            FD_SET(it->first, &read_FDs_);
+        }
+        if(it->second & PollFlag_WRITE) {
+            FD_SET(it->first, &write_FDs_);
+        }
+        nfds = ((int)it->first > nfds) ? (int)it->first : nfds;
+    }
+
+    timeval sel_timeout;
+    sel_timeout.tv_sec = timeout_ms / 1000;
+    sel_timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+    int sel_res = select(nfds+1, &read_FDs_, &write_FDs_, 0, &sel_timeout);
+    if(sel_res <= 0) {
+        return (sel_res < 0 && errno == EINTR) ? 0 : sel_res;
+    }
+
+    for(auto it = interests_.begin(); it != interests_.end() && sel_res; ++it) {
+        poll_evt pe = {it->first, PollFlag_NONE};
+        if(FD_ISSET(it->first, &read_FDs_)) {
+            pe.flags_ |= PollFlag_READ;
+            --sel_res;
+        }
+        if(FD_ISSET(it->first, &write_FDs_)) {
+            pe.flags_ |= PollFlag_WRITE;
+            --sel_res;
+        }
+        if(pe.flags_) {
+            ready.push_back(pe);
+        }
+    }
+    return (int)ready.size();
+}
+
+//epoll_poller
+
+epoll_poller::epoll_poller() :
+    epfd_(-1),
+    evts_(EPOLL_MAX_EVTS)
+{}
+
+epoll_poller::~epoll_poller()
+{
+    if(epfd_ >= 0) {
+        close(epfd_);
+    }
+}
+
+RetCode epoll_poller::init()
+{
+    if((epfd_ = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        return RetCode_SYSERR;
+    }
+    return RetCode_OK;
+}
+
+RetCode epoll_poller::ctl(int op, SOCKET sckt, int interest)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLET | EPOLLRDHUP;
+    if(interest & PollFlag_READ) {
+        ev.events |= EPOLLIN;
+    }
+    if(interest & PollFlag_WRITE) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.fd = sckt;
+    if(epoll_ctl(epfd_, op, sckt, &ev) < 0) {
+        return (errno == ENOENT || errno == EBADF) ? RetCode_NOTFOUND : RetCode_SYSERR;
+    }
+    return RetCode_OK;
+}
+
+RetCode epoll_poller::add(SOCKET sckt, int interest)
+{
+    return ctl(EPOLL_CTL_ADD, sckt, interest);
+}
+
+RetCode epoll_poller::modify(SOCKET sckt, int interest)
+{
+    return ctl(EPOLL_CTL_MOD, sckt, interest);
+}
+
+RetCode epoll_poller::remove(SOCKET sckt)
+{
+    return ctl(EPOLL_CTL_DEL, sckt, PollFlag_NONE);
+}
+
+int epoll_poller::wait(std::vector<poll_evt> &ready, int timeout_ms)
+{
+    ready.clear();
+    int nevts = epoll_wait(epfd_, evts_.data(), (int)evts_.size(), timeout_ms);
+    if(nevts <= 0) {
+        return (nevts < 0 && errno == EINTR) ? 0 : nevts;
+    }
+    for(int i = 0; i < nevts; ++i) {
+        poll_evt pe = {evts_[i].data.fd, PollFlag_NONE};
+        if(evts_[i].events & (EPOLLIN | EPOLLRDHUP)) {
+            pe.flags_ |= PollFlag_READ;
+        }
+        if(evts_[i].events & EPOLLOUT) {
+            pe.flags_ |= PollFlag_WRITE;
+        }
+        if(evts_[i].events & (EPOLLERR | EPOLLHUP)) {
+            pe.flags_ |= PollFlag_ERROR;
+        }
+        ready.push_back(pe);
+    }
+    return nevts;
+}
+
+//uring
+
+uring::uring() :
+    ring_fd_(-1),
+    to_submit_(0),
+    sq_ptr_(MAP_FAILED),
+    sq_sz_(0),
+    sq_entries_(0),
+    sq_head_(nullptr),
+    sq_tail_(nullptr),
+    sq_mask_(nullptr),
+    sq_array_(nullptr),
+    sqes_((struct io_uring_sqe *)MAP_FAILED),
+    sqes_sz_(0),
+    cq_ptr_(MAP_FAILED),
+    cq_sz_(0),
+    cq_head_(nullptr),
+    cq_tail_(nullptr),
+    cq_mask_(nullptr),
+    cqes_(nullptr)
+{}
+
+#ifdef NDS_IO_URING
+
+uring::~uring()
+{
+    if(sqes_ != MAP_FAILED) {
+        munmap(sqes_, sqes_sz_);
+    }
+    if(cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+        munmap(cq_ptr_, cq_sz_);
+    }
+    if(sq_ptr_ != MAP_FAILED) {
+        munmap(sq_ptr_, sq_sz_);
+    }
+    if(ring_fd_ >= 0) {
+        close(ring_fd_);
+    }
+}
+
+RetCode uring::init()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    //a completion for each operation in flight: two per connection, besides the accepts.
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_CQ_ENTRIES;
+
+    if((ring_fd_ = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params)) < 0) {
+        return RetCode_SYSERR;
+    }
+    if(!(params.features & IORING_FEAT_EXT_ARG)) {
+        return RetCode_UNSP;
+    }
+
+    sq_entries_ = params.sq_entries;
+    sq_sz_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_sz_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_sz_ = cq_sz_ = std::max(sq_sz_, cq_sz_);
+    }
+
+    if((sq_ptr_ = mmap(0, sq_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd_, IORING_OFF_SQ_RING)) == MAP_FAILED) {
+        return RetCode_MEMERR;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr_ = sq_ptr_;
+    } else if((cq_ptr_ = mmap(0, cq_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                              ring_fd_, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+        return RetCode_MEMERR;
+    }
+    sqes_sz_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    if((sqes_ = (struct io_uring_sqe *)mmap(0, sqes_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                            ring_fd_, IORING_OFF_SQES)) == MAP_FAILED) {
+        return RetCode_MEMERR;
+    }
+
+    sq_head_ = (unsigned *)((char *)sq_ptr_ + params.sq_off.head);
+    sq_tail_ = (unsigned *)((char *)sq_ptr_ + params.sq_off.tail);
+    sq_mask_ = (unsigned *)((char *)sq_ptr_ + params.sq_off.ring_mask);
+    sq_array_ = (unsigned *)((char *)sq_ptr_ + params.sq_off.array);
+    cq_head_ = (unsigned *)((char *)cq_ptr_ + params.cq_off.head);
+    cq_tail_ = (unsigned *)((char *)cq_ptr_ + params.cq_off.tail);
+    cq_mask_ = (unsigned *)((char *)cq_ptr_ + params.cq_off.ring_mask);
+    cqes_ = (struct io_uring_cqe *)((char *)cq_ptr_ + params.cq_off.cqes);
+    return RetCode_OK;
+}
+
+int uring::enter(unsigned to_submit, unsigned min_complete, int timeout_ms)
+{
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (__u64)(uintptr_t)&ts;
+
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    if(min_complete) {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+    return (int)syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, &arg, sizeof(arg));
+}
+
+struct io_uring_sqe *uring::get_sqe()
+{
+    unsigned tail = *sq_tail_;
+    if(tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        //submission ring full: flush it.
+        if(enter(to_submit_, 0, 0) < 0) {
+            return nullptr;
+        }
+        to_submit_ = 0;
+        if(tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+            return nullptr;
+        }
+    }
+    unsigned idx = tail & *sq_mask_;
+    struct io_uring_sqe *sqe = &sqes_[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[idx] = idx;
+    //the kernel reads the entry only at next io_uring_enter(), once the caller has filled it.
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    ++to_submit_;
+    return sqe;
+}
+
+RetCode uring::recvmsg(SOCKET sckt, struct msghdr *msg, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if(!sqe) {
+        return RetCode_QFULL;
+    }
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = sckt;
+    sqe->addr = (__u64)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->user_data = user_data;
+    return RetCode_OK;
+}
+
+RetCode uring::sendmsg(SOCKET sckt, const struct msghdr *msg, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if(!sqe) {
+        return RetCode_QFULL;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = sckt;
+    sqe->addr = (__u64)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+    return RetCode_OK;
+}
+
+RetCode uring::accept(SOCKET sckt, struct sockaddr *addr, socklen_t *len, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if(!sqe) {
+        return RetCode_QFULL;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = sckt;
+    sqe->addr = (__u64)(uintptr_t)addr;
+    sqe->addr2 = (__u64)(uintptr_t)len;
+    sqe->user_data = user_data;
+    return RetCode_OK;
+}
+
+RetCode uring::connect(SOCKET sckt, const struct sockaddr *addr, socklen_t len, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if(!sqe) {
+        return RetCode_QFULL;
+    }
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = sckt;
+    sqe->addr = (__u64)(uintptr_t)addr;
+    sqe->off = len;
+    sqe->user_data = user_data;
+    return RetCode_OK;
+}
+
+RetCode uring::read(int fd, void *buf, unsigned len, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if(!sqe) {
+        return RetCode_QFULL;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (__u64)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->user_data = user_data;
+    return RetCode_OK;
+}
+
+RetCode uring::poll_write(SOCKET sckt, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if(!sqe) {
+        return RetCode_QFULL;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = sckt;
+    sqe->poll32_events = POLLOUT | POLLERR | POLLHUP;
+    sqe->user_data = user_data;
+    return RetCode_OK;
+}
+
+RetCode uring::cancel(uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if(!sqe) {
+        return RetCode_QFULL;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = 0;
+    return RetCode_OK;
+}
+
+int uring::wait(std::vector<uring_cpl> &cpls, int timeout_ms)
+{
+    cpls.clear();
+
+    //submit queued operations and wait for completions with a single syscall.
+    bool cq_empty = (*cq_head_ == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE));
+    if(cq_empty || to_submit_) {
+        int res = enter(to_submit_, cq_empty ? 1 : 0, timeout_ms);
+        if(res >= 0) {
+            to_submit_ -= std::min((unsigned)res, to_submit_);
+        } else if(errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+            return -1;
+        }
+    }
+
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for(; head != tail; ++head) {
+        const struct io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+        uring_cpl cpl = {cqe.user_data, cqe.res};
+        cpls.push_back(cpl);
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return (int)cpls.size();
+}
+
+#else
+
+uring::~uring() {}
+
+RetCode uring::init()
+{
+    return RetCode_UNSP;
+}
+
+RetCode uring::recvmsg(SOCKET, struct msghdr *, uint64_t)
+{
+    return RetCode_UNSP;
+}
+
+RetCode uring::sendmsg(SOCKET, const struct msghdr *, uint64_t)
+{
+    return RetCode_UNSP;
+}
+
+RetCode uring::accept(SOCKET, struct sockaddr *, socklen_t *, uint64_t)
+{
+    return RetCode_UNSP;
+}
+
+RetCode uring::connect(SOCKET, const struct sockaddr *, socklen_t, uint64_t)
+{
+    return RetCode_UNSP;
+}
+
+RetCode uring::read(int, void *, unsigned, uint64_t)
+{
+    return RetCode_UNSP;
+}
+
+RetCode uring::poll_write(SOCKET, uint64_t)
+{
+    return RetCode_UNSP;
+}
+
+RetCode uring::cancel(uint64_t)
+{
+    return RetCode_UNSP;
+}
+
+int uring::wait(std::vector<uring_cpl> &, int)
+{
+    return -1;
+}
+
+struct io_uring_sqe *uring::get_sqe()
+{
+    return nullptr;
+}
+
+int uring::enter(unsigned, unsigned, int)
+{
+    return -1;
+}
+
+#endif
+
+}
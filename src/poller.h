@@ -0,0 +1,195 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+#include "nds.h"
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace nds {
+
+/**
+ * Interest/readiness flags of a monitored socket.
+ */
+enum PollFlag {
+    PollFlag_NONE   = 0,
+    PollFlag_READ   = 1,    //socket readable (or listening socket with pending accepts)
+    PollFlag_WRITE  = 2,    //socket writable
+    PollFlag_ERROR  = 4,    //error or hang-up condition (readiness only)
+};
+
+/**
+ * A readiness notification produced by a poller.
+ */
+struct poll_evt {
+    SOCKET socket_;
+    int flags_;
+};
+
+/**
+ * poller
+ *
+ * The I/O multiplexer used by the selector.
+ * A socket is registered once (add) and its interest set is changed (modify) only
+ * when the state of the owning connection changes; a socket is deregistered (remove)
+ * before being closed.
+ * Consumers of readiness notifications must always drain a ready socket until it would block,
+ * as implementations are allowed to report readiness only on transitions (edge-triggered).
+ */
+struct poller {
+    virtual ~poller() {}
+
+    virtual const char *name() const = 0;
+
+    virtual RetCode init() = 0;
+
+    virtual RetCode add(SOCKET sckt, int interest) = 0;
+    virtual RetCode modify(SOCKET sckt, int interest) = 0;
+    virtual RetCode remove(SOCKET sckt) = 0;
+
+    //waits at most timeout_ms milliseconds for readiness notifications.
+    //returns the number of notifications put in ready, 0 on timeout, -1 on error.
+    virtual int wait(std::vector<poll_evt> &ready, int timeout_ms) = 0;
+};
+
+/**
+ * select() based poller.
+ *
+ * Level-triggered; it rebuilds the fd_sets from the registered interests at each wait.
+ * It cannot monitor sockets whose value is greater or equal than FD_SETSIZE.
+ * It is the fallback poller, always available.
+ */
+struct select_poller : public poller {
+    explicit select_poller();
+
+    virtual const char *name() const override {
+        return "select";
+    }
+
+    virtual RetCode init() override;
+    virtual RetCode add(SOCKET sckt, int interest) override;
+    virtual RetCode modify(SOCKET sckt, int interest) override;
+    virtual RetCode remove(SOCKET sckt) override;
+    virtual int wait(std::vector<poll_evt> &ready, int timeout_ms) override;
+
+    std::unordered_map<SOCKET, int> interests_;
+    fd_set read_FDs_, write_FDs_;
+};
+
+/**
+ * epoll based poller.
+ *
+ * Edge-triggered; the kernel keeps the interest list, so a wait costs
+ * O(ready sockets) instead of O(registered sockets).
+ */
+struct epoll_poller : public poller {
+    explicit epoll_poller();
+    virtual ~epoll_poller();
+
+    virtual const char *name() const override {
+        return "epoll";
+    }
+
+    virtual RetCode init() override;
+    virtual RetCode add(SOCKET sckt, int interest) override;
+    virtual RetCode modify(SOCKET sckt, int interest) override;
+    virtual RetCode remove(SOCKET sckt) override;
+    virtual int wait(std::vector<poll_evt> &ready, int timeout_ms) override;
+
+    RetCode ctl(int op, SOCKET sckt, int interest);
+
+    int epfd_;
+    std::vector<struct epoll_event> evts_;
+};
+
+/**
+ * A completion of an operation submitted to a uring.
+ */
+struct uring_cpl {
+    uint64_t user_data_;
+    int res_;
+};
+
+/**
+ * io_uring instance, driven through raw syscalls.
+ *
+ * Unlike a poller it does not report readiness: the I/O operations themselves are queued
+ * in the submission ring and completed by the kernel. Queued operations are submitted together
+ * with the wait for completions, so that a loop iteration of the selector costs a single
+ * io_uring_enter() regardless of the number of operations submitted and completed.
+ * Requires a kernel supporting IORING_FEAT_EXT_ARG (5.11+); init fails with RetCode_UNSP
+ * when the kernel, or the headers nds is built with, lack it.
+ * Every buffer referenced by an operation must stay valid until its completion.
+ */
+struct uring {
+    explicit uring();
+    ~uring();
+
+    const char *name() const {
+        return "io_uring";
+    }
+
+    RetCode init();
+
+    //operations, completed with the given user data; res_ is as the return value of the
+    //corresponding syscall, with -errno on error.
+    RetCode recvmsg(SOCKET sckt, struct msghdr *msg, uint64_t user_data);
+    RetCode sendmsg(SOCKET sckt, const struct msghdr *msg, uint64_t user_data);
+    RetCode accept(SOCKET sckt, struct sockaddr *addr, socklen_t *len, uint64_t user_data);
+    RetCode connect(SOCKET sckt, const struct sockaddr *addr, socklen_t len, uint64_t user_data);
+    RetCode read(int fd, void *buf, unsigned len, uint64_t user_data);
+
+    //completes with the poll events once sckt is writable.
+    RetCode poll_write(SOCKET sckt, uint64_t user_data);
+
+    //cancels the operation submitted with user_data, which completes with -ECANCELED;
+    //the completion of the cancel request itself has user data 0.
+    RetCode cancel(uint64_t user_data);
+
+    //submits the queued operations and waits at most timeout_ms milliseconds for completions.
+    //returns the number of completions put in cpls, 0 on timeout, -1 on error.
+    int wait(std::vector<uring_cpl> &cpls, int timeout_ms);
+
+    struct io_uring_sqe *get_sqe();
+    int enter(unsigned to_submit, unsigned min_complete, int timeout_ms);
+
+    int ring_fd_;
+    unsigned to_submit_;
+
+    //submission ring
+    void *sq_ptr_;
+    size_t sq_sz_;
+    unsigned sq_entries_;
+    unsigned *sq_head_, *sq_tail_, *sq_mask_, *sq_array_;
+    struct io_uring_sqe *sqes_;
+    size_t sqes_sz_;
+
+    //completion ring
+    void *cq_ptr_;
+    size_t cq_sz_;
+    unsigned *cq_head_, *cq_tail_, *cq_mask_;
+    struct io_uring_cqe *cqes_;
+};
+
+}
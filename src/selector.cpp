@@ -27,8 +27,23 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <netdb.h>
 #include <ifaddrs.h>
 #include <linux/if_link.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
 #endif
 #include "peer.h"
+#include "local.h"
+
+//datagrams multicast back to back before letting the receivers drain them
+#define MCAST_BURST 64
+
+//milliseconds between two bursts of datagrams
+#define MCAST_PACE_MS 1
+
+//seconds a stopping selector is allowed to take sending the datagrams still queued
+#define MCAST_DRAIN_TIMEOUT 5
+
+//milliseconds a stopping selector waits for the operations in flight on its ring to be cancelled
+#define RING_DRAIN_TIMEOUT_MS 1000
 
 namespace nds {
 
@@ -76,6 +91,12 @@ RetCode acceptor::create_server_socket(SOCKET &serv_socket)
 
                 if(!listen(serv_socket_, SOMAXCONN)) {
                     log_->debug("listen OK");
+                    //accepts are drained until they would block.
+                    int flags = fcntl(serv_socket_, F_GETFL, 0);
+                    if(flags < 0 || fcntl(serv_socket_, F_SETFL, flags|O_NONBLOCK)) {
+                        log_->error("fcntl KO errno:{}", errno);
+                        return RetCode_SYSERR;
+                    }
                     break;
                 } else {
                     log_->error("listen KO");
@@ -98,25 +119,29 @@ RetCode acceptor::accept(std::shared_ptr<connection> &new_conn)
 {
     SOCKET socket = INVALID_SOCKET;
     struct sockaddr_in addr;
-    socklen_t len = 0;
+    socklen_t len = sizeof(addr);
 
     if((socket = ::accept(serv_socket_, (sockaddr *)&addr, &len)) == INVALID_SOCKET) {
         int err = errno;
+        if(err == EAGAIN || err == EWOULDBLOCK) {
+            return RetCode_SCKWBLK;
+        }
         log_->error("accept KO err:{}", err);
         return RetCode_SYSERR;
-    } else {
-        getpeername(socket, (sockaddr *)&addr, &len);
-
-        log_->debug("accept OK - socket:{}, host:{}, port:{}",
-                    socket,
-                    inet_ntoa(addr.sin_addr),
-                    ntohs(addr.sin_port));
-
-        new_conn->socket_ = socket;
-        new_conn->addr_ = addr;
-        new_conn->set_connection_established();
     }
-    return RetCode_OK;
+    return accepted(socket, addr, new_conn);
+}
+
+RetCode acceptor::accepted(SOCKET socket, const sockaddr_in &addr, std::shared_ptr<connection> &new_conn)
+{
+    log_->debug("accept OK - socket:{}, host:{}, port:{}",
+                socket,
+                inet_ntoa(addr.sin_addr),
+                ntohs(addr.sin_port));
+
+    new_conn->socket_ = socket;
+    new_conn->addr_ = addr;
+    return new_conn->set_connection_established();
 }
 
 //event
@@ -125,13 +150,13 @@ event::event() : evt_(Interrupt) {}
 
 event::event(EvtType evt) : evt_(evt) {}
 
-event::event(EvtType evt, std::shared_ptr<connection> &conn) :
+event::event(EvtType evt, const std::shared_ptr<connection> &conn) :
     evt_(evt),
     conn_(conn)
 {}
 
-event::event(std::shared_ptr<connection> &conn,
-             std::unique_ptr<g_bbuf> &&rdn_pkt,
+event::event(const std::shared_ptr<connection> &conn,
+             g_bbuf_ptr &&rdn_pkt,
              const char *src_ip) :
     evt_(PacketAvailable),
     conn_(conn),
@@ -140,40 +165,54 @@ event::event(std::shared_ptr<connection> &conn,
     memcpy(opt_src_ip_, src_ip, sizeof(opt_src_ip_));
 }
 
-selector::selector(peer &p) :
+selector::selector(peer &p, unsigned shard_id) :
     peer_(p),
+    shard_id_(shard_id),
     status_(SelectorStatus_TO_INIT),
-    nfds_(-1),
-    sel_res_(-1),
-    udp_ntfy_srv_socket_(INVALID_SOCKET),
-    udp_ntfy_cli_socket_(INVALID_SOCKET),
+    ring_seq_(0),
+    ntfy_read_id_(0),
+    srv_accept_id_(0),
+    local_accept_id_(0),
+    ntfy_cnt_(0),
+    ring_acc_len_(0),
+    ntfy_evt_fd_(-1),
+    ntfy_pending_(false),
+    peer_intr_ms_(0),
     srv_socket_(INVALID_SOCKET),
     srv_acceptor_(p),
+    local_socket_(INVALID_SOCKET),
     mcast_udp_inco_conn_(new connection(*this, ConnectionType_UDP_INGOING)),
-    mcast_udp_outg_conn_(*this, ConnectionType_UDP_OUTGOING)
+    mcast_udp_outg_conn_(*this, ConnectionType_UDP_OUTGOING),
+    mcast_queued_(0)
 {
-    memset(&udp_ntfy_sa_in_, 0, sizeof(udp_ntfy_sa_in_));
-    udp_ntfy_sa_in_.sin_family = AF_INET;
-    udp_ntfy_sa_in_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    memset(&ring_acc_addr_, 0, sizeof(ring_acc_addr_));
     memset(&srv_sockaddr_in_, 0, sizeof(srv_sockaddr_in_));
     srv_sockaddr_in_.sin_family = AF_INET;
     srv_sockaddr_in_.sin_addr.s_addr = INADDR_ANY;
-    FD_ZERO(&read_FDs_);
-    FD_ZERO(&write_FDs_);
 }
 
 selector::~selector()
-{}
+{
+    if(ntfy_evt_fd_ >= 0) {
+        close(ntfy_evt_fd_);
+    }
+}
 
 RetCode selector::init()
 {
     log_ = peer_.log_;
 
+    RET_ON_KO(init_poller())
+    RET_ON_KO(create_notify_evt_fd())
+
+    if(!primary()) {
+        set_status(SelectorStatus_INIT);
+        return RetCode_OK;
+    }
+
     enumHostNetInterfaces();
 
     RET_ON_KO(srv_acceptor_.set_sockaddr_in(srv_sockaddr_in_))
-    RET_ON_KO(create_UDP_notify_srv_sock())
-    RET_ON_KO(connect_UDP_notify_cli_sock())
 
     struct sockaddr_in mcast_p;
     mcast_p.sin_family = AF_INET;
@@ -246,407 +285,583 @@ RetCode selector::await_for_status_reached(SelectorStatus test,
     return rcode;
 }
 
-RetCode selector::create_UDP_notify_srv_sock()
+RetCode selector::create_notify_evt_fd()
 {
-    int res = 0;
-    if((udp_ntfy_srv_socket_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) != INVALID_SOCKET) {
-        log_->debug("udp_ntfy_srv_socket_:{} OK", udp_ntfy_srv_socket_);
-        if(!bind(udp_ntfy_srv_socket_, (sockaddr *)&udp_ntfy_sa_in_, sizeof(udp_ntfy_sa_in_))) {
-
-            log_->debug("udp_ntfy_srv_socket_:{} bind OK", udp_ntfy_srv_socket_);
-
-            int flags = fcntl(udp_ntfy_srv_socket_, F_GETFL, 0);
-            if(flags < 0) {
-                return RetCode_KO;
-            }
-
-            flags = (flags|O_NONBLOCK);
-            if((res = fcntl(udp_ntfy_srv_socket_, F_SETFL, flags))) {
-                log_->critical("udp_ntfy_srv_socket_:{} fcntl KO err:{}", udp_ntfy_srv_socket_, errno);
-                return RetCode_SYSERR;
-            } else {
-                log_->debug("udp_ntfy_srv_socket_:{} fcntl OK", udp_ntfy_srv_socket_);
-            }
-
-        } else {
-            log_->critical("udp_ntfy_srv_socket_:{} bind KO err:{}", udp_ntfy_srv_socket_, errno);
-            return RetCode_SYSERR;
-        }
-    } else {
-        log_->critical("socket KO err:{}", errno);
+    //the ring reads it with an operation completing once it is signaled.
+    if((ntfy_evt_fd_ = eventfd(0, ring_ ? EFD_CLOEXEC : EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        log_->critical("eventfd KO err:{}", errno);
         return RetCode_SYSERR;
     }
+    log_->debug("ntfy_evt_fd_:{} OK", ntfy_evt_fd_);
     return RetCode_OK;
 }
 
-RetCode selector::connect_UDP_notify_cli_sock()
+RetCode selector::interrupt()
 {
-    socklen_t len = sizeof(udp_ntfy_sa_in_);
-    getsockname(udp_ntfy_srv_socket_, (struct sockaddr *)&udp_ntfy_sa_in_, &len);
-
-    log_->debug("sin_addr:{}, sin_port:{}",
-                inet_ntoa(udp_ntfy_sa_in_.sin_addr),
-                htons(udp_ntfy_sa_in_.sin_port));
+    return notify(event());
+}
 
-    if((udp_ntfy_cli_socket_ = socket(AF_INET, SOCK_DGRAM, 0)) != INVALID_SOCKET) {
-        log_->debug("udp_ntfy_cli_socket_:{} OK", udp_ntfy_cli_socket_);
-        if((connect(udp_ntfy_cli_socket_, (struct sockaddr *)&udp_ntfy_sa_in_, sizeof(udp_ntfy_sa_in_))) != INVALID_SOCKET) {
-            log_->debug("udp_ntfy_cli_socket_:{} connect OK", udp_ntfy_cli_socket_);
-        } else {
-            log_->critical("udp_ntfy_cli_socket_:{} connect KO errno:{}", udp_ntfy_cli_socket_, errno);
-            return RetCode_SYSERR;
-        }
-    } else {
-        log_->critical("socket KO");
+RetCode selector::notify(event &&evt)
+{
+    asyn_evt_q_.put(std::move(evt));
+    if(ntfy_pending_.exchange(true)) {
+        //selector already signaled and not yet woken up.
+        return RetCode_OK;
+    }
+    uint64_t one = 1;
+    if(write(ntfy_evt_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        log_->error("ntfy_evt_fd_:{} errno:{}", ntfy_evt_fd_, errno);
         return RetCode_SYSERR;
     }
     return RetCode_OK;
 }
 
-RetCode selector::interrupt()
+RetCode selector::init_poller()
 {
-    event *interrupt = new event();
-    return notify(interrupt);
+    if(peer_.cfg_.multiplexer == "uring") {
+        ring_.reset(new uring());
+        if(!ring_->init()) {
+            log_->debug("using {} ring", ring_->name());
+            return RetCode_OK;
+        }
+        log_->warn("{} init KO errno:{}, falling back to select", ring_->name(), errno);
+        ring_.reset();
+    } else if(peer_.cfg_.multiplexer == "epoll") {
+        poller_.reset(new epoll_poller());
+    } else if(peer_.cfg_.multiplexer != "select") {
+        log_->warn("unsupported multiplexer:{}, falling back to select", peer_.cfg_.multiplexer);
+    }
+    if(poller_) {
+        if(!poller_->init()) {
+            log_->debug("using {} poller", poller_->name());
+            return RetCode_OK;
+        }
+        log_->warn("{} poller init KO errno:{}, falling back to select", poller_->name(), errno);
+    }
+    poller_.reset(new select_poller());
+    return poller_->init();
 }
 
-RetCode selector::notify(const event *evt)
+const char *selector::multiplexer_name() const
 {
-    long bsent = 0;
-    while((bsent = send(udp_ntfy_cli_socket_, (const char *)&evt, sizeof(void *), 0)) == SOCKET_ERROR) {
-        int err = errno;
-        if(err == EAGAIN || err == EWOULDBLOCK) {
-            //ok we can go ahead
-        } else if(err == ECONNRESET) {
-            log_->error("udp_ntfy_cli_socket_:{} errno:{}",  udp_ntfy_cli_socket_, err);
-            return RetCode_KO;
-        } else {
-            log_->error("udp_ntfy_cli_socket_:{} errno:{}",  udp_ntfy_cli_socket_, err);
-            return RetCode_SYSERR;
-        }
-    }
-    return RetCode_OK;
+    return ring_ ? ring_->name() : poller_->name();
 }
 
 RetCode selector::start_conn_objs()
 {
     RetCode res = RetCode_OK;
+
+    //internal notification eventfd
+    RET_ON_KO(ring_ ? ring_read_ntfy() : poller_->add(ntfy_evt_fd_, PollFlag_READ))
+
+    if(!primary()) {
+        return res;
+    }
+
     if((res = srv_acceptor_.create_server_socket(srv_socket_))) {
         log_->critical("starting acceptor, last_err:{}",  res);
         return RetCode_KO;
     }
 
     //listening TCP socket
-    FD_SET(srv_socket_, &read_FDs_);
-    nfds_ = (int)srv_socket_;
-
-    //internal fake UDP socket
-    FD_SET(udp_ntfy_srv_socket_, &read_FDs_);
-    nfds_ = ((int)udp_ntfy_srv_socket_ > nfds_) ? (int)udp_ntfy_srv_socket_ : nfds_;
+    RET_ON_KO(ring_ ? ring_accept(false) : poller_->add(srv_socket_, PollFlag_READ))
 
     //multicast listening UDP socket
-    FD_SET(mcast_udp_inco_conn_->socket_, &read_FDs_);
-    nfds_ = ((int)mcast_udp_inco_conn_->socket_ > nfds_) ? (int)mcast_udp_inco_conn_->socket_ : nfds_;
+    RET_ON_KO(ring_ ? ring_recv(mcast_udp_inco_conn_) : poller_->add(mcast_udp_inco_conn_->socket_, PollFlag_READ))
+
+    //local listening socket
+    if(peer_.cfg_.start_node && !create_local_socket()) {
+        RET_ON_KO(ring_ ? ring_accept(true) : poller_->add(local_socket_, PollFlag_READ))
+    }
 
     return res;
 }
 
-RetCode selector::process_inco_sock_inco_events()
+RetCode selector::create_local_socket()
 {
-    SOCKET sckt = INVALID_SOCKET;
-    if(sel_res_) {
-        for(auto it = inco_conn_map_.begin(); it != inco_conn_map_.end(); it++) {
-            sckt = it->second->socket_;
-            //first: check if it is readable.
-            if(FD_ISSET(sckt, &read_FDs_)) {
-                conn_process_rdn_buff(it->second);
-                if(!(--sel_res_)) {
-                    break;
-                }
-            }
+    std::string path = peer_.cfg_.get_local_socket();
+    if(path.empty()) {
+        return RetCode_KO;
+    }
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) {
+        log_->error("local socket path too long:{}", path);
+        return RetCode_BADARG;
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+
+    if((local_socket_ = socket(AF_UNIX, SOCK_STREAM, 0)) == INVALID_SOCKET) {
+        log_->error("local socket KO errno:{}", errno);
+        return RetCode_SYSERR;
+    }
+    if(bind(local_socket_, (sockaddr *)&addr, sizeof(addr))) {
+        //the socket file left by a node no longer running is replaced.
+        local_client probe;
+        bool stale = (errno == EADDRINUSE) &&
+                     probe.connect(path, peer_.cfg_.connect_timeout_ms) == RetCode_UNVRSC;
+        if(!stale || unlink(path.c_str()) || bind(local_socket_, (sockaddr *)&addr, sizeof(addr))) {
+            log_->warn("local socket:{} is not served by this node", path);
+            local_socket_shutdown();
+            return RetCode_UNVRSC;
         }
     }
+    local_path_ = path;
+
+    //accepts are drained until they would block.
+    int flags = 0;
+    if(listen(local_socket_, SOMAXCONN) ||
+            (flags = fcntl(local_socket_, F_GETFL, 0)) < 0 ||
+            fcntl(local_socket_, F_SETFL, flags|O_NONBLOCK)) {
+        log_->error("local socket listen KO errno:{}", errno);
+        local_socket_shutdown();
+        return RetCode_SYSERR;
+    }
+    log_->debug("serving local socket:{}", path);
     return RetCode_OK;
 }
 
-inline RetCode selector::process_inco_sock_outg_events()
+std::shared_ptr<connection> selector::find_conn(SOCKET sckt)
 {
-    for(auto it = wp_inco_conn_map_.begin(); it != wp_inco_conn_map_.end(); it++) {
-        if(FD_ISSET(it->second->socket_, &write_FDs_)) {
-            it->second->aggr_msgs_and_send_pkt();
-            if(!(--sel_res_)) {
-                break;
-            }
-        }
+    auto it = inco_conn_map_.find(sckt);
+    if(it != inco_conn_map_.end()) {
+        return it->second;
     }
-    return RetCode_OK;
+    it = outg_conn_map_.find(sckt);
+    if(it != outg_conn_map_.end()) {
+        return it->second;
+    }
+    return std::shared_ptr<connection>();
 }
 
-inline RetCode selector::process_outg_sock_outg_events()
+inline std::unordered_map<SOCKET, std::shared_ptr<connection>> &selector::conn_map(const connection &conn)
 {
-    for(auto it = wp_outg_conn_map_.begin(); it != wp_outg_conn_map_.end(); it++) {
-        if(FD_ISSET(it->second->socket_, &write_FDs_)) {
-            it->second->aggr_msgs_and_send_pkt();
-            if(!(--sel_res_)) {
-                break;
-            }
-        }
+    return (conn.con_type_ == ConnectionType_TCP_INGOING) ? inco_conn_map_ : outg_conn_map_;
+}
+
+inline std::unordered_map<SOCKET, std::shared_ptr<connection>> &selector::wp_conn_map(const connection &conn)
+{
+    return (conn.con_type_ == ConnectionType_TCP_INGOING) ? wp_inco_conn_map_ : wp_outg_conn_map_;
+}
+
+RetCode selector::set_write_pending(std::shared_ptr<connection> &conn)
+{
+    if(!wp_conn_map(*conn).insert(std::make_pair(conn->socket_, conn)).second) {
+        //already write pending: writability is already monitored, or a send is in flight.
+        return RetCode_OK;
     }
-    return RetCode_OK;
+    if(ring_) {
+        return ring_send(conn);
+    }
+    return poller_->modify(conn->socket_, PollFlag_READ | PollFlag_WRITE);
 }
 
-RetCode selector::process_outg_sock_inco_events()
+void selector::release_conn(const std::shared_ptr<connection> &conn)
 {
-    if(sel_res_) {
-        for(auto it = outg_conn_map_.begin(); it != outg_conn_map_.end(); it++) {
-            //first: check if it is readable.
-            if(FD_ISSET(it->second->socket_, &read_FDs_)) {
-                conn_process_rdn_buff(it->second);
-                if(!(--sel_res_)) {
-                    break;
-                }
-            }
+    auto &cmap = conn_map(*conn);
+    auto it = cmap.find(conn->socket_);
+    if(it != cmap.end() && it->second == conn) {
+        wp_conn_map(*conn).erase(conn->socket_);
+        if(conn->con_type_ == ConnectionType_TCP_OUTGOING) {
+            pc_outg_conn_map_.erase(conn->socket_);
         }
+        cmap.erase(it);
     }
-    return RetCode_OK;
 }
 
-RetCode selector::consume_inco_sock_events()
+RetCode selector::accept_inco_conns()
 {
-    if(FD_ISSET(srv_socket_, &read_FDs_)) {
-
-        std::shared_ptr<connection> inco_conn(new connection(*this, ConnectionType_TCP_INGOING));
-        if(srv_acceptor_.accept(inco_conn)) {
-            log_->critical("accepting new connection");
-            return RetCode_KO;
+    RetCode rcode = RetCode_OK;
+    while(true) {
+        selector &owner = peer_.next_shard();
+        std::shared_ptr<connection> inco_conn(new connection(owner, ConnectionType_TCP_INGOING));
+        if((rcode = srv_acceptor_.accept(inco_conn))) {
+            break;
         }
-        inco_conn_map_[inco_conn->socket_] = inco_conn;
-        inco_conn->on_established();
+        hand_over_inco_conn(inco_conn);
+    }
+    //all pending connections have been accepted.
+    return (rcode == RetCode_SCKWBLK) ? RetCode_OK : rcode;
+}
 
-        --sel_res_;
-        if(sel_res_) {
-            if(process_inco_sock_inco_events()) {
-                log_->critical("processing incoming socket events");
-                return RetCode_KO;
+RetCode selector::accept_local_conns()
+{
+    while(true) {
+        SOCKET socket = ::accept(local_socket_, nullptr, nullptr);
+        if(socket == INVALID_SOCKET) {
+            int err = errno;
+            if(err == EAGAIN || err == EWOULDBLOCK) {
+                //all pending connections have been accepted.
+                return RetCode_OK;
             }
+            log_->error("local accept KO err:{}", err);
+            return RetCode_SYSERR;
         }
-
-    } else {
-        if(process_inco_sock_inco_events()) {
-            log_->critical("processing incoming socket events");
-            return RetCode_KO;
-        }
+        selector &owner = peer_.next_shard();
+        std::shared_ptr<connection> inco_conn(new connection(owner, ConnectionType_TCP_INGOING));
+        inco_conn->local_ = true;
+        inco_conn->socket_ = socket;
+        inco_conn->set_connection_established();
+        hand_over_inco_conn(inco_conn);
     }
-    return RetCode_OK;
 }
 
-inline void selector::FDSET_sockets()
+void selector::hand_over_inco_conn(std::shared_ptr<connection> &inco_conn)
 {
-    FD_ZERO(&read_FDs_);
-    FD_ZERO(&write_FDs_);
-    FDSET_incoming_sockets();
-    FDSET_outgoing_sockets();
-    FDSET_write_incoming_pending_sockets();
-    FDSET_write_outgoing_pending_sockets();
+    if(&inco_conn->sel_ == this) {
+        add_inco_conn(inco_conn);
+    } else {
+        inco_conn->sel_.notify(event(AcceptedConnect, inco_conn));
+    }
 }
 
-inline void selector::FDSET_write_incoming_pending_sockets()
+RetCode selector::add_inco_conn(std::shared_ptr<connection> &inco_conn)
 {
-    auto it = wp_inco_conn_map_.begin();
-    while(it != wp_inco_conn_map_.end()) {
-        if(it->second->acc_snd_buff_.available_read() ||
-                (it->second->cpkt_ && it->second->cpkt_->available_read()) ||
-                !it->second->pkt_sending_q_.empty()) {
-            FD_SET(it->second->socket_, &write_FDs_);
-            nfds_ = ((int)it->second->socket_ > nfds_) ? (int)it->second->socket_ : nfds_;
-            it++;
-        } else {
-            it = wp_inco_conn_map_.erase(it);
-        }
+    RetCode rcode = RetCode_OK;
+    if((rcode = ring_ ? ring_recv(inco_conn) : poller_->add(inco_conn->socket_, PollFlag_READ))) {
+        log_->error("{} add KO - socket:{}", multiplexer_name(), inco_conn->socket_);
+        inco_conn->close_connection();
+        return rcode;
     }
+    inco_conn_map_[inco_conn->socket_] = inco_conn;
+    inco_conn->on_established();
+    return rcode;
 }
 
-inline void selector::FDSET_write_outgoing_pending_sockets()
+RetCode selector::conn_flush_pending(std::shared_ptr<connection> &conn)
 {
-    auto it = wp_outg_conn_map_.begin();
-    while(it != wp_outg_conn_map_.end()) {
-        if(it->second->acc_snd_buff_.available_read() ||
-                (it->second->cpkt_ && it->second->cpkt_->available_read()) ||
-                !it->second->pkt_sending_q_.empty()) {
-            FD_SET(it->second->socket_, &write_FDs_);
-            nfds_ = ((int)it->second->socket_ > nfds_) ? (int)it->second->socket_ : nfds_;
-            it++;
-        } else {
-            it = wp_outg_conn_map_.erase(it);
-        }
+    auto &wp_map = wp_conn_map(*conn);
+    if(wp_map.find(conn->socket_) == wp_map.end()) {
+        return RetCode_OK;
     }
+    RetCode rcode = conn->aggr_msgs_and_send_pkt();
+    if(conn->status_ == ConnectionStatus_ESTABLISHED && !conn->pending_output()) {
+        //all sent: stop monitoring writability.
+        wp_map.erase(conn->socket_);
+        poller_->modify(conn->socket_, PollFlag_READ);
+    }
+    return rcode;
 }
 
-inline void selector::FDSET_incoming_sockets()
+RetCode selector::process_conn_events(std::shared_ptr<connection> &conn, int flags)
 {
-    auto it = inco_conn_map_.begin();
-    while(it != inco_conn_map_.end()) {
-        if(it->second->status_ == ConnectionStatus_ESTABLISHED) {
-            SOCKET inco_sock = it->second->socket_;
-            FD_SET(inco_sock, &read_FDs_);
-            nfds_ = ((int)inco_sock > nfds_) ? (int)inco_sock : nfds_;
-            it++;
-        } else {
-            SOCKET inco_sock = it->second->socket_;
-            wp_inco_conn_map_.erase(inco_sock);
-            it = inco_conn_map_.erase(it);
+    RetCode rcode = RetCode_OK;
+    if(conn->status_ == ConnectionStatus_CONNECTING) {
+        if(!(flags & (PollFlag_WRITE | PollFlag_ERROR))) {
+            return RetCode_OK;
+        }
+        if((rcode = complete_outg_conn(conn))) {
+            return rcode;
         }
     }
-
-    //listening TCP socket
-    FD_SET(srv_socket_, &read_FDs_);
-    nfds_ = ((int)srv_socket_ > nfds_) ? (int)srv_socket_ : nfds_;
-
-    //listening internal fake UDP socket
-    FD_SET(udp_ntfy_srv_socket_, &read_FDs_);
-    nfds_ = ((int)udp_ntfy_srv_socket_ > nfds_) ? (int)udp_ntfy_srv_socket_ : nfds_;
-
-    //multicast listening UDP socket
-    FD_SET(mcast_udp_inco_conn_->socket_, &read_FDs_);
-    nfds_ = ((int)mcast_udp_inco_conn_->socket_ > nfds_) ? (int)mcast_udp_inco_conn_->socket_ : nfds_;
+    if(flags & (PollFlag_READ | PollFlag_ERROR)) {
+        rcode = conn_process_rdn_buff(conn);
+    }
+    if((flags & PollFlag_WRITE) && conn->status_ == ConnectionStatus_ESTABLISHED) {
+        rcode = conn_flush_pending(conn);
+    }
+    if(conn->status_ == ConnectionStatus_DISCONNECTED) {
+        release_closed_conn(conn);
+    }
+    return rcode;
 }
 
-inline void selector::FDSET_outgoing_sockets()
+void selector::release_closed_conn(std::shared_ptr<connection> &conn)
 {
-    auto it = outg_conn_map_.begin();
-    while(it != outg_conn_map_.end()) {
-        if(it->second->status_ == ConnectionStatus_ESTABLISHED) {
-            FD_SET(it->second->socket_, &read_FDs_);
-            nfds_ = ((int)it->second->socket_ > nfds_) ? (int)it->second->socket_ : nfds_;
-            it++;
-        } else {
-            wp_outg_conn_map_.erase(it->second->socket_);
-            it = outg_conn_map_.erase(it);
-        }
+    release_conn(conn);
+    if(conn->con_type_ == ConnectionType_TCP_OUTGOING || conn->local_) {
+        //let the peer drop it from its pool, or stop pushing changes to a local client.
+        peer_.incoming_evt_q_.put(shard_id_, event(Disconnect, conn));
     }
 }
 
 inline RetCode selector::manage_disconnect_conn(event *conn_evt)
 {
     conn_evt->conn_->close_connection();
+    release_conn(conn_evt->conn_);
     return RetCode_OK;
 }
 
 inline RetCode selector::add_outg_conn(event *conn_evt)
 {
     RetCode rcode = RetCode_OK;
-    if((rcode = conn_evt->conn_->establish_connection(conn_evt->conn_->addr_))) {
+    std::shared_ptr<connection> &conn = conn_evt->conn_;
+    if(ring_) {
+        //the connect always completes with the ring.
+        rcode = ring_connect(conn);
+    } else if(!(rcode = conn->establish_connection(conn->addr_))) {
+        //a connect in progress completes when the socket becomes writable.
+        bool connecting = (conn->status_ == ConnectionStatus_CONNECTING);
+        if((rcode = poller_->add(conn->socket_, connecting ? PollFlag_READ | PollFlag_WRITE : PollFlag_READ))) {
+            log_->error("poller add KO - socket:{}", conn->socket_);
+            conn->close_connection();
+        }
+    }
+    if(rcode) {
+        peer_.incoming_evt_q_.put(shard_id_, event(ConnectFailed, conn));
         return rcode;
     }
-    outg_conn_map_[conn_evt->conn_->socket_] = conn_evt->conn_;
+    outg_conn_map_[conn->socket_] = conn;
+    if(conn->status_ == ConnectionStatus_CONNECTING) {
+        conn->connect_deadline_ = std::chrono::steady_clock::now() +
+                                  std::chrono::milliseconds(peer_.cfg_.connect_timeout_ms);
+        pc_outg_conn_map_[conn->socket_] = conn;
+    }
     return RetCode_OK;
 }
 
-inline bool selector::is_still_valid_connection(const event *evt)
+RetCode selector::complete_outg_conn(std::shared_ptr<connection> &conn)
 {
-    if(evt->conn_->con_type_ == ConnectionType_TCP_INGOING) {
-        return (inco_conn_map_.find(evt->conn_->socket_) != inco_conn_map_.end());
-    } else {
-        return (outg_conn_map_.find(evt->conn_->socket_) != outg_conn_map_.end());
+    pc_outg_conn_map_.erase(conn->socket_);
+    if(conn->complete_connection()) {
+        fail_outg_conn(conn);
+        return RetCode_KO;
     }
+    //keep monitoring writability only if packets have been queued meanwhile.
+    auto &wp_map = wp_conn_map(*conn);
+    bool wp = wp_map.find(conn->socket_) != wp_map.end();
+    return poller_->modify(conn->socket_, wp ? PollFlag_READ | PollFlag_WRITE : PollFlag_READ);
 }
 
-RetCode selector::process_asyn_evts()
+void selector::fail_outg_conn(const std::shared_ptr<connection> &conn)
 {
-    long brecv = 0, recv_buf_sz = sizeof(void *);
-    event *conn_evt = nullptr;
-    bool conn_still_valid = true;
-
-    while((brecv = recv(udp_ntfy_srv_socket_, (char *)&conn_evt, recv_buf_sz, 0)) > 0) {
+    if(conn->status_ != ConnectionStatus_DISCONNECTED) {
+        conn->close_connection();
+    }
+    release_conn(conn);
+    peer_.incoming_evt_q_.put(shard_id_, event(ConnectFailed, conn));
+}
 
-        if(brecv != recv_buf_sz) {
-            log_->critical("brecv != recv_buf_sz");
-            return RetCode_GENERR;
+int selector::check_connect_deadlines(int timeout_ms)
+{
+    if(pc_outg_conn_map_.empty()) {
+        return timeout_ms;
+    }
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<connection>> expired;
+    for(auto it = pc_outg_conn_map_.begin(); it != pc_outg_conn_map_.end(); ++it) {
+        if(it->second->connect_deadline_ <= now) {
+            expired.push_back(it->second);
+        } else {
+            int to_deadline = (int)std::chrono::duration_cast<std::chrono::milliseconds>
+                              (it->second->connect_deadline_ - now).count() + 1;
+            timeout_ms = std::min(timeout_ms, to_deadline);
         }
+    }
+    for(auto it = expired.begin(); it != expired.end(); ++it) {
+        log_->error("connect timeout -> host:{} - port:{}",
+                    inet_ntoa((*it)->addr_.sin_addr),
+                    htons((*it)->addr_.sin_port));
+        fail_outg_conn(*it);
+    }
+    return timeout_ms;
+}
 
-        if(conn_evt->evt_ != Interrupt) {
-
-            /*check if we still have connection*/
-            if(conn_evt->evt_ != ConnectRequest) {
-                conn_still_valid = is_still_valid_connection(conn_evt);
-            }
+RetCode selector::interrupt_peer_in(uint32_t ms)
+{
+    int64_t at = std::chrono::duration_cast<std::chrono::milliseconds>
+                 (std::chrono::steady_clock::now().time_since_epoch()).count() + ms;
+    //the nearest request wins.
+    int64_t cur = peer_intr_ms_.load();
+    while((!cur || at < cur) && !peer_intr_ms_.compare_exchange_weak(cur, at)) {}
+    //let the selector bound its wait.
+    return interrupt();
+}
 
-            if(conn_still_valid) {
-                switch(conn_evt->evt_) {
-                    case SendPacket:
-                        if(conn_evt->conn_->con_type_ == ConnectionType_TCP_INGOING) {
-                            wp_inco_conn_map_[conn_evt->conn_->socket_] = conn_evt-> conn_;
-                        } else {
-                            wp_outg_conn_map_[conn_evt->conn_->socket_] = conn_evt->conn_;
-                        }
-                        break;
-                    case ConnectRequest:
-                        add_outg_conn(conn_evt);
-                        break;
-                    case Disconnect:
-                        manage_disconnect_conn(conn_evt);
-                        break;
-                    default:
-                        log_->critical("unknown event");
-                        break;
-                }
-            } else {
-                log_->debug("socket:{} is no longer valid", conn_evt->conn_->socket_);
-            }
+int selector::check_peer_interrupt(int timeout_ms)
+{
+    int64_t at = peer_intr_ms_.load();
+    if(!at) {
+        return timeout_ms;
+    }
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>
+                  (std::chrono::steady_clock::now().time_since_epoch()).count();
+    if(at > now) {
+        return std::min(timeout_ms, (int)(at - now));
+    }
+    if(peer_intr_ms_.compare_exchange_strong(at, 0)) {
+        peer_.incoming_evt_q_.put(shard_id_, event());
+    }
+    return timeout_ms;
+}
 
+RetCode selector::send_mcast(const char *pkt, size_t len)
+{
+    //datagrams are not reordered: while some are queued, the following ones are queued too.
+    if(!mcast_queued_.load()) {
+        RetCode rcode = mcast_udp_outg_conn_.send_datagram(pkt, len);
+        if(rcode != RetCode_SCKWBLK) {
+            return rcode;
         }
-        delete conn_evt;
     }
-    if(brecv == SOCKET_ERROR) {
-        int err = errno;
+    mcast_out out;
+    out.pkt_ = g_bbuf_pool::instance().acquire(len);
+    out.pkt_->append(pkt, 0, len);
+    out.pkt_->set_read();
+    ++mcast_queued_;
+    mcast_out_q_.put(std::move(out));
+    return interrupt();
+}
 
-        if(err == EAGAIN || err == EWOULDBLOCK) {
-            //ok we can go ahead
-        } else if(err == ECONNRESET) {
-            log_->error("errno:{}", err);
-            return RetCode_KO;
+RetCode selector::send_mcast_chunks(const std::shared_ptr<g_bbuf> &xfer, size_t total, uint64_t ts, unsigned shard)
+{
+    mcast_out out;
+    out.xfer_ = xfer;
+    out.total_ = total;
+    out.ts_ = ts;
+    out.shard_ = shard;
+    out.count_ = (uint32_t)((total + WIRE_CHUNK_SZ - 1) / WIRE_CHUNK_SZ);
+    ++mcast_queued_;
+    mcast_out_q_.put(std::move(out));
+    return interrupt();
+}
+
+int selector::flush_mcast(int timeout_ms)
+{
+    mcast_out_q_.drain([&](mcast_out &out) {
+        mcast_pending_.push_back(std::move(out));
+    });
+    if(mcast_pending_.empty()) {
+        return timeout_ms;
+    }
+    //let the receivers drain a burst before the next one.
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(now - mcast_last_burst_ < std::chrono::milliseconds(MCAST_PACE_MS)) {
+        return std::min(timeout_ms, MCAST_PACE_MS);
+    }
+    mcast_last_burst_ = now;
+    uint16_t lp = ntohs(srv_sockaddr_in_.sin_port);
+    unsigned sent = 0;
+    while(!mcast_pending_.empty() && sent < MCAST_BURST) {
+        mcast_out &out = mcast_pending_.front();
+        RetCode rcode = RetCode_OK;
+        if(out.xfer_) {
+            g_bbuf_ptr pkt = encode_chunk_msg(lp, out.ts_, out.shard_, out.next_, out.xfer_->buf_, out.total_);
+            rcode = mcast_udp_outg_conn_.send_datagram(&pkt->buf_[pkt->pos_], pkt->available_read());
         } else {
-            log_->critical("errno:{}", err);
-            return RetCode_SYSERR;
+            rcode = mcast_udp_outg_conn_.send_datagram(&out.pkt_->buf_[out.pkt_->pos_], out.pkt_->available_read());
         }
+        if(rcode == RetCode_SCKWBLK) {
+            //the socket send buffer is full: retried with the next burst.
+            break;
+        }
+        ++sent;
+        if(rcode == RetCode_OK && out.xfer_ && ++out.next_ < out.count_) {
+            continue;
+        }
+        //a transfer failing is repaired by the nodes missing its chunks.
+        mcast_pending_.pop_front();
+        --mcast_queued_;
     }
-    if(!brecv) {
-        return RetCode_KO;
+    return mcast_pending_.empty() ? timeout_ms : std::min(timeout_ms, MCAST_PACE_MS);
+}
+
+void selector::drain_mcast()
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+                                                     std::chrono::seconds(MCAST_DRAIN_TIMEOUT);
+    while(mcast_queued_.load() && std::chrono::steady_clock::now() < deadline) {
+        flush_mcast(0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(MCAST_PACE_MS));
     }
-    return RetCode_OK;
 }
 
-inline RetCode selector::consume_events()
+inline bool selector::is_still_valid_connection(const event *evt)
+{
+    auto &cmap = conn_map(*evt->conn_);
+    auto it = cmap.find(evt->conn_->socket_);
+    return (it != cmap.end()) && (it->second == evt->conn_);
+}
+
+RetCode selector::process_asyn_evt(event &conn_evt)
 {
-    if(FD_ISSET(udp_ntfy_srv_socket_, &read_FDs_)) {
-        process_asyn_evts();
-        sel_res_--;
+    if(conn_evt.evt_ == Interrupt) {
+        return RetCode_OK;
     }
 
-    if(FD_ISSET(mcast_udp_inco_conn_->socket_, &read_FDs_)) {
-        conn_process_rdn_buff(mcast_udp_inco_conn_);
-        sel_res_--;
+    /*check if we still have connection*/
+    if(conn_evt.evt_ != ConnectRequest &&
+            conn_evt.evt_ != AcceptedConnect &&
+            !is_still_valid_connection(&conn_evt)) {
+        log_->debug("socket:{} is no longer valid", conn_evt.conn_->socket_);
+        return RetCode_OK;
     }
 
-    if(sel_res_) {
-        consume_inco_sock_events();
-        if(sel_res_) {
-            process_outg_sock_inco_events();
-        }
+    switch(conn_evt.evt_) {
+        case SendPacket:
+            set_write_pending(conn_evt.conn_);
+            break;
+        case ConnectRequest:
+            add_outg_conn(&conn_evt);
+            break;
+        case AcceptedConnect:
+            add_inco_conn(conn_evt.conn_);
+            break;
+        case Disconnect:
+            manage_disconnect_conn(&conn_evt);
+            break;
+        default:
+            log_->critical("unknown event");
+            break;
     }
+    return RetCode_OK;
+}
 
-    if(sel_res_) {
-        process_inco_sock_outg_events();
-        if(sel_res_) {
-            process_outg_sock_outg_events();
-        }
+RetCode selector::process_asyn_evts()
+{
+    uint64_t cnt = 0;
+    if(read(ntfy_evt_fd_, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN) {
+        log_->critical("ntfy_evt_fd_:{} errno:{}", ntfy_evt_fd_, errno);
+        return RetCode_SYSERR;
     }
+    return drain_asyn_evts();
+}
 
+RetCode selector::drain_asyn_evts()
+{
+    //from now on producers must signal again: events queued before this point are consumed below.
+    ntfy_pending_.store(false);
+    asyn_evt_q_.drain([&](event &conn_evt) {
+        process_asyn_evt(conn_evt);
+    });
+    return RetCode_OK;
+}
+
+RetCode selector::consume_events()
+{
+    for(auto it = ready_evts_.begin(); it != ready_evts_.end(); ++it) {
+        if(it->socket_ == ntfy_evt_fd_) {
+            process_asyn_evts();
+        } else if(it->socket_ == mcast_udp_inco_conn_->socket_) {
+            conn_process_rdn_buff(mcast_udp_inco_conn_);
+        } else if(it->socket_ == srv_socket_) {
+            if(accept_inco_conns()) {
+                log_->critical("accepting new connection");
+            }
+        } else if(it->socket_ == local_socket_) {
+            if(accept_local_conns()) {
+                log_->error("accepting new local connection");
+            }
+        } else {
+            std::shared_ptr<connection> conn = find_conn(it->socket_);
+            if(conn) {
+                process_conn_events(conn, it->flags_);
+            }
+        }
+    }
     return RetCode_OK;
 }
 
 RetCode selector::server_socket_shutdown()
 {
     int last_err_ = 0;
+    if(poller_) {
+        poller_->remove(srv_socket_);
+    } else if(srv_accept_id_) {
+        ring_->cancel(srv_accept_id_);
+        srv_accept_id_ = 0;
+    }
     if((last_err_ = close(srv_socket_))) {
         log_->error("socket:{} close KO res:{}", srv_socket_, last_err_);
     } else {
@@ -656,6 +871,26 @@ RetCode selector::server_socket_shutdown()
     return RetCode_OK;
 }
 
+RetCode selector::local_socket_shutdown()
+{
+    if(local_socket_ == INVALID_SOCKET) {
+        return RetCode_OK;
+    }
+    if(poller_) {
+        poller_->remove(local_socket_);
+    } else if(local_accept_id_) {
+        ring_->cancel(local_accept_id_);
+        local_accept_id_ = 0;
+    }
+    close(local_socket_);
+    local_socket_ = INVALID_SOCKET;
+    if(!local_path_.empty()) {
+        unlink(local_path_.c_str());
+        local_path_.clear();
+    }
+    return RetCode_OK;
+}
+
 RetCode selector::stop_and_clean()
 {
     for(auto it = inco_conn_map_.begin(); it != inco_conn_map_.end(); ++it)
@@ -665,30 +900,306 @@ RetCode selector::stop_and_clean()
 
     wp_inco_conn_map_.clear();
     inco_conn_map_.clear();
-    server_socket_shutdown();
+    if(primary()) {
+        server_socket_shutdown();
+        local_socket_shutdown();
+    }
 
     for(auto it = outg_conn_map_.begin(); it != outg_conn_map_.end(); ++it)
         if(it->second->status_ != ConnectionStatus_DISCONNECTED) {
             it->second->close_connection();
         }
 
+    wp_outg_conn_map_.clear();
+    pc_outg_conn_map_.clear();
     outg_conn_map_.clear();
 
-    FD_ZERO(&read_FDs_);
-    FD_ZERO(&write_FDs_);
+    if(ring_) {
+        ring_drain();
+    }
     return RetCode_OK;
 }
 
 RetCode selector::conn_process_rdn_buff(std::shared_ptr<connection> &conn)
 {
     char src_ip[16];
-    RetCode rcode = conn->recv_bytes(src_ip);
-    while(!(rcode = conn->chase_pkt())) {
-        conn->recv_pkt(src_ip);
+    RetCode rcode = RetCode_OK;
+    //read until the socket would block: pollers are allowed to be edge-triggered.
+    do {
+        rcode = conn->recv_bytes(src_ip);
+        while(!conn->chase_pkt()) {
+            conn->recv_pkt(src_ip);
+        }
+    } while(rcode == RetCode_OK && conn->status_ == ConnectionStatus_ESTABLISHED);
+    return rcode;
+}
+
+uint64_t selector::ring_track(RingOp op, const std::shared_ptr<connection> &conn)
+{
+    ring_op &rop = ring_ops_[++ring_seq_];
+    rop.op_ = op;
+    rop.conn_ = conn;
+    return ring_seq_;
+}
+
+RetCode selector::ring_read_ntfy()
+{
+    uint64_t id = ring_track(RingOp_NTFY_READ, std::shared_ptr<connection>());
+    RetCode rcode = ring_->read(ntfy_evt_fd_, &ntfy_cnt_, sizeof(ntfy_cnt_), id);
+    if(rcode) {
+        ring_ops_.erase(id);
+        log_->critical("ring read KO - ntfy_evt_fd_:{}", ntfy_evt_fd_);
+        return rcode;
+    }
+    ntfy_read_id_ = id;
+    return RetCode_OK;
+}
+
+RetCode selector::ring_accept(bool local)
+{
+    uint64_t id = ring_track(local ? RingOp_LOCAL_ACCEPT : RingOp_ACCEPT, std::shared_ptr<connection>());
+    RetCode rcode = RetCode_OK;
+    if(local) {
+        rcode = ring_->accept(local_socket_, nullptr, nullptr, id);
+    } else {
+        ring_acc_len_ = sizeof(ring_acc_addr_);
+        rcode = ring_->accept(srv_socket_, (sockaddr *)&ring_acc_addr_, &ring_acc_len_, id);
+    }
+    if(rcode) {
+        ring_ops_.erase(id);
+        log_->critical("ring accept KO - socket:{}", local ? local_socket_ : srv_socket_);
+        return rcode;
+    }
+    (local ? local_accept_id_ : srv_accept_id_) = id;
+    return RetCode_OK;
+}
+
+RetCode selector::ring_recv(std::shared_ptr<connection> &conn)
+{
+    conn->prep_recv_msg();
+    uint64_t id = ring_track(RingOp_RECV, conn);
+    RetCode rcode = ring_->recvmsg(conn->socket_, &conn->rcv_msg_, id);
+    if(rcode) {
+        ring_ops_.erase(id);
+        log_->error("ring recv KO - socket:{}", conn->socket_);
+        return rcode;
+    }
+    conn->ring_rcv_id_ = id;
+    return RetCode_OK;
+}
+
+RetCode selector::ring_send(std::shared_ptr<connection> &conn)
+{
+    RetCode rcode = RetCode_OK;
+    while(conn->status_ == ConnectionStatus_ESTABLISHED && !conn->ring_snd_id_) {
+        conn->pull_snd_pkts();
+        if(conn->snd_pkts_.empty()) {
+            //all sent: nothing in flight until packets are queued again.
+            wp_conn_map(*conn).erase(conn->socket_);
+            return RetCode_OK;
+        }
+        uint64_t id = 0;
+        if(conn->snd_pkts_.front().file_) {
+            //no user space copy: sent with sendfile(), the ring only waits for writability.
+            if((rcode = conn->send_file_pkt(conn->snd_pkts_.front())) == RetCode_OK) {
+                conn->snd_pkts_.pop_front();
+                continue;
+            }
+            if(rcode != RetCode_SCKWBLK) {
+                break;
+            }
+            id = ring_track(RingOp_WRITABLE, conn);
+            rcode = ring_->poll_write(conn->socket_, id);
+        } else {
+            conn->prep_send_msg();
+            id = ring_track(RingOp_SEND, conn);
+            rcode = ring_->sendmsg(conn->socket_, &conn->snd_msg_, id);
+        }
+        if(rcode) {
+            ring_ops_.erase(id);
+            log_->error("ring send KO - socket:{}", conn->socket_);
+            conn->close_connection();
+            break;
+        }
+        conn->ring_snd_id_ = id;
+    }
+    if(conn->status_ == ConnectionStatus_DISCONNECTED) {
+        release_closed_conn(conn);
     }
     return rcode;
 }
 
+RetCode selector::ring_connect(std::shared_ptr<connection> &conn)
+{
+    RET_ON_KO(conn->create_socket(conn->addr_))
+    uint64_t id = ring_track(RingOp_CONNECT, conn);
+    RetCode rcode = ring_->connect(conn->socket_, (sockaddr *)&conn->addr_, sizeof(conn->addr_), id);
+    if(rcode) {
+        ring_ops_.erase(id);
+        log_->error("ring connect KO - socket:{}", conn->socket_);
+        conn->close_connection();
+        return rcode;
+    }
+    log_->debug("connect in progress -> host:{} - port:{}",
+                inet_ntoa(conn->addr_.sin_addr),
+                htons(conn->addr_.sin_port));
+    conn->ring_snd_id_ = id;
+    conn->status_ = ConnectionStatus_CONNECTING;
+    return RetCode_OK;
+}
+
+void selector::ring_release(connection &conn)
+{
+    //operations in flight complete once cancelled: meanwhile they keep the buffers they use.
+    if(conn.ring_rcv_id_) {
+        auto it = ring_ops_.find(conn.ring_rcv_id_);
+        if(it != ring_ops_.end()) {
+            it->second.rdn_body_ = std::move(conn.curr_rdn_body_);
+        }
+        ring_->cancel(conn.ring_rcv_id_);
+        conn.ring_rcv_id_ = 0;
+    }
+    if(conn.ring_snd_id_) {
+        auto it = ring_ops_.find(conn.ring_snd_id_);
+        if(it != ring_ops_.end()) {
+            it->second.snd_pkts_.swap(conn.snd_pkts_);
+        }
+        ring_->cancel(conn.ring_snd_id_);
+        conn.ring_snd_id_ = 0;
+    }
+}
+
+RetCode selector::consume_completions()
+{
+    for(auto it = ring_cpls_.begin(); it != ring_cpls_.end(); ++it) {
+        auto op_it = ring_ops_.find(it->user_data_);
+        if(op_it == ring_ops_.end()) {
+            //completion of a cancel request.
+            continue;
+        }
+        ring_op op(std::move(op_it->second));
+        ring_ops_.erase(op_it);
+        process_completion(it->user_data_, op, it->res_);
+    }
+    return RetCode_OK;
+}
+
+void selector::process_completion(uint64_t user_data, ring_op &op, int res)
+{
+    std::shared_ptr<connection> &conn = op.conn_;
+    switch(op.op_) {
+        case RingOp_NTFY_READ:
+            if(user_data != ntfy_read_id_) {
+                break;
+            }
+            ntfy_read_id_ = 0;
+            if(res < 0) {
+                log_->critical("ntfy_evt_fd_:{} errno:{}", ntfy_evt_fd_, -res);
+            }
+            drain_asyn_evts();
+            ring_read_ntfy();
+            break;
+        case RingOp_ACCEPT:
+        case RingOp_LOCAL_ACCEPT: {
+            bool local = (op.op_ == RingOp_LOCAL_ACCEPT);
+            uint64_t &accept_id = local ? local_accept_id_ : srv_accept_id_;
+            if(user_data != accept_id) {
+                //the listening socket has been shut down meanwhile.
+                if(res >= 0) {
+                    close(res);
+                }
+                break;
+            }
+            accept_id = 0;
+            if(res >= 0) {
+                selector &owner = peer_.next_shard();
+                std::shared_ptr<connection> inco_conn(new connection(owner, ConnectionType_TCP_INGOING));
+                if(local) {
+                    inco_conn->local_ = true;
+                    inco_conn->socket_ = res;
+                    inco_conn->set_connection_established();
+                } else {
+                    srv_acceptor_.accepted(res, ring_acc_addr_, inco_conn);
+                }
+                hand_over_inco_conn(inco_conn);
+            } else {
+                log_->error("{}accept KO err:{}", local ? "local " : "", -res);
+            }
+            ring_accept(local);
+            break;
+        }
+        case RingOp_RECV: {
+            if(user_data != conn->ring_rcv_id_) {
+                break;
+            }
+            conn->ring_rcv_id_ = 0;
+            char src_ip[16];
+            RetCode rcode = conn->recv_msg_done(res, src_ip);
+            while(!conn->chase_pkt()) {
+                conn->recv_pkt(src_ip);
+            }
+            if(conn->status_ == ConnectionStatus_DISCONNECTED) {
+                release_closed_conn(conn);
+            } else if((rcode == RetCode_OK || rcode == RetCode_SCKWBLK) && ring_recv(conn)) {
+                conn->close_connection();
+                release_closed_conn(conn);
+            }
+            break;
+        }
+        case RingOp_SEND:
+        case RingOp_WRITABLE:
+            if(user_data != conn->ring_snd_id_) {
+                break;
+            }
+            conn->ring_snd_id_ = 0;
+            if(op.op_ == RingOp_SEND) {
+                conn->send_msg_done(res);
+            } else if(res < 0) {
+                conn->close_connection();
+            }
+            if(conn->status_ == ConnectionStatus_DISCONNECTED) {
+                release_closed_conn(conn);
+            } else {
+                ring_send(conn);
+            }
+            break;
+        case RingOp_CONNECT:
+            if(user_data != conn->ring_snd_id_) {
+                break;
+            }
+            conn->ring_snd_id_ = 0;
+            pc_outg_conn_map_.erase(conn->socket_);
+            if(conn->complete_connection(-res) || ring_recv(conn)) {
+                fail_outg_conn(conn);
+                break;
+            }
+            //packets queued meanwhile.
+            ring_send(conn);
+            break;
+        default:
+            break;
+    }
+}
+
+void selector::ring_drain()
+{
+    ntfy_read_id_ = 0;
+    for(auto it = ring_ops_.begin(); it != ring_ops_.end(); ++it) {
+        ring_->cancel(it->first);
+    }
+    //the completions are only waited for: the connections have already been closed.
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+                                                     std::chrono::milliseconds(RING_DRAIN_TIMEOUT_MS);
+    while(!ring_ops_.empty() && std::chrono::steady_clock::now() < deadline) {
+        if(ring_->wait(ring_cpls_, RING_DRAIN_TIMEOUT_MS) < 0) {
+            break;
+        }
+        for(auto it = ring_cpls_.begin(); it != ring_cpls_.end(); ++it) {
+            ring_ops_.erase(it->user_data_);
+        }
+    }
+}
+
 #define SEL_TIMEOUT 2
 
 void selector::run()
@@ -714,42 +1225,53 @@ void selector::run()
 
         set_status(SelectorStatus_SELECT);
 
-        timeval sel_timeout;
-        sel_timeout.tv_sec = SEL_TIMEOUT;
-        sel_timeout.tv_usec = 0;
-        time_t t0 = time(0), elapsed = 0;
+        int poll_res = 0;
+        time_t t0 = time(0), elapsed = 0, timeout = SEL_TIMEOUT;
 
         while(status_ == SelectorStatus_SELECT) {
 
-            if((sel_res_ = select(nfds_+1, &read_FDs_, &write_FDs_, 0, &sel_timeout)) > 0) {
-                log_->trace("+select() [interrupt]+");
-                consume_events();
-            } else if(!sel_res_) {
+            int timeout_ms = check_peer_interrupt(check_connect_deadlines((int)timeout*1000));
+            if(primary()) {
+                timeout_ms = flush_mcast(timeout_ms);
+            }
+            poll_res = ring_ ? ring_->wait(ring_cpls_, timeout_ms) : poller_->wait(ready_evts_, timeout_ms);
+            if(poll_res > 0) {
+                log_->trace("+{}() [interrupt]+", multiplexer_name());
+                if(ring_) {
+                    consume_completions();
+                } else {
+                    consume_events();
+                }
+            } else if(!poll_res) {
                 //timeout
 #if 0
-                log_->trace("+select() [timeout]+");
+                log_->trace("+{}() [timeout]+", multiplexer_name());
 #endif
-                peer_.incoming_evt_q_.put(event());
             } else {
                 //error
-                log_->error("+select() [errno:{}]+", errno);
+                log_->error("+{}() [errno:{}]+", multiplexer_name(), errno);
                 set_status(SelectorStatus_ERROR);
                 break;
             }
 
-            FDSET_sockets();
-
             if((elapsed = (time(0) - t0)) < SEL_TIMEOUT) {
-                sel_timeout.tv_sec = SEL_TIMEOUT - elapsed;
+                timeout = SEL_TIMEOUT - elapsed;
             } else {
+                //let the peer process its status at least every SEL_TIMEOUT seconds.
+                if(primary()) {
+                    peer_.incoming_evt_q_.put(shard_id_, event());
+                }
                 t0 = time(0);
-                sel_timeout.tv_sec = SEL_TIMEOUT;
+                timeout = SEL_TIMEOUT;
             }
-            sel_timeout.tv_usec = 0;
         }
 
         if(status_ == SelectorStatus_REQUEST_STOP) {
             log_->debug("+stop requested, clean initiated+");
+            if(primary()) {
+                //as the alive of a setter exiting.
+                drain_mcast();
+            }
             stop_and_clean();
             break;
         }
@@ -761,10 +1283,9 @@ void selector::run()
     } while(true);
 
     set_status(SelectorStatus_STOPPED);
-    stop();
 
     //generate interrupt on peer
-    peer_.incoming_evt_q_.put(nds::event());
+    peer_.incoming_evt_q_.put(shard_id_, nds::event());
 }
 
 }
@@ -20,6 +20,7 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #pragma once
 #include "connection.h"
+#include "poller.h"
 
 namespace nds {
 struct peer;
@@ -34,9 +35,12 @@ enum EvtType {
     Interrupt,              //generic interrupt
     ConnectRequest,         //request for TCP connection (peer -> selector)
     IncomingConnect,        //new incoming TCP connection (selector -> peer)
+    AcceptedConnect,        //accepted TCP connection handed over to its owning shard (selector -> selector)
+    ConnectFailed,          //outgoing TCP connection could not be established (selector -> peer)
     SendPacket,             //request to send a packet (peer -> selector)
     PacketAvailable,        //foreign packet available (selector -> peer)
-    Disconnect,             //connection disconnection event
+    Disconnect,             //connection disconnection event (peer -> selector, selector -> peer for outgoing connections)
+    ApiRequest,             //requests queued through the API of an embedded node (api -> peer)
 };
 
 /**
@@ -46,6 +50,7 @@ enum EvtType {
  *
  * It can model an interrupt (Interrupt).
  * It can be used by peer thread to request selector thread to connect to TCP (ConnectRequest).
+ * It can be used by selector to inform peer thread that a requested connection failed (ConnectFailed).
  * It can transport an incoming packet from a multicast/unicast socket (PacketAvailable).
  * It can be used by peer thread to request selector to send a packet (SendPacket).
  * It can be used by selector to inform peer thread of a received foreign packet (PacketAvailable).
@@ -54,15 +59,15 @@ enum EvtType {
 struct event {
     explicit event();
     explicit event(EvtType evt);
-    explicit event(EvtType evt, std::shared_ptr<connection> &conn);
+    explicit event(EvtType evt, const std::shared_ptr<connection> &conn);
 
-    explicit event(std::shared_ptr<connection> &conn,
-                   std::unique_ptr<g_bbuf> &&rdn_pkt,
+    explicit event(const std::shared_ptr<connection> &conn,
+                   g_bbuf_ptr &&rdn_pkt,
                    const char *src_ip);
 
     EvtType evt_;
     std::shared_ptr<connection> conn_;
-    std::unique_ptr<g_bbuf> opt_rdn_pkt_;
+    g_bbuf_ptr opt_rdn_pkt_;
     char opt_src_ip_[16] = {0};
 };
 
@@ -80,6 +85,9 @@ struct acceptor {
     RetCode create_server_socket(SOCKET &serv_socket);
     RetCode accept(std::shared_ptr<connection> &new_connection);
 
+    //sets up new_connection over a socket just accepted, with the selector's ring too.
+    RetCode accepted(SOCKET socket, const sockaddr_in &addr, std::shared_ptr<connection> &new_connection);
+
     peer &peer_;
     SOCKET serv_socket_;
     sockaddr_in serv_sockaddr_in_;
@@ -87,6 +95,49 @@ struct acceptor {
     std::shared_ptr<spdlog::logger> log_;
 };
 
+/**
+ * A datagram to be multicast by the primary selector.
+ *
+ * Either a framed packet or a whole framed data message sent in chunks, starting from next_:
+ * chunks are encoded as they are sent, from the buffer shared with the peer thread.
+ */
+struct mcast_out {
+    g_bbuf_ptr pkt_;
+
+    std::shared_ptr<g_bbuf> xfer_;
+    size_t total_ = 0;
+    uint64_t ts_ = 0;
+    unsigned shard_ = 0;
+    uint32_t next_ = 0;
+    uint32_t count_ = 0;
+};
+
+/**
+ * Operations a selector submits to its ring.
+ */
+enum RingOp {
+    RingOp_NTFY_READ,       //read of the notification eventfd
+    RingOp_ACCEPT,          //accept over the listening socket
+    RingOp_LOCAL_ACCEPT,    //accept over the local socket
+    RingOp_RECV,            //receive over a connection
+    RingOp_SEND,            //send of the packets queued on a TCP connection
+    RingOp_WRITABLE,        //wait for a TCP connection to be writable, to send a mem_file packet
+    RingOp_CONNECT,         //connect of an outgoing TCP connection
+};
+
+/**
+ * An operation in flight on the ring of a selector.
+ *
+ * It keeps its connection alive until it completes; when the connection is closed first,
+ * it also takes the buffers the kernel may still be reading or writing.
+ */
+struct ring_op {
+    RingOp op_;
+    std::shared_ptr<connection> conn_;
+    g_bbuf_ptr rdn_body_;
+    std::deque<snd_pkt> snd_pkts_;
+};
+
 /**
  * States of the selector automa.
  *
@@ -108,14 +159,28 @@ enum SelectorStatus {
 /**
  * selector
  *
- * The selector is a singleton class used to actively monitor all sockets of all
+ * The selector is a class used to actively monitor the sockets of the
  * connections managed by this NDS node.
- * The selector monitors all internal/multicast UDP sockets alongside with all TCP sockets.
+ * The primary selector monitors all internal/multicast UDP sockets alongside with the listening socket and
+ * its own TCP sockets; additional selector shards, each one running its own thread, only monitor their own
+ * TCP sockets. Accepted and outgoing TCP connections are spread round-robin across all selectors.
+ * Daemon nodes also serve, on the primary selector, a local unix domain socket whose accepted connections
+ * (see local.h) are spread as the TCP ones.
+ * Sockets are monitored through a poller (epoll or select); a socket is registered when its
+ * connection is established (or its connect is started) and deregistered when its connection is closed.
+ * Alternatively (uring), the selector is completion based: receives, sends, accepts and connects are
+ * operations submitted to an io_uring and completed in batches, with a receive always in flight on
+ * every established connection and a send in flight while it has packets to send.
+ * Outgoing connects never block the selector: completion is detected by writability (or by the ring) and
+ * every connect in progress is abandoned if not completed within peer's cfg connect_timeout_ms.
  * When a packet is read from a socket it is packed up and sent asynch to the peer thread.
- * The selector is also listening for events coming from peer thread (such as requests to send a packet over TCP).
+ * The selector is also listening for events coming from peer thread (such as requests to send a packet over TCP);
+ * these are queued in a lock-free queue and signaled through an eventfd.
+ * The primary selector also multicasts the datagrams the peer thread cannot send straight away, as the chunks
+ * of a multicast transfer: they are sent in bursts between two waits, never blocking nor sleeping.
  */
 struct selector : public th {
-    explicit selector(peer &);
+    explicit selector(peer &, unsigned shard_id = 0);
     virtual ~selector();
 
     RetCode init();
@@ -127,52 +192,140 @@ struct selector : public th {
                                      time_t sec = -1,
                                      long nsec = 0);
 
-    RetCode notify(const event *);
+    RetCode notify(event &&);
     RetCode process_asyn_evts();
+    RetCode drain_asyn_evts();
+    RetCode process_asyn_evt(event &);
     RetCode interrupt();
     RetCode set_status(SelectorStatus);
 
     virtual void run() override;
 
-    RetCode create_UDP_notify_srv_sock();
-    RetCode connect_UDP_notify_cli_sock();
+    RetCode create_notify_evt_fd();
 
     bool is_still_valid_connection(const event *);
-    RetCode process_inco_sock_inco_events();
-    RetCode process_inco_sock_outg_events();
-    RetCode process_outg_sock_inco_events();
-    RetCode process_outg_sock_outg_events();
 
-    RetCode start_conn_objs();
+    //the primary selector owns multicast sockets and the listening socket.
+    bool primary() const {
+        return !shard_id_;
+    }
 
-    void FDSET_sockets();
-    void FDSET_incoming_sockets();
-    void FDSET_outgoing_sockets();
-    void FDSET_write_incoming_pending_sockets();
-    void FDSET_write_outgoing_pending_sockets();
+    //sets up the ring or the poller, falling back to select.
+    RetCode init_poller();
+    const char *multiplexer_name() const;
+    RetCode start_conn_objs();
 
     RetCode consume_events();
-    RetCode consume_inco_sock_events();
+    RetCode accept_inco_conns();
+    RetCode add_inco_conn(std::shared_ptr<connection> &);
+    RetCode process_conn_events(std::shared_ptr<connection> &, int flags);
+
+    //adds an accepted connection to its owning selector.
+    void hand_over_inco_conn(std::shared_ptr<connection> &);
+
+    //releases a connection just closed, letting the peer know if it has to.
+    void release_closed_conn(std::shared_ptr<connection> &);
+
+    //ring only: submit operations, returning their user data.
+    uint64_t ring_track(RingOp, const std::shared_ptr<connection> &);
+    RetCode ring_read_ntfy();
+    RetCode ring_accept(bool local);
+    RetCode ring_recv(std::shared_ptr<connection> &);
+    RetCode ring_send(std::shared_ptr<connection> &);
+    RetCode ring_connect(std::shared_ptr<connection> &);
+
+    //ring only: cancels the operations in flight of a connection being closed.
+    void ring_release(connection &);
+
+    //ring only: processes the completions of the last wait.
+    RetCode consume_completions();
+    void process_completion(uint64_t user_data, ring_op &op, int res);
+
+    //ring only: cancels all the operations in flight and waits for them while stopping.
+    void ring_drain();
 
     RetCode conn_process_rdn_buff(std::shared_ptr<connection> &);
+    RetCode conn_flush_pending(std::shared_ptr<connection> &);
+
+    std::shared_ptr<connection> find_conn(SOCKET);
+    std::unordered_map<SOCKET, std::shared_ptr<connection>> &conn_map(const connection &);
+    std::unordered_map<SOCKET, std::shared_ptr<connection>> &wp_conn_map(const connection &);
+
+    RetCode set_write_pending(std::shared_ptr<connection> &);
+    void release_conn(const std::shared_ptr<connection> &);
 
     RetCode add_outg_conn(event *);
+    RetCode complete_outg_conn(std::shared_ptr<connection> &);
+    void fail_outg_conn(const std::shared_ptr<connection> &);
+
+    //abandons the connects in progress that are past their deadline;
+    //returns timeout_ms bounded by the nearest deadline still pending.
+    int check_connect_deadlines(int timeout_ms);
+
+    //interrupts the peer within ms, sooner than at its periodic interrupt; primary selector only.
+    RetCode interrupt_peer_in(uint32_t ms);
+
+    //interrupts the peer if it is due; returns timeout_ms bounded by it otherwise.
+    int check_peer_interrupt(int timeout_ms);
     RetCode manage_disconnect_conn(event *);
 
+    //multicasts pkt, queuing a copy of it behind the datagrams not yet sent; peer thread.
+    RetCode send_mcast(const char *pkt, size_t len);
+
+    //queues the chunks of the data message xfer of total bytes, written at ts; peer thread.
+    RetCode send_mcast_chunks(const std::shared_ptr<g_bbuf> &xfer, size_t total, uint64_t ts, unsigned shard);
+
+    //sends a burst of the datagrams queued; returns timeout_ms bounded to send the next burst.
+    int flush_mcast(int timeout_ms);
+
+    //sends the datagrams still queued while stopping.
+    void drain_mcast();
+
+    //the local socket is served by daemon nodes only, if no other node on this host is serving it;
+    //a node failing to serve it keeps running.
+    RetCode create_local_socket();
+    RetCode accept_local_conns();
+    RetCode local_socket_shutdown();
+
     RetCode server_socket_shutdown();
     RetCode stop_and_clean();
 
     peer &peer_;
+    unsigned shard_id_;
     SelectorStatus status_;
-    fd_set read_FDs_, write_FDs_;
 
-    int nfds_;
-    int sel_res_;
+    //logger; declared before the connection members as they copy it on construction.
+    std::shared_ptr<spdlog::logger> log_;
+
+    //the I/O multiplexer and the readiness notifications of the last wait
+    std::unique_ptr<poller> poller_;
+    std::vector<poll_evt> ready_evts_;
+
+    //or the ring, the completions of the last wait and the operations in flight by user data
+    std::unique_ptr<uring> ring_;
+    std::vector<uring_cpl> ring_cpls_;
+    std::unordered_map<uint64_t, ring_op> ring_ops_;
+    uint64_t ring_seq_;
+
+    //ring only: user data of the eventfd read and of the accepts in flight, 0 if none;
+    //the eventfd counter and the address of the TCP accept
+    uint64_t ntfy_read_id_;
+    uint64_t srv_accept_id_;
+    uint64_t local_accept_id_;
+    uint64_t ntfy_cnt_;
+    sockaddr_in ring_acc_addr_;
+    socklen_t ring_acc_len_;
 
-    //internal UDP socket used to interrupt the select() and notify selector of new events.
-    sockaddr_in udp_ntfy_sa_in_;
-    SOCKET udp_ntfy_srv_socket_;
-    SOCKET udp_ntfy_cli_socket_;
+    //events sent to the selector by other threads (peer thread).
+    mpsc_qu<event> asyn_evt_q_;
+
+    //eventfd used to wake up the selector when events are queued;
+    //a single wakeup is signaled until the selector consumes the queue.
+    int ntfy_evt_fd_;
+    std::atomic<bool> ntfy_pending_;
+
+    //when the peer asked to be interrupted, in steady clock milliseconds (0 if not asked)
+    std::atomic<int64_t> peer_intr_ms_;
 
     //host network interfaces
     std::unordered_set<std::string> hintfs_;
@@ -192,12 +345,23 @@ struct selector : public th {
     std::unordered_map<SOCKET, std::shared_ptr<connection>> outg_conn_map_;
     std::unordered_map<SOCKET, std::shared_ptr<connection>> wp_outg_conn_map_;
 
+    //outgoing connections with a connect in progress (also in outg_conn_map_)
+    std::unordered_map<SOCKET, std::shared_ptr<connection>> pc_outg_conn_map_;
+
+    //local incoming (unix domain socket) and the path it is bound to
+    SOCKET local_socket_;
+    std::string local_path_;
+
     //UDP Multicast
     std::shared_ptr<connection> mcast_udp_inco_conn_;
     connection mcast_udp_outg_conn_;
 
-    //logger
-    std::shared_ptr<spdlog::logger> log_;
+    //datagrams queued by the peer thread, the ones being sent by the selector
+    //and how many of them have not been sent yet
+    mpsc_qu<mcast_out> mcast_out_q_;
+    std::deque<mcast_out> mcast_pending_;
+    std::atomic<size_t> mcast_queued_;
+    std::chrono::steady_clock::time_point mcast_last_burst_;
 };
 
 }
@@ -0,0 +1,356 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifdef __GNUG__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <endian.h>
+#endif
+#include "shm.h"
+#include "wire.h"
+
+//"NDSM"
+#define SHM_MAGIC 0x4D53444E
+#define SHM_VERSION 2
+
+//milliseconds without a heartbeat of the publisher before its segment is considered dead
+#define SHM_STALE_MS 10000
+
+//attempts of a reader to read a consistent snapshot, before giving up
+#define SHM_READ_RETRIES 100000
+
+namespace nds {
+
+static uint64_t now_ms()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>
+           (std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static bool alive(const shm_hdr &hdr)
+{
+    return now_ms() - hdr.beat_.load(std::memory_order_relaxed) < SHM_STALE_MS;
+}
+
+//shm_publisher
+
+shm_publisher::shm_publisher() :
+    hdr_(nullptr),
+    size_(0),
+    gen_(0),
+    ts_(0),
+    shard_gen_(),
+    shard_cap_(),
+    laid_out_(false)
+{}
+
+shm_publisher::~shm_publisher()
+{
+    close();
+}
+
+RetCode shm_publisher::open(const std::string &name, size_t size)
+{
+    if(size < sizeof(shm_hdr)) {
+        return RetCode_BADARG;
+    }
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0 && errno == EEXIST) {
+        //the segment left by a dead node is replaced: the readers still mapping it find it dead.
+        shm_reader rd;
+        if(!rd.open(name) && alive(*rd.hdr_)) {
+            return RetCode_UNVRSC;
+        }
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    }
+    if(fd < 0) {
+        return RetCode_SYSERR;
+    }
+    void *addr = MAP_FAILED;
+    if(!ftruncate(fd, (off_t)size)) {
+        addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if(addr == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return RetCode_SYSERR;
+    }
+
+    //the segment is zero filled: an empty store.
+    name_ = name;
+    size_ = size;
+    hdr_ = (shm_hdr *)addr;
+    hdr_->version_ = SHM_VERSION;
+    hdr_->size_ = size;
+    gen_ = ts_ = 0;
+    laid_out_ = false;
+    beat();
+    hdr_->magic_ = SHM_MAGIC;
+    return RetCode_OK;
+}
+
+void shm_publisher::close()
+{
+    if(!hdr_) {
+        return;
+    }
+    munmap(hdr_, size_);
+    shm_unlink(name_.c_str());
+    hdr_ = nullptr;
+}
+
+RetCode shm_publisher::encode_shard(const store::shard &sh)
+{
+    for(auto it = sh.entries_.begin(); it != sh.entries_.end(); ++it) {
+        RET_ON_KO(append_kv_rec(buf_, it->first, it->second.val_.data(), it->second.val_.size(), it->second.ts_))
+    }
+    return RetCode_OK;
+}
+
+RetCode shm_publisher::publish(const store &st, uint64_t ts)
+{
+    if(!hdr_ || (gen_ == st.gen_ && ts_ == ts)) {
+        return RetCode_OK;
+    }
+    if(!laid_out_) {
+        return publish_all(st, ts);
+    }
+
+    //just the shards written since the last time, each one in its own region.
+    std::array<uint32_t, STORE_SHARDS + 1> pos = {};
+    buf_.reset();
+    for(unsigned shard = 0; shard < STORE_SHARDS; ++shard) {
+        pos[shard] = (uint32_t)buf_.limit();
+        if(st.shards_[shard].gen_ == shard_gen_[shard]) {
+            continue;
+        }
+        RET_ON_KO(encode_shard(st.shards_[shard]))
+        if(buf_.limit() - pos[shard] > shard_cap_[shard]) {
+            return publish_all(st, ts);
+        }
+    }
+    pos[STORE_SHARDS] = (uint32_t)buf_.limit();
+
+    uint64_t seq = hdr_->seq_.load(std::memory_order_relaxed);
+    hdr_->seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    hdr_->ts_ = ts;
+    for(unsigned shard = 0; shard < STORE_SHARDS; ++shard) {
+        if(st.shards_[shard].gen_ == shard_gen_[shard]) {
+            continue;
+        }
+        hdr_->shard_len_[shard] = pos[shard + 1] - pos[shard];
+        memcpy((char *)hdr_ + sizeof(shm_hdr) + hdr_->shard_off_[shard], buf_.buf_ + pos[shard],
+               pos[shard + 1] - pos[shard]);
+        shard_gen_[shard] = st.shards_[shard].gen_;
+    }
+    hdr_->seq_.store(seq + 2, std::memory_order_release);
+
+    gen_ = st.gen_;
+    ts_ = ts;
+    return RetCode_OK;
+}
+
+RetCode shm_publisher::publish_all(const store &st, uint64_t ts)
+{
+    std::array<uint32_t, STORE_SHARDS + 1> pos = {};
+    buf_.reset();
+    for(unsigned shard = 0; shard < STORE_SHARDS; ++shard) {
+        pos[shard] = (uint32_t)buf_.limit();
+        RET_ON_KO(encode_shard(st.shards_[shard]))
+    }
+    pos[STORE_SHARDS] = (uint32_t)buf_.limit();
+    size_t room = size_ - sizeof(shm_hdr);
+    bool overflow = buf_.limit() > room;
+
+    //the spare room is shared evenly: the shards written next are rewritten in place.
+    uint32_t spare = overflow ? 0 : (uint32_t)((room - buf_.limit()) / STORE_SHARDS);
+    std::array<uint32_t, STORE_SHARDS> off = {};
+    for(unsigned shard = 0, cur = 0; shard < STORE_SHARDS; ++shard) {
+        off[shard] = cur;
+        shard_cap_[shard] = pos[shard + 1] - pos[shard] + spare;
+        cur += shard_cap_[shard];
+    }
+
+    uint64_t seq = hdr_->seq_.load(std::memory_order_relaxed);
+    hdr_->seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    hdr_->ts_ = ts;
+    hdr_->overflow_ = overflow;
+    if(overflow) {
+        memset(hdr_->shard_off_, 0, sizeof(hdr_->shard_off_));
+        memset(hdr_->shard_len_, 0, sizeof(hdr_->shard_len_));
+    } else {
+        for(unsigned shard = 0; shard < STORE_SHARDS; ++shard) {
+            hdr_->shard_off_[shard] = off[shard];
+            hdr_->shard_len_[shard] = pos[shard + 1] - pos[shard];
+            memcpy((char *)hdr_ + sizeof(shm_hdr) + off[shard], buf_.buf_ + pos[shard], pos[shard + 1] - pos[shard]);
+        }
+    }
+    hdr_->seq_.store(seq + 2, std::memory_order_release);
+
+    //a store not fitting is laid out again at each write, until it fits.
+    laid_out_ = !overflow;
+    for(unsigned shard = 0; shard < STORE_SHARDS; ++shard) {
+        shard_gen_[shard] = st.shards_[shard].gen_;
+    }
+    gen_ = st.gen_;
+    ts_ = ts;
+    return overflow ? RetCode_OVRSZ : RetCode_OK;
+}
+
+void shm_publisher::beat()
+{
+    if(hdr_) {
+        hdr_->beat_.store(now_ms(), std::memory_order_relaxed);
+    }
+}
+
+//shm_reader
+
+shm_reader::shm_reader() :
+    hdr_(nullptr),
+    size_(0)
+{}
+
+shm_reader::~shm_reader()
+{
+    close();
+}
+
+RetCode shm_reader::open(const std::string &name)
+{
+    close();
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0) {
+        return RetCode_UNVRSC;
+    }
+    struct stat st;
+    void *addr = MAP_FAILED;
+    if(!fstat(fd, &st) && (size_t)st.st_size >= sizeof(shm_hdr)) {
+        addr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if(addr == MAP_FAILED) {
+        return RetCode_UNVRSC;
+    }
+    hdr_ = (const shm_hdr *)addr;
+    size_ = (size_t)st.st_size;
+    if(hdr_->magic_ != SHM_MAGIC || hdr_->version_ != SHM_VERSION || hdr_->size_ != size_) {
+        //not yet initialized, or published by an incompatible node.
+        close();
+        return RetCode_UNVRSC;
+    }
+    return RetCode_OK;
+}
+
+void shm_reader::close()
+{
+    if(hdr_) {
+        munmap((void *)hdr_, size_);
+        hdr_ = nullptr;
+    }
+}
+
+RetCode shm_reader::get(const std::string &key, std::string &val, uint64_t &ts, uint64_t &node_ts) const
+{
+    if(!hdr_) {
+        return RetCode_BADSTTS;
+    }
+    if(!alive(*hdr_)) {
+        return RetCode_TIMEOUT;
+    }
+    unsigned shard = store::shard_of(key);
+    const char *recs = (const char *)hdr_ + sizeof(shm_hdr);
+    size_t recs_len = size_ - sizeof(shm_hdr);
+
+    for(unsigned attempt = 0; attempt < SHM_READ_RETRIES; ++attempt) {
+        uint64_t seq = hdr_->seq_.load(std::memory_order_acquire);
+        if(seq & 1) {
+            continue;
+        }
+        //everything read before the second load of seq can be torn: it is bounds checked, then discarded.
+        node_ts = hdr_->ts_;
+        bool overflow = hdr_->overflow_;
+        size_t off = hdr_->shard_off_[shard], end = off + hdr_->shard_len_[shard];
+        val.clear();
+        ts = 0;
+        while(!overflow && off + WIRE_KV_HDR_SZ <= end && end <= recs_len) {
+            uint16_t u16 = 0;
+            uint32_t u32 = 0;
+            uint64_t u64 = 0;
+            memcpy(&u16, &recs[off], 2);
+            memcpy(&u32, &recs[off + 2], 4);
+            memcpy(&u64, &recs[off + 6], 8);
+            size_t key_len = le16toh(u16), val_len = le32toh(u32);
+            const char *rec_key = &recs[off + WIRE_KV_HDR_SZ];
+            off += WIRE_KV_HDR_SZ;
+            if(key_len > end - off || val_len > end - off - key_len) {
+                break;
+            }
+            if(key_len == key.size() && !memcmp(rec_key, key.data(), key_len)) {
+                val.assign(rec_key + key_len, val_len);
+                ts = le64toh(u64);
+                break;
+            }
+            off += key_len + val_len;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(hdr_->seq_.load(std::memory_order_relaxed) == seq) {
+            return overflow ? RetCode_OVRSZ : RetCode_OK;
+        }
+    }
+    return RetCode_RETRY;
+}
+
+RetCode shm_reader::version(uint64_t &ts) const
+{
+    if(!hdr_) {
+        return RetCode_BADSTTS;
+    }
+    if(!alive(*hdr_)) {
+        return RetCode_TIMEOUT;
+    }
+    for(unsigned attempt = 0; attempt < SHM_READ_RETRIES; ++attempt) {
+        uint64_t seq = hdr_->seq_.load(std::memory_order_acquire);
+        if(seq & 1) {
+            continue;
+        }
+        ts = hdr_->ts_;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(hdr_->seq_.load(std::memory_order_relaxed) == seq) {
+            return RetCode_OK;
+        }
+    }
+    return RetCode_RETRY;
+}
+
+std::string shm_segment_name(const std::string &multicast_address, uint16_t multicast_port)
+{
+    std::ostringstream os;
+    os << "/nds." << multicast_address << "." << multicast_port;
+    return os.str();
+}
+
+}
@@ -0,0 +1,126 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+#include "store.h"
+#include <atomic>
+
+namespace nds {
+
+/**
+ * The header of the shared memory segment a daemon node publishes its store into.
+ *
+ * The records follow the header, in the key/value record format of data messages (see wire.h),
+ * grouped by shard: the records of shard s lie in [shard_off_[s], shard_off_[s] + shard_len_[s]) bytes
+ * after the header. The region of a shard extends up to the next one: its spare room lets a write
+ * rewrite just the shard it changed, in place.
+ * The segment is protected by a seqlock: the publisher makes seq_ odd while writing and even once
+ * done; a reader retries until it reads the same even seq_ before and after having copied what it needs.
+ * beat_ is refreshed by the publisher while alive: readers do not trust a segment left by a dead node.
+ */
+struct shm_hdr {
+    uint32_t magic_;
+    uint32_t version_;
+    std::atomic<uint64_t> seq_;
+    //milliseconds since epoch of the last heartbeat of the publisher
+    std::atomic<uint64_t> beat_;
+    //bytes of the whole segment
+    uint64_t size_;
+    //the timestamp of the node
+    uint64_t ts_;
+    //not zero if the store does not fit in the segment: no record is published
+    uint32_t overflow_;
+    uint32_t shard_off_[STORE_SHARDS];
+    uint32_t shard_len_[STORE_SHARDS];
+};
+
+/**
+ * The publisher of the store of a daemon node in a named shared memory segment.
+ * Accessed by peer thread only.
+ */
+struct shm_publisher {
+    explicit shm_publisher();
+    ~shm_publisher();
+
+    //creates (or takes over from a dead node) the segment; RetCode_UNVRSC if another node is publishing it.
+    RetCode open(const std::string &name, size_t size);
+    void close();
+
+    bool opened() const {
+        return hdr_ != nullptr;
+    }
+
+    //writes the shards and the timestamp of the node changed since the last time.
+    //A shard outgrowing its region lays out the whole store again: O(store) bytes,
+    //bounded by the size of the segment, while readers retry.
+    RetCode publish(const store &st, uint64_t ts);
+
+    //tells the readers the publisher is alive.
+    void beat();
+
+    std::string name_;
+    shm_hdr *hdr_;
+    size_t size_;
+
+    //the store generation and the timestamp last published
+    uint64_t gen_;
+    uint64_t ts_;
+
+    //the generation of each shard last published, and the bytes of its region
+    std::array<uint64_t, STORE_SHARDS> shard_gen_;
+    std::array<uint32_t, STORE_SHARDS> shard_cap_;
+    bool laid_out_;
+
+    //the records are encoded here, then copied into the segment in one go: readers retry less.
+    g_bbuf buf_;
+
+    //encodes the records of a shard at the end of buf_.
+    RetCode encode_shard(const store::shard &sh);
+
+    //lays out all the shards again, sharing the spare room of the segment among them.
+    RetCode publish_all(const store &st, uint64_t ts);
+};
+
+/**
+ * A reader of the store published by a daemon node on this host.
+ * Once opened, reads involve no syscalls: they are meant to be polled by latency critical co-located services.
+ * A reader finding the publisher dead is expected to open the segment again: a new daemon publishes a new one.
+ */
+struct shm_reader {
+    explicit shm_reader();
+    ~shm_reader();
+
+    //RetCode_UNVRSC if no segment is published under name.
+    RetCode open(const std::string &name);
+    void close();
+
+    //the value and the version of a key (empty and 0 if absent), along with the timestamp of the node;
+    //RetCode_TIMEOUT if the publisher is dead, RetCode_OVRSZ if the store does not fit in the segment.
+    RetCode get(const std::string &key, std::string &val, uint64_t &ts, uint64_t &node_ts) const;
+    RetCode version(uint64_t &ts) const;
+
+    const shm_hdr *hdr_;
+    size_t size_;
+};
+
+//the name of the segment published by the daemon joining a multicast group.
+std::string shm_segment_name(const std::string &multicast_address, uint16_t multicast_port);
+
+}
@@ -0,0 +1,146 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "store.h"
+#include <algorithm>
+
+namespace nds {
+
+unsigned store::shard_of(const char *key, size_t len)
+{
+    //FNV-1a: the shard of a key must be the same on every node.
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < len; ++i) {
+        h ^= (uint8_t)key[i];
+        h *= 16777619u;
+    }
+    return h % STORE_SHARDS;
+}
+
+unsigned store::bucket_of(const char *key, size_t len)
+{
+    //the same hash as the shard, but different bits.
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < len; ++i) {
+        h ^= (uint8_t)key[i];
+        h *= 16777619u;
+    }
+    return (h >> 16) % STORE_BUCKETS;
+}
+
+uint64_t store::item_digest(const std::string &key, uint64_t ts)
+{
+    //FNV-1a 64 bits of the key, mixed with the version by a splitmix64 finalizer.
+    uint64_t h = 14695981039346656037ull;
+    for(size_t i = 0; i < key.size(); ++i) {
+        h ^= (uint8_t)key[i];
+        h *= 1099511628211ull;
+    }
+    h ^= ts + 0x9e3779b97f4a7c15ull;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+bool store::put(const std::string &key, g_bslice &&val, uint64_t ts)
+{
+    shard &sh = shards_[shard_of(key)];
+    auto it = sh.entries_.find(key);
+    if(it != sh.entries_.end() ? it->second.ts_ >= ts : !ts) {
+        return false;
+    }
+    //the digests of the tree are updated replacing the old pair with the new one.
+    uint64_t d = item_digest(key, ts);
+    if(it != sh.entries_.end()) {
+        d ^= item_digest(key, it->second.ts_);
+    }
+    sh.bucket_digests_[bucket_of(key)] ^= d;
+    sh.digest_ ^= d;
+    digest_ ^= d;
+
+    entry &e = it != sh.entries_.end() ? it->second : sh.entries_[key];
+    e.val_ = std::move(val);
+    e.ts_ = ts;
+    if(ts > sh.version_) {
+        if(sh.last_key_ != key) {
+            sh.prev_version_ = sh.version_;
+            sh.last_key_ = key;
+        }
+        sh.version_ = ts;
+    } else {
+        sh.prev_version_ = std::max(sh.prev_version_, ts);
+    }
+    ++sh.gen_;
+    ++gen_;
+    return true;
+}
+
+const store::entry *store::get(const std::string &key) const
+{
+    const shard &sh = shards_[shard_of(key)];
+    auto it = sh.entries_.find(key);
+    return it == sh.entries_.end() ? nullptr : &it->second;
+}
+
+g_bslice store::value(const std::string &key) const
+{
+    const entry *e = get(key);
+    return e ? e->val_ : g_bslice();
+}
+
+RetCode store::children(unsigned node, std::vector<uint64_t> &digests) const
+{
+    if(!node) {
+        for(unsigned shard = 0; shard < STORE_SHARDS; ++shard) {
+            digests.push_back(shards_[shard].digest_);
+        }
+        return RetCode_OK;
+    }
+    if(leaf_node(node)) {
+        return RetCode_BADARG;
+    }
+    const shard &sh = shards_[node - 1];
+    digests.insert(digests.end(), sh.bucket_digests_.begin(), sh.bucket_digests_.end());
+    return RetCode_OK;
+}
+
+void store::leaf_entries(unsigned node,
+                         std::vector<std::pair<const std::string *, const entry *>> &out) const
+{
+    unsigned shard = (node - 1 - STORE_SHARDS) / STORE_BUCKETS;
+    unsigned bucket = (node - 1 - STORE_SHARDS) % STORE_BUCKETS;
+    const store::shard &sh = shards_[shard];
+    for(auto it = sh.entries_.begin(); it != sh.entries_.end(); ++it) {
+        if(bucket_of(it->first) == bucket) {
+            out.push_back(std::make_pair(&it->first, &it->second));
+        }
+    }
+}
+
+std::array<uint64_t, STORE_SHARDS> store::versions() const
+{
+    std::array<uint64_t, STORE_SHARDS> vers;
+    for(unsigned shard = 0; shard < STORE_SHARDS; ++shard) {
+        vers[shard] = shards_[shard].version_;
+    }
+    return vers;
+}
+
+}
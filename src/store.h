@@ -0,0 +1,135 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+#include "bbuf.h"
+#include <array>
+
+//number of shards keys are spread across; it is part of the wire protocol.
+#define STORE_SHARDS 16
+
+//the key holding the value shared with JSON-only nodes, which know a single value.
+#define STORE_DEFAULT_KEY "_"
+
+//number of digest buckets each shard is split into; it is part of the wire protocol.
+#define STORE_BUCKETS 16
+
+namespace nds {
+
+/**
+ * The in-memory key/value store of a node.
+ *
+ * Keys are spread across STORE_SHARDS shards by a hash stable across nodes;
+ * each key has its own version (the timestamp of the write that produced it)
+ * and each shard has the version of its latest write.
+ * Nodes compare shard versions to find out which shards they have to synch,
+ * then only keys newer than their own shard version are transferred.
+ *
+ * Versions alone cannot tell two nodes that wrote different keys of the same shard apart:
+ * a digest tree, maintained incrementally at each write, lets them find where they diverge.
+ * The tree has the store as root, the shards as children of the root and the buckets of
+ * each shard as leaves; the digest of a node is the XOR of the digests of the (key, version)
+ * pairs below it.
+ * Accessed by peer thread only.
+ */
+struct store {
+
+    //a value with its version
+    struct entry {
+        g_bslice val_;
+        uint64_t ts_ = 0;
+    };
+
+    //a shard: its entries, the greatest version among them and its digests;
+    //the key written last holds the version, the ones of the others are not greater than prev_version_.
+    struct shard {
+        std::unordered_map<std::string, entry> entries_;
+        uint64_t version_ = 0;
+        uint64_t prev_version_ = 0;
+        std::string last_key_;
+        uint64_t digest_ = 0;
+        std::array<uint64_t, STORE_BUCKETS> bucket_digests_ = {};
+
+        //incremented at each write of the shard
+        uint64_t gen_ = 0;
+    };
+
+    static unsigned shard_of(const char *key, size_t len);
+    static unsigned shard_of(const std::string &key) {
+        return shard_of(key.data(), key.size());
+    }
+    static unsigned bucket_of(const char *key, size_t len);
+    static unsigned bucket_of(const std::string &key) {
+        return bucket_of(key.data(), key.size());
+    }
+
+    //the digest of a (key, version) pair.
+    static uint64_t item_digest(const std::string &key, uint64_t ts);
+
+    /*digest tree: node 0 is the root, then the shards, then the buckets of each shard*/
+
+    static unsigned shard_node(unsigned shard) {
+        return 1 + shard;
+    }
+    static unsigned bucket_node(unsigned shard, unsigned bucket) {
+        return 1 + STORE_SHARDS + shard * STORE_BUCKETS + bucket;
+    }
+    static bool leaf_node(unsigned node) {
+        return node > STORE_SHARDS;
+    }
+    static unsigned tree_nodes() {
+        return 1 + STORE_SHARDS + STORE_SHARDS * STORE_BUCKETS;
+    }
+
+    //the digests of the children of an inner node, in order.
+    RetCode children(unsigned node, std::vector<uint64_t> &digests) const;
+
+    //the entries below a leaf node.
+    void leaf_entries(unsigned node,
+                      std::vector<std::pair<const std::string *, const entry *>> &out) const;
+
+    //stores the value if it is newer than the current one; returns true if stored.
+    bool put(const std::string &key, g_bslice &&val, uint64_t ts);
+
+    //the entry of a key, nullptr if absent.
+    const entry *get(const std::string &key) const;
+
+    //the value of a key, empty if absent.
+    g_bslice value(const std::string &key) const;
+
+    uint64_t version(unsigned shard) const {
+        return shards_[shard].version_;
+    }
+
+    std::array<uint64_t, STORE_SHARDS> versions() const;
+
+    //the digest of the whole store.
+    uint64_t digest() const {
+        return digest_;
+    }
+
+    std::array<shard, STORE_SHARDS> shards_;
+    uint64_t digest_ = 0;
+
+    //incremented at each write
+    uint64_t gen_ = 0;
+};
+
+}
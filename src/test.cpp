@@ -19,8 +19,10 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
 #include <vector>
+#include <arpa/inet.h>
 #include "gtest/gtest.h"
-#include "peer.h"
+#include "node.h"
+#include "local.h"
 
 int mock_main(int argc, char *argv[], nds::peer &pr);
 
@@ -43,12 +45,17 @@ struct peer_tester {
     int res_ = 0;
 };
 
+//created before the nodes, the logger registry outlives them: their destructors shut it down.
+spdlog::details::registry &log_registry = spdlog::details::registry::instance();
+
 peer_tester node1;
 peer_tester node2;
 peer_tester setter_cli;
+peer_tester getter_cli;
+nds::node embedded;
 
 std::vector<const char *> node1_args = {"test", "-n", "-v", "trace", "-l", "n1"};
-std::vector<const char *> node2_args = {"test", "-n", "-v", "trace", "-l", "n2"};
+std::vector<const char *> node2_args = {"test", "-n", "-p", "31583", "-v", "trace", "-l", "n2"};
 
 int main(int argc, char *argv[])
 {
@@ -78,8 +85,8 @@ TEST(DaemonNodesStatus, CheckInitialStatus)
     EXPECT_EQ(node2.pr_.current_node_ts_, 0U);
     EXPECT_EQ(node1.pr_.desired_cluster_ts_, 0U);
     EXPECT_EQ(node2.pr_.desired_cluster_ts_, 0U);
-    EXPECT_EQ(node1.pr_.data_, "");
-    EXPECT_EQ(node2.pr_.data_, "");
+    EXPECT_EQ(node1.pr_.store_.value("color"), "");
+    EXPECT_EQ(node2.pr_.store_.value("color"), "");
 
     //wait synch takes place
     std::this_thread::sleep_for(std::chrono::seconds(3));
@@ -89,13 +96,17 @@ TEST(DaemonNodesStatus, CheckInitialStatus)
     EXPECT_NE(node2.pr_.desired_cluster_ts_, 0U);
     EXPECT_EQ(node1.pr_.current_node_ts_, node2.pr_.current_node_ts_);
     EXPECT_EQ(node1.pr_.current_node_ts_, node1.pr_.desired_cluster_ts_);
-    EXPECT_EQ(node1.pr_.data_, "");
-    EXPECT_EQ(node2.pr_.data_, "");
+    EXPECT_EQ(node1.pr_.store_.value("color"), "");
+    EXPECT_EQ(node2.pr_.store_.value("color"), "");
+
+    //nodes that heard each other have distinct node ids
+    EXPECT_NE(node1.pr_.hlc_.node_id_, node2.pr_.hlc_.node_id_);
+    EXPECT_NE(node1.pr_.hlc_.node_id_, 0U);
 }
 
 TEST(DaemonNodesStatus, SetValueJerico)
 {
-    std::vector<const char *> setter_cli_args = {"test", "set", "Jerico", "-v", "trace", "-l", "s1"};
+    std::vector<const char *> setter_cli_args = {"test", "set", "color", "Jerico", "-v", "trace", "-l", "s1"};
     setter_cli.start(setter_cli_args.size(), (char **)setter_cli_args.data());
     std::this_thread::sleep_for(std::chrono::milliseconds(200));
 
@@ -105,13 +116,399 @@ TEST(DaemonNodesStatus, SetValueJerico)
     EXPECT_NE(node2.pr_.desired_cluster_ts_, 0U);
     EXPECT_EQ(node1.pr_.current_node_ts_, node2.pr_.current_node_ts_);
     EXPECT_EQ(node1.pr_.current_node_ts_, node1.pr_.desired_cluster_ts_);
-    EXPECT_EQ(node1.pr_.data_, "Jerico");
-    EXPECT_EQ(node2.pr_.data_, "Jerico");
+    EXPECT_EQ(node1.pr_.store_.value("color"), "Jerico");
+    EXPECT_EQ(node2.pr_.store_.value("color"), "Jerico");
+    EXPECT_EQ(node1.pr_.store_.version(nds::store::shard_of("color")), setter_cli.pr_.current_node_ts_);
 
     EXPECT_EQ(setter_cli.pr_.current_node_ts_, node1.pr_.current_node_ts_);
     EXPECT_EQ(setter_cli.pr_.desired_cluster_ts_, node1.pr_.desired_cluster_ts_);
-    EXPECT_EQ(setter_cli.pr_.data_, "Jerico");
+    EXPECT_EQ(setter_cli.pr_.store_.value("color"), "Jerico");
 
     setter_cli.pr_.stop();
     setter_cli.daemon_->join();
 }
+
+TEST(DaemonNodesStatus, NewNodesSpeakBinary)
+{
+    //nodes that have not heard any JSON-only node exchange binary messages from the start
+    EXPECT_EQ(node1.pr_.tp_json_node_seen_, std::chrono::system_clock::time_point());
+    EXPECT_EQ(node2.pr_.tp_json_node_seen_, std::chrono::system_clock::time_point());
+    EXPECT_TRUE(node1.pr_.bin_wire());
+    EXPECT_TRUE(node2.pr_.bin_wire());
+    EXPECT_TRUE(node1.pr_.alive_msg_bin_);
+    EXPECT_TRUE(node2.pr_.alive_msg_bin_);
+    EXPECT_EQ(node2.pr_.store_.value("color"), "Jerico");
+}
+
+TEST(DaemonNodesStatus, DropsJsonFieldsOfBadType)
+{
+    //JSON messages with fields of the wrong type are dropped without bringing the nodes down
+    std::vector<std::string> msgs = {
+        "[1, 2]",
+        "{\"_pt\":\"an\",\"_lp\":\"31599\",\"_ts\":1}",
+        "{\"_pt\":\"an\",\"_wv\":1,\"_lp\":31599,\"_hlc\":\"5\"}",
+        "{\"_pt\":\"an\",\"_wv\":1,\"_lp\":31599,\"_hlc\":5,\"_sv\":[\"x\"]}",
+        "{\"_pt\":\"an\",\"_wv\":1,\"_lp\":31599,\"_hlc\":5,\"_il\":[1,{\"_k\":\"a\",\"_dv\":\"b\",\"_sh\":\"x\"}]}"
+    };
+    int sck = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_GE(sck, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(node1.pr_.cfg_.multicast_address.c_str());
+    addr.sin_port = htons(node1.pr_.cfg_.multicast_port);
+    for(auto it = msgs.begin(); it != msgs.end(); ++it) {
+        uint32_t len = (uint32_t)it->size();
+        std::string pkt((const char *)&len, sizeof(len));
+        pkt += *it;
+        EXPECT_EQ(sendto(sck, pkt.data(), pkt.size(), 0, (sockaddr *)&addr, sizeof(addr)), (ssize_t)pkt.size());
+    }
+    close(sck);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    nds::local_client cli;
+    std::string val;
+    uint64_t ts = 0;
+    ASSERT_EQ(cli.connect(node1.pr_.cfg_.get_local_socket(), 3000), nds::RetCode_OK);
+    EXPECT_EQ(cli.get("color", val, ts), nds::RetCode_OK);
+    EXPECT_EQ(val, "Jerico");
+}
+
+TEST(DaemonNodesStatus, GetValueThroughLocalSocket)
+{
+    //a getter is served by the daemon running on this host, without joining the cluster
+    std::vector<const char *> getter_cli_args = {"test", "get", "color", "-v", "trace", "-l", "g1"};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    getter_cli.start(getter_cli_args.size(), (char **)getter_cli_args.data());
+    getter_cli.daemon_->join();
+
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+    EXPECT_EQ(getter_cli.res_, 0);
+    EXPECT_EQ(getter_cli.pr_.store_.value("color"), "Jerico");
+    EXPECT_EQ(getter_cli.pr_.current_node_ts_, node1.pr_.store_.get("color")->ts_);
+    EXPECT_FALSE(getter_cli.pr_.log_);
+}
+
+TEST(DaemonNodesStatus, SetThroughLocalSocketAwaitsWriteConcern)
+{
+    //a set served by the daemon is answered once the other nodes acknowledge it
+    nds::local_client cli;
+    ASSERT_EQ(cli.connect(node1.pr_.cfg_.get_local_socket(), 3000), nds::RetCode_OK);
+    uint64_t ts = 0, latency_us = 0;
+    unsigned acks = 0;
+    EXPECT_EQ(cli.set("gait", "brisk", 1, false, 3000, ts, acks, latency_us), nds::RetCode_OK);
+    EXPECT_GE(acks, 1U);
+    EXPECT_EQ(ts, node1.pr_.store_.get("gait")->ts_);
+
+    //not meeting it, the result reports the nodes that did
+    EXPECT_EQ(cli.set("gait", "slow", 5, false, 500, ts, acks, latency_us), nds::RetCode_TIMEOUT);
+    EXPECT_LT(acks, 5U);
+    EXPECT_GE(latency_us, 500000U);
+
+    //a setter fails as when joining the cluster
+    peer_tester setter;
+    setter.pr_.cfg_.ack_timeout_ms = 500;
+    std::vector<const char *> setter_args = {"test", "set", "gait", "steady", "-c", "5", "-v", "trace", "-l", "s6"};
+    setter.start(setter_args.size(), (char **)setter_args.data());
+    setter.daemon_->join();
+
+    EXPECT_EQ(setter.res_, nds::RetCode_TIMEOUT);
+    EXPECT_EQ(setter.pr_.store_.value("gait"), "steady");
+    EXPECT_EQ(node1.pr_.store_.value("gait"), "steady");
+}
+
+TEST(DaemonNodesStatus, EmbeddedNodeSetAsync)
+{
+    std::atomic<unsigned> changes(0);
+    embedded.on_change([&](const std::string &key, const nds::g_bslice &val, uint64_t ts) {
+        if(key == "shape") {
+            ++changes;
+        }
+    });
+    nds::peer::cfg cfg;
+    cfg.log_type = "e1";
+    cfg.log_level = "trace";
+    cfg.local_socket = "none";
+    ASSERT_EQ(embedded.start_node(cfg), nds::RetCode_OK);
+
+    //the write completes once the other nodes announce it
+    nds::api_result res = embedded.set_async("shape", "circle").get();
+    EXPECT_EQ(res.rcode_, nds::RetCode_OK);
+    EXPECT_NE(res.ts_, 0U);
+    EXPECT_GE(res.acks_, 1U);
+
+    nds::api_result got = embedded.get_async("shape").get();
+    EXPECT_EQ(got.rcode_, nds::RetCode_OK);
+    EXPECT_EQ(got.val_, "circle");
+    EXPECT_EQ(got.ts_, res.ts_);
+    EXPECT_GE(embedded.version_async().get().ts_, res.ts_);
+    EXPECT_EQ(changes.load(), 1U);
+
+    embedded.stop_node();
+    EXPECT_EQ(embedded.get_async("shape").get().rcode_, nds::RetCode_BADSTTS);
+    EXPECT_TRUE(node1.pr_.store_.value("shape") == "circle" || node2.pr_.store_.value("shape") == "circle");
+}
+
+TEST(DaemonNodesStatus, SetterExitsOnceAcknowledged)
+{
+    //a setter joining the cluster completes as soon as every node has acknowledged the value,
+    //well before its synch window expires
+    peer_tester setter;
+    std::vector<const char *> setter_args = {"test", "set", "size", "XL", "-u", "none", "-c", "all",
+                                             "-p", "31590", "-v", "trace", "-l", "s2"
+                                            };
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    setter.start(setter_args.size(), (char **)setter_args.data());
+    setter.daemon_->join();
+
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(1500));
+    EXPECT_EQ(setter.res_, 0);
+    EXPECT_EQ(node1.pr_.store_.value("size"), "XL");
+    EXPECT_EQ(node2.pr_.store_.value("size"), "XL");
+}
+
+TEST(DaemonNodesStatus, SetterOverIoUring)
+{
+    //a setter whose selector is completion based exchanges its value and acks with epoll based nodes
+    peer_tester setter;
+    std::vector<const char *> setter_args = {"test", "set", "shape", "round", "-u", "none", "-c", "all",
+                                             "-m", "uring", "-p", "31595", "-v", "trace", "-l", "s7"
+                                            };
+    setter.start(setter_args.size(), (char **)setter_args.data());
+    setter.daemon_->join();
+
+    EXPECT_EQ(setter.res_, 0);
+    EXPECT_EQ(node1.pr_.store_.value("shape"), "round");
+    EXPECT_EQ(node2.pr_.store_.value("shape"), "round");
+}
+
+TEST(DaemonNodesStatus, SetterFailsOnUnmetWriteConcern)
+{
+    //a setter waits for its write concern up to the ack timeout, then exits with an error
+    peer_tester setter;
+    std::vector<const char *> setter_args = {"test", "set", "fit", "slim", "-u", "none", "-c", "3",
+                                             "-p", "31591", "-v", "trace", "-l", "s3"
+                                            };
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    setter.start(setter_args.size(), (char **)setter_args.data());
+    setter.daemon_->join();
+
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(3000));
+    EXPECT_EQ(setter.res_, nds::RetCode_TIMEOUT);
+    EXPECT_EQ(node1.pr_.store_.value("fit"), "slim");
+    EXPECT_EQ(node2.pr_.store_.value("fit"), "slim");
+
+    //the result reports the nodes that acknowledged the write
+    nds::node writer;
+    nds::peer::cfg cfg;
+    cfg.listening_port = 31592;
+    cfg.log_type = "e2";
+    cfg.log_level = "trace";
+    cfg.local_socket = "none";
+    cfg.write_concern = "3";
+    ASSERT_EQ(writer.start_node(cfg), nds::RetCode_OK);
+    nds::api_result res = writer.set_async("fit", "loose").get();
+    EXPECT_EQ(res.rcode_, nds::RetCode_TIMEOUT);
+    EXPECT_EQ(res.acks_, 2U);
+    writer.stop_node();
+}
+
+TEST(DaemonNodesStatus, LoneSetterSucceeds)
+{
+    //with no other node in its cluster a setter waiting for all the nodes completes its write;
+    //clusters on the same host are kept apart by their multicast port
+    peer_tester setter;
+    setter.pr_.cfg_.multicast_port = 8746;
+    std::vector<const char *> setter_args = {"test", "set", "color", "Lonely", "-c", "all", "-u", "none",
+                                             "-p", "31593", "-v", "trace", "-l", "s4"
+                                            };
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    setter.start(setter_args.size(), (char **)setter_args.data());
+    setter.daemon_->join();
+
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(3000));
+    EXPECT_EQ(setter.res_, 0);
+    EXPECT_EQ(setter.pr_.store_.value("color"), "Lonely");
+    EXPECT_EQ(node1.pr_.store_.value("color"), "Jerico");
+
+    //an explicit number of nodes is not met by a lone node
+    peer_tester counter;
+    counter.pr_.cfg_.multicast_port = 8746;
+    std::vector<const char *> counter_args = {"test", "set", "color", "Lonely", "-c", "1", "-u", "none",
+                                              "-p", "31594", "-v", "trace", "-l", "s5"
+                                             };
+    counter.start(counter_args.size(), (char **)counter_args.data());
+    counter.daemon_->join();
+
+    EXPECT_EQ(counter.res_, nds::RetCode_TIMEOUT);
+    EXPECT_EQ(counter.pr_.store_.value("color"), "Lonely");
+}
+
+TEST(DaemonNodesStatus, WatchKeyThroughLocalSocket)
+{
+    std::string path = node1.pr_.cfg_.get_local_socket();
+    nds::local_client watcher, setter;
+    ASSERT_EQ(watcher.connect(path, 3000), nds::RetCode_OK);
+    ASSERT_EQ(setter.connect(path, 3000), nds::RetCode_OK);
+    uint64_t ts1 = 0, ts2 = 0, ts = 0;
+    ASSERT_EQ(setter.set("mood", "calm", ts1), nds::RetCode_OK);
+
+    //the value already set comes first, then the new ones of the key as they are set
+    std::vector<std::pair<std::string, uint64_t>> seen;
+    std::promise<void> watching;
+    std::thread th([&]() {
+        watcher.watch("mood", 0, [&](const std::string &key, const std::string &val, uint64_t ts) {
+            seen.push_back(std::make_pair(val, ts));
+            if(seen.size() == 1) {
+                watching.set_value();
+            }
+            return seen.size() < 2;
+        });
+    });
+    watching.get_future().wait();
+    EXPECT_EQ(setter.set("tone", "low", ts), nds::RetCode_OK);
+    EXPECT_EQ(setter.set("mood", "angry", ts2), nds::RetCode_OK);
+    th.join();
+
+    ASSERT_EQ(seen.size(), 2U);
+    EXPECT_EQ(seen[0], std::make_pair(std::string("calm"), ts1));
+    EXPECT_EQ(seen[1], std::make_pair(std::string("angry"), ts2));
+
+    //a watch resumed from a version only gets the newer values
+    std::string resumed;
+    ASSERT_EQ(watcher.connect(path, 3000), nds::RetCode_OK);
+    EXPECT_EQ(watcher.watch("mood", ts1, [&](const std::string &key, const std::string &val, uint64_t ts) {
+        resumed = val;
+        return false;
+    }), nds::RetCode_OK);
+    EXPECT_EQ(resumed, "angry");
+}
+
+TEST(HybridLogicalClock, OrdersWritesWithinTheSameSecond)
+{
+    nds::hlc clk;
+    clk.set_node_id(1);
+
+    //timestamps generated back to back are strictly increasing
+    uint64_t ts1 = clk.now();
+    uint64_t ts2 = clk.now();
+    EXPECT_LT(ts1, ts2);
+    EXPECT_EQ(ts1 & 0xfff, 1U);
+
+    //a timestamp observed ahead of the wall clock is overtaken
+    uint64_t oth_ts = ts2 + (1000ULL << 20);
+    EXPECT_TRUE(clk.observe(oth_ts));
+    EXPECT_GT(clk.now(), oth_ts);
+
+    //one too far ahead is not followed
+    clk.max_drift_ms_ = 60000;
+    uint64_t far_ts = oth_ts + (3600000ULL << 20);
+    EXPECT_FALSE(clk.observe(far_ts));
+    EXPECT_LT(clk.now(), far_ts);
+
+    EXPECT_EQ(nds::hlc::to_secs(nds::hlc::from_secs(1234)), 1234U);
+}
+
+TEST(Store, DigestTracksDivergentKeys)
+{
+    nds::store st1, st2;
+    st1.put("k1", nds::g_bslice(std::string("v1")), 5);
+    st2.put("k2", nds::g_bslice(std::string("v2")), 6);
+    EXPECT_NE(st1.digest(), st2.digest());
+
+    //the bucket holding a divergent key is found walking down the tree
+    unsigned shard = nds::store::shard_of("k1");
+    std::vector<uint64_t> d1, d2;
+    EXPECT_EQ(st1.children(nds::store::shard_node(shard), d1), nds::RetCode_OK);
+    EXPECT_EQ(st2.children(nds::store::shard_node(shard), d2), nds::RetCode_OK);
+    EXPECT_NE(d1[nds::store::bucket_of("k1")], d2[nds::store::bucket_of("k1")]);
+
+    //same (key, version) pairs give the same digest, whatever the order of the writes
+    st1.put("k2", nds::g_bslice(std::string("v2")), 6);
+    st2.put("k1", nds::g_bslice(std::string("v1")), 5);
+    EXPECT_EQ(st1.digest(), st2.digest());
+
+    //overwriting a key replaces its pair
+    st1.put("k1", nds::g_bslice(std::string("v3")), 7);
+    EXPECT_NE(st1.digest(), st2.digest());
+    st2.put("k1", nds::g_bslice(std::string("v3")), 7);
+    EXPECT_EQ(st1.digest(), st2.digest());
+}
+
+TEST(WireProtocol, ChunksCoverTheTransfer)
+{
+    std::string xfer(2 * WIRE_CHUNK_SZ + 10, 'x');
+    std::string rebuilt;
+    for(uint32_t seq = 0; seq < 3; ++seq) {
+        nds::g_bbuf_ptr pkt = nds::encode_chunk_msg(31582, 42, 3, seq, xfer.data(), xfer.size());
+        nds::msg m;
+        nds::chunk ch;
+        ASSERT_EQ(nds::decode_bin_msg(&pkt->buf_[4], pkt->available_read() - 4, m), nds::RetCode_OK);
+        ASSERT_EQ(nds::decode_chunk(m.pl_, m.pl_len_, ch), nds::RetCode_OK);
+        EXPECT_EQ(m.type_, nds::MsgType_DATA_CHUNK);
+        EXPECT_EQ(m.ts_, 42U);
+        EXPECT_EQ(ch.shard_, 3U);
+        EXPECT_EQ(ch.count_, 3U);
+        rebuilt.append(ch.data_, ch.len_);
+    }
+    EXPECT_EQ(rebuilt, xfer);
+
+    //the announcement carries the size of the transfer, without data
+    nds::g_bbuf_ptr pkt = nds::encode_announce_msg(31582, 42, 3, xfer.size());
+    nds::msg m;
+    nds::chunk ch;
+    ASSERT_EQ(nds::decode_bin_msg(&pkt->buf_[4], pkt->available_read() - 4, m), nds::RetCode_OK);
+    ASSERT_EQ(nds::decode_announce(m.pl_, m.pl_len_, ch), nds::RetCode_OK);
+    EXPECT_EQ(m.type_, nds::MsgType_DATA_ANNOUNCE);
+    EXPECT_EQ(ch.shard_, 3U);
+    EXPECT_EQ(ch.count_, 3U);
+    EXPECT_EQ(ch.total_, xfer.size());
+    EXPECT_NE(nds::decode_chunk(m.pl_, m.pl_len_, ch), nds::RetCode_OK);
+}
+
+TEST(SharedMemory, ReadsThePublishedStore)
+{
+    nds::store st;
+    st.put("color", nds::g_bslice(std::string("Jerico")), 5);
+    st.put("shape", nds::g_bslice(std::string("square")), 6);
+
+    nds::shm_publisher pub;
+    ASSERT_EQ(pub.open("/nds_test_shm", 4096), nds::RetCode_OK);
+    EXPECT_EQ(pub.publish(st, 6), nds::RetCode_OK);
+
+    //a segment already published by a live node is not taken over
+    nds::shm_publisher oth;
+    EXPECT_EQ(oth.open("/nds_test_shm", 4096), nds::RetCode_UNVRSC);
+
+    nds::shm_reader rd;
+    ASSERT_EQ(rd.open("/nds_test_shm"), nds::RetCode_OK);
+    std::string val;
+    uint64_t ts = 0, node_ts = 0;
+    EXPECT_EQ(rd.get("color", val, ts, node_ts), nds::RetCode_OK);
+    EXPECT_EQ(val, "Jerico");
+    EXPECT_EQ(ts, 5U);
+    EXPECT_EQ(node_ts, 6U);
+    EXPECT_EQ(rd.get("size", val, ts, node_ts), nds::RetCode_OK);
+    EXPECT_EQ(val, "");
+    EXPECT_EQ(ts, 0U);
+
+    //a newer write is seen by a reader already mapping the segment
+    st.put("color", nds::g_bslice(std::string("Rumba")), 7);
+    EXPECT_EQ(pub.publish(st, 7), nds::RetCode_OK);
+    EXPECT_EQ(rd.get("color", val, ts, node_ts), nds::RetCode_OK);
+    EXPECT_EQ(val, "Rumba");
+    EXPECT_EQ(ts, 7U);
+
+    //a shard outgrowing its region is laid out again, along with the others
+    st.put("color", nds::g_bslice(std::string(1024, 'y')), 8);
+    EXPECT_EQ(pub.publish(st, 8), nds::RetCode_OK);
+    EXPECT_EQ(rd.get("color", val, ts, node_ts), nds::RetCode_OK);
+    EXPECT_EQ(val, std::string(1024, 'y'));
+    EXPECT_EQ(rd.get("shape", val, ts, node_ts), nds::RetCode_OK);
+    EXPECT_EQ(val, "square");
+
+    //a store not fitting the segment is not published
+    st.put("big", nds::g_bslice(std::string(8192, 'x')), 9);
+    EXPECT_EQ(pub.publish(st, 9), nds::RetCode_OVRSZ);
+    EXPECT_EQ(rd.get("color", val, ts, node_ts), nds::RetCode_OVRSZ);
+}
@@ -0,0 +1,500 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "wire.h"
+#include <endian.h>
+#include <algorithm>
+
+namespace nds {
+
+bool is_bin_msg(const char *body, size_t len)
+{
+    uint16_t magic = 0;
+    if(len < sizeof(magic)) {
+        return false;
+    }
+    memcpy(&magic, body, sizeof(magic));
+    return le16toh(magic) == WIRE_MAGIC;
+}
+
+RetCode decode_bin_msg(const char *body, size_t len, msg &out)
+{
+    if(len < WIRE_HDR_SZ || !is_bin_msg(body, len)) {
+        return RetCode_MALFORM;
+    }
+    uint16_t u16 = 0;
+    uint32_t u32 = 0;
+    uint64_t u64 = 0;
+
+    out.json_ = false;
+    out.version_ = (uint8_t)body[2];
+    out.type_ = (MsgType)(uint8_t)body[3];
+    memcpy(&u16, &body[4], 2);
+    out.lp_ = le16toh(u16);
+    memcpy(&u16, &body[6], 2);
+    out.flags_ = le16toh(u16);
+    memcpy(&u32, &body[8], 4);
+    out.pl_len_ = le32toh(u32);
+    memcpy(&u64, &body[12], 8);
+    out.ts_ = le64toh(u64);
+
+    if(out.pl_len_ > len - WIRE_HDR_SZ) {
+        return RetCode_MALFORM;
+    }
+    out.pl_ = &body[WIRE_HDR_SZ];
+    return RetCode_OK;
+}
+
+void encode_bin_hdr(char *out, MsgType type, uint16_t lp, uint64_t ts, size_t pl_len, uint16_t flags)
+{
+    uint16_t u16 = htole16(WIRE_MAGIC);
+    memcpy(&out[0], &u16, 2);
+    out[2] = (char)WIRE_VERSION;
+    out[3] = (char)type;
+    u16 = htole16(lp);
+    memcpy(&out[4], &u16, 2);
+    u16 = htole16(flags);
+    memcpy(&out[6], &u16, 2);
+    uint32_t u32 = htole32((uint32_t)pl_len);
+    memcpy(&out[8], &u32, 4);
+    patch_bin_ts(out, ts);
+}
+
+void patch_bin_ts(char *hdr, uint64_t ts)
+{
+    uint64_t u64 = htole64(ts);
+    memcpy(&hdr[12], &u64, 8);
+}
+
+g_bbuf_ptr encode_bin_msg(MsgType type,
+                          uint16_t lp,
+                          uint64_t ts,
+                          const void *pl,
+                          size_t pl_len)
+{
+    g_bbuf_ptr pkt = encode_bin_msg_hdr(type, lp, ts, pl_len, 4 + WIRE_HDR_SZ + pl_len);
+    if(pl_len) {
+        pkt->set_write();
+        pkt->append(pl, 0, pl_len);
+        pkt->set_read();
+    }
+    return pkt;
+}
+
+g_bbuf_ptr encode_bin_msg_hdr(MsgType type,
+                              uint16_t lp,
+                              uint64_t ts,
+                              size_t pl_len,
+                              size_t capacity)
+{
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(std::max(capacity, (size_t)(4 + WIRE_HDR_SZ)));
+    char hdr[WIRE_HDR_SZ];
+    encode_bin_hdr(hdr, type, lp, ts, pl_len);
+    pkt->append_uint((unsigned int)(WIRE_HDR_SZ + pl_len));
+    pkt->append(hdr, 0, WIRE_HDR_SZ);
+    pkt->set_read();
+    return pkt;
+}
+
+RetCode append_kv_rec(g_bbuf &out, const std::string &key, const char *val, size_t val_len, uint64_t ts)
+{
+    char hdr[WIRE_KV_HDR_SZ];
+    uint16_t u16 = htole16((uint16_t)key.size());
+    memcpy(&hdr[0], &u16, 2);
+    uint32_t u32 = htole32((uint32_t)val_len);
+    memcpy(&hdr[2], &u32, 4);
+    uint64_t u64 = htole64(ts);
+    memcpy(&hdr[6], &u64, 8);
+    RET_ON_KO(out.append(hdr, 0, WIRE_KV_HDR_SZ))
+    if(key.size()) {
+        RET_ON_KO(out.append(key.data(), 0, key.size()))
+    }
+    if(val_len) {
+        RET_ON_KO(out.append(val, 0, val_len))
+    }
+    return RetCode_OK;
+}
+
+RetCode decode_kv_recs(const char *pl, size_t len, std::vector<kv_rec> &out)
+{
+    while(len) {
+        if(len < WIRE_KV_HDR_SZ) {
+            return RetCode_MALFORM;
+        }
+        uint16_t u16 = 0;
+        uint32_t u32 = 0;
+        uint64_t u64 = 0;
+        kv_rec rec;
+        memcpy(&u16, &pl[0], 2);
+        rec.key_len_ = le16toh(u16);
+        memcpy(&u32, &pl[2], 4);
+        rec.val_len_ = le32toh(u32);
+        memcpy(&u64, &pl[6], 8);
+        rec.ts_ = le64toh(u64);
+        pl += WIRE_KV_HDR_SZ;
+        len -= WIRE_KV_HDR_SZ;
+        if(rec.key_len_ > len || rec.val_len_ > len - rec.key_len_) {
+            return RetCode_MALFORM;
+        }
+        rec.key_ = pl;
+        rec.val_ = pl + rec.key_len_;
+        pl += rec.key_len_ + rec.val_len_;
+        len -= rec.key_len_ + rec.val_len_;
+        out.push_back(rec);
+    }
+    return RetCode_OK;
+}
+
+RetCode append_shard_req(g_bbuf &out, const shard_req &req)
+{
+    char rec[WIRE_SHARD_REQ_SZ];
+    uint16_t u16 = htole16((uint16_t)req.shard_);
+    memcpy(&rec[0], &u16, 2);
+    uint64_t u64 = htole64(req.since_);
+    memcpy(&rec[2], &u64, 8);
+    return out.append(rec, 0, WIRE_SHARD_REQ_SZ);
+}
+
+RetCode decode_shard_reqs(const char *pl, size_t len, std::vector<shard_req> &out)
+{
+    if(len % WIRE_SHARD_REQ_SZ) {
+        return RetCode_MALFORM;
+    }
+    for(; len; pl += WIRE_SHARD_REQ_SZ, len -= WIRE_SHARD_REQ_SZ) {
+        uint16_t u16 = 0;
+        uint64_t u64 = 0;
+        shard_req req;
+        memcpy(&u16, &pl[0], 2);
+        req.shard_ = le16toh(u16);
+        memcpy(&u64, &pl[2], 8);
+        req.since_ = le64toh(u64);
+        out.push_back(req);
+    }
+    return RetCode_OK;
+}
+
+RetCode decode_inline_recs(const char *pl, size_t len, std::vector<inline_rec> &out)
+{
+    std::vector<shard_req> reqs;
+    std::vector<kv_rec> recs;
+    while(len) {
+        if(len < WIRE_SHARD_REQ_SZ + WIRE_KV_HDR_SZ) {
+            return RetCode_MALFORM;
+        }
+        reqs.clear();
+        RET_ON_KO(decode_shard_reqs(pl, WIRE_SHARD_REQ_SZ, reqs))
+        pl += WIRE_SHARD_REQ_SZ;
+        len -= WIRE_SHARD_REQ_SZ;
+
+        //the length of the record is in its header.
+        uint16_t u16 = 0;
+        uint32_t u32 = 0;
+        memcpy(&u16, &pl[0], 2);
+        memcpy(&u32, &pl[2], 4);
+        size_t rec_len = WIRE_KV_HDR_SZ + le16toh(u16) + (size_t)le32toh(u32);
+        if(rec_len > len) {
+            return RetCode_MALFORM;
+        }
+        recs.clear();
+        RET_ON_KO(decode_kv_recs(pl, rec_len, recs))
+        pl += rec_len;
+        len -= rec_len;
+
+        inline_rec rec;
+        rec.req_ = reqs[0];
+        rec.rec_ = recs[0];
+        out.push_back(rec);
+    }
+    return RetCode_OK;
+}
+
+RetCode append_u16s(g_bbuf &out, const unsigned *vals, size_t cnt)
+{
+    for(size_t i = 0; i < cnt; ++i) {
+        uint16_t u16 = htole16((uint16_t)vals[i]);
+        RET_ON_KO(out.append(&u16, 0, sizeof(u16)))
+    }
+    return RetCode_OK;
+}
+
+RetCode decode_u16s(const char *pl, size_t len, std::vector<unsigned> &out)
+{
+    if(len % sizeof(uint16_t)) {
+        return RetCode_MALFORM;
+    }
+    for(; len; pl += sizeof(uint16_t), len -= sizeof(uint16_t)) {
+        uint16_t u16 = 0;
+        memcpy(&u16, pl, sizeof(u16));
+        out.push_back(le16toh(u16));
+    }
+    return RetCode_OK;
+}
+
+RetCode append_u32s(g_bbuf &out, const uint32_t *vals, size_t cnt)
+{
+    for(size_t i = 0; i < cnt; ++i) {
+        uint32_t u32 = htole32(vals[i]);
+        RET_ON_KO(out.append(&u32, 0, sizeof(u32)))
+    }
+    return RetCode_OK;
+}
+
+RetCode decode_u32s(const char *pl, size_t len, std::vector<uint32_t> &out)
+{
+    if(len % sizeof(uint32_t)) {
+        return RetCode_MALFORM;
+    }
+    for(; len; pl += sizeof(uint32_t), len -= sizeof(uint32_t)) {
+        uint32_t u32 = 0;
+        memcpy(&u32, pl, sizeof(u32));
+        out.push_back(le32toh(u32));
+    }
+    return RetCode_OK;
+}
+
+static void encode_chunk_hdr(char *hdr, unsigned shard, uint32_t seq, size_t total)
+{
+    uint16_t u16 = htole16((uint16_t)shard);
+    memcpy(&hdr[0], &u16, 2);
+    uint32_t u32 = htole32(seq);
+    memcpy(&hdr[2], &u32, 4);
+    u32 = htole32((uint32_t)((total + WIRE_CHUNK_SZ - 1) / WIRE_CHUNK_SZ));
+    memcpy(&hdr[6], &u32, 4);
+    u32 = htole32((uint32_t)total);
+    memcpy(&hdr[10], &u32, 4);
+}
+
+static void decode_chunk_hdr(const char *pl, chunk &out)
+{
+    uint16_t u16 = 0;
+    uint32_t u32 = 0;
+    memcpy(&u16, &pl[0], 2);
+    out.shard_ = le16toh(u16);
+    memcpy(&u32, &pl[2], 4);
+    out.seq_ = le32toh(u32);
+    memcpy(&u32, &pl[6], 4);
+    out.count_ = le32toh(u32);
+    memcpy(&u32, &pl[10], 4);
+    out.total_ = le32toh(u32);
+}
+
+g_bbuf_ptr encode_chunk_msg(uint16_t lp, uint64_t ts, unsigned shard, uint32_t seq,
+                            const char *xfer, size_t total)
+{
+    size_t off = (size_t)seq * WIRE_CHUNK_SZ;
+    size_t len = std::min((size_t)WIRE_CHUNK_SZ, total - off);
+    char hdr[WIRE_CHUNK_HDR_SZ];
+    encode_chunk_hdr(hdr, shard, seq, total);
+
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + WIRE_HDR_SZ + WIRE_CHUNK_HDR_SZ + len);
+    pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+    pkt->append(hdr, 0, WIRE_CHUNK_HDR_SZ);
+    pkt->append(&xfer[off], 0, len);
+    seal_bin_msg(*pkt, MsgType_DATA_CHUNK, lp, ts);
+    return pkt;
+}
+
+RetCode decode_chunk(const char *pl, size_t len, chunk &out)
+{
+    if(len < WIRE_CHUNK_HDR_SZ) {
+        return RetCode_MALFORM;
+    }
+    decode_chunk_hdr(pl, out);
+    out.data_ = &pl[WIRE_CHUNK_HDR_SZ];
+    out.len_ = len - WIRE_CHUNK_HDR_SZ;
+
+    //chunks are full but the last one.
+    if(!out.count_ || out.seq_ >= out.count_ ||
+            out.count_ != (out.total_ + WIRE_CHUNK_SZ - 1) / WIRE_CHUNK_SZ ||
+            out.len_ != std::min((size_t)WIRE_CHUNK_SZ, (size_t)out.total_ - (size_t)out.seq_ * WIRE_CHUNK_SZ)) {
+        return RetCode_MALFORM;
+    }
+    return RetCode_OK;
+}
+
+g_bbuf_ptr encode_announce_msg(uint16_t lp, uint64_t ts, unsigned shard, size_t total)
+{
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + WIRE_HDR_SZ + WIRE_CHUNK_HDR_SZ);
+    pkt->advance_pos_write(4 + WIRE_HDR_SZ);
+    char hdr[WIRE_CHUNK_HDR_SZ];
+    encode_chunk_hdr(hdr, shard, 0, total);
+    pkt->append(hdr, 0, WIRE_CHUNK_HDR_SZ);
+    seal_bin_msg(*pkt, MsgType_DATA_ANNOUNCE, lp, ts);
+    return pkt;
+}
+
+RetCode decode_announce(const char *pl, size_t len, chunk &out)
+{
+    if(len != WIRE_CHUNK_HDR_SZ) {
+        return RetCode_MALFORM;
+    }
+    decode_chunk_hdr(pl, out);
+    if(!out.count_ || out.seq_ ||
+            out.count_ != (out.total_ + WIRE_CHUNK_SZ - 1) / WIRE_CHUNK_SZ) {
+        return RetCode_MALFORM;
+    }
+    return RetCode_OK;
+}
+
+RetCode append_digest_rec(g_bbuf &out, unsigned node, const uint64_t *digests, size_t cnt)
+{
+    char hdr[WIRE_DIGEST_HDR_SZ];
+    uint16_t u16 = htole16((uint16_t)node);
+    memcpy(&hdr[0], &u16, 2);
+    u16 = htole16((uint16_t)cnt);
+    memcpy(&hdr[2], &u16, 2);
+    RET_ON_KO(out.append(hdr, 0, WIRE_DIGEST_HDR_SZ))
+    return append_u64s(out, digests, cnt);
+}
+
+RetCode decode_digest_recs(const char *pl, size_t len, std::vector<digest_rec> &out)
+{
+    while(len) {
+        if(len < WIRE_DIGEST_HDR_SZ) {
+            return RetCode_MALFORM;
+        }
+        uint16_t u16 = 0;
+        digest_rec rec;
+        memcpy(&u16, &pl[0], 2);
+        rec.node_ = le16toh(u16);
+        memcpy(&u16, &pl[2], 2);
+        size_t sz = le16toh(u16) * sizeof(uint64_t);
+        pl += WIRE_DIGEST_HDR_SZ;
+        len -= WIRE_DIGEST_HDR_SZ;
+        if(sz > len) {
+            return RetCode_MALFORM;
+        }
+        RET_ON_KO(decode_u64s(pl, sz, rec.digests_))
+        pl += sz;
+        len -= sz;
+        out.push_back(std::move(rec));
+    }
+    return RetCode_OK;
+}
+
+RetCode append_leaf_hdr(g_bbuf &out, unsigned node, size_t cnt)
+{
+    char hdr[WIRE_LEAF_HDR_SZ];
+    uint16_t u16 = htole16((uint16_t)node);
+    memcpy(&hdr[0], &u16, 2);
+    uint32_t u32 = htole32((uint32_t)cnt);
+    memcpy(&hdr[2], &u32, 4);
+    return out.append(hdr, 0, WIRE_LEAF_HDR_SZ);
+}
+
+RetCode append_key_ver(g_bbuf &out, const std::string &key, uint64_t ts)
+{
+    char hdr[WIRE_KEY_VER_HDR_SZ];
+    uint16_t u16 = htole16((uint16_t)key.size());
+    memcpy(&hdr[0], &u16, 2);
+    uint64_t u64 = htole64(ts);
+    memcpy(&hdr[2], &u64, 8);
+    RET_ON_KO(out.append(hdr, 0, WIRE_KEY_VER_HDR_SZ))
+    if(key.size()) {
+        RET_ON_KO(out.append(key.data(), 0, key.size()))
+    }
+    return RetCode_OK;
+}
+
+RetCode decode_leaf_recs(const char *pl, size_t len, std::vector<leaf_rec> &out)
+{
+    while(len) {
+        if(len < WIRE_LEAF_HDR_SZ) {
+            return RetCode_MALFORM;
+        }
+        uint16_t u16 = 0;
+        uint32_t u32 = 0;
+        leaf_rec rec;
+        memcpy(&u16, &pl[0], 2);
+        rec.node_ = le16toh(u16);
+        memcpy(&u32, &pl[2], 4);
+        size_t cnt = le32toh(u32);
+        pl += WIRE_LEAF_HDR_SZ;
+        len -= WIRE_LEAF_HDR_SZ;
+        for(size_t i = 0; i < cnt; ++i) {
+            if(len < WIRE_KEY_VER_HDR_SZ) {
+                return RetCode_MALFORM;
+            }
+            uint64_t u64 = 0;
+            leaf_rec::key_ver kv;
+            memcpy(&u16, &pl[0], 2);
+            kv.key_len_ = le16toh(u16);
+            memcpy(&u64, &pl[2], 8);
+            kv.ts_ = le64toh(u64);
+            pl += WIRE_KEY_VER_HDR_SZ;
+            len -= WIRE_KEY_VER_HDR_SZ;
+            if(kv.key_len_ > len) {
+                return RetCode_MALFORM;
+            }
+            kv.key_ = pl;
+            pl += kv.key_len_;
+            len -= kv.key_len_;
+            rec.keys_.push_back(kv);
+        }
+        out.push_back(std::move(rec));
+    }
+    return RetCode_OK;
+}
+
+RetCode append_u64s(g_bbuf &out, const uint64_t *vals, size_t cnt)
+{
+    for(size_t i = 0; i < cnt; ++i) {
+        uint64_t u64 = htole64(vals[i]);
+        RET_ON_KO(out.append(&u64, 0, sizeof(u64)))
+    }
+    return RetCode_OK;
+}
+
+RetCode decode_u64s(const char *pl, size_t len, std::vector<uint64_t> &out)
+{
+    if(len % sizeof(uint64_t)) {
+        return RetCode_MALFORM;
+    }
+    for(; len; pl += sizeof(uint64_t), len -= sizeof(uint64_t)) {
+        uint64_t u64 = 0;
+        memcpy(&u64, pl, sizeof(u64));
+        out.push_back(le64toh(u64));
+    }
+    return RetCode_OK;
+}
+
+void seal_bin_msg(g_bbuf &pkt, MsgType type, uint16_t lp, uint64_t ts, uint16_t flags)
+{
+    size_t pl_len = pkt.limit() - 4 - WIRE_HDR_SZ;
+    uint32_t sz = (uint32_t)(WIRE_HDR_SZ + pl_len);
+    memcpy(&pkt.buf_[0], &sz, sizeof(sz));
+    encode_bin_hdr(&pkt.buf_[4], type, lp, ts, pl_len, flags);
+    pkt.set_read();
+}
+
+g_bbuf_ptr encode_json_msg(const Json::Value &msg)
+{
+    Json::StreamWriterBuilder wbuilder;
+    wbuilder["indentation"] = "";
+    std::string str = Json::writeString(wbuilder, msg);
+
+    g_bbuf_ptr pkt = g_bbuf_pool::instance().acquire(4 + str.size());
+    pkt->append_uint((unsigned int)str.size());
+    pkt->append(str.data(), 0, str.size());
+    pkt->set_read();
+    return pkt;
+}
+
+}
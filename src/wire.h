@@ -0,0 +1,290 @@
+/* Original Work Copyright (c) 2021 Giuseppe Baccini - giuseppe.baccini@live.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+the Software, and to permit persons to whom the Software is furnished to do so,
+subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#pragma once
+#include "bbuf.h"
+
+//wire protocol version spoken by this node; JSON-only nodes are version 0.
+#define WIRE_VERSION 1
+
+//binary messages start with these 2 bytes ("ND"), JSON messages start with '{'.
+#define WIRE_MAGIC 0x444E
+#define WIRE_HDR_SZ 20
+
+namespace nds {
+
+/**
+ * Message types.
+ */
+enum MsgType {
+    MsgType_UNDEF,
+    MsgType_ALIVE_NODE,         //Alive Node (UDP multicast)
+    MsgType_DATA,               //Data (TCP)
+    MsgType_DATA_REQUEST,       //Data Request (TCP)
+    MsgType_DIGEST_REQUEST,     //Digest Request (TCP, binary only)
+    MsgType_DIGEST,             //Digest (TCP, binary only)
+    MsgType_RECONCILE_REQUEST,  //Reconcile Request (TCP, binary only)
+    MsgType_DATA_CHUNK,         //Data Chunk (UDP multicast, TCP for repairs, binary only)
+    MsgType_DATA_NAK,           //Data Negative Acknowledgement (TCP, binary only)
+    MsgType_LOCAL_GET,          //Local Get (unix domain socket, binary only)
+    MsgType_LOCAL_SET,          //Local Set (unix domain socket, binary only)
+    MsgType_LOCAL_VERSION,      //Local Version (unix domain socket, binary only)
+    MsgType_LOCAL_RESULT,       //Local Result (unix domain socket, binary only)
+    MsgType_LOCAL_WATCH,        //Local Watch (unix domain socket, binary only)
+    MsgType_LOCAL_CHANGE,       //Local Change (unix domain socket, binary only)
+    MsgType_DATA_ACK,           //Data Acknowledgement (TCP, binary only)
+    MsgType_DATA_ANNOUNCE,      //Data Announcement (UDP multicast, binary only)
+};
+
+/**
+ * Message flags.
+ */
+enum MsgFlag {
+    MsgFlag_NONE        = 0,
+    MsgFlag_RECONCILE   = 1,    //data message answering a reconcile request
+    MsgFlag_WRITE_ACKS  = 2,    //local set waiting for lp nodes to acknowledge it, for up to ts milliseconds
+    MsgFlag_WRITE_ALL   = 4,    //local set waiting for all the nodes heard lately, for up to ts milliseconds
+    MsgFlag_UNMET       = 8,    //local result of a set whose write concern was not met in time
+    MsgFlag_NODE_ID     = 0x8000,   //alive message carrying the hlc node id of its source in the low bits
+};
+
+/**
+ * A decoded message.
+ *
+ * Binary messages are decoded in place: the payload points inside the packet buffer.
+ * JSON messages are decoded by the peer: the payload points inside the parsed Json::Value.
+ *
+ * Binary message layout, all fields little-endian:
+ *
+ *  0       2     3      4      6       8        12       20
+ *  +-------+-----+------+------+-------+--------+--------+----------
+ *  | magic | ver | type |  lp  | flags | pl len |   ts   | payload ...
+ *  +-------+-----+------+------+-------+--------+--------+----------
+ *
+ * lp is the listening port of the source node (alive messages only).
+ */
+struct msg {
+    MsgType type_ = MsgType_UNDEF;
+    uint8_t version_ = 0;
+    bool json_ = false;
+    uint16_t lp_ = 0;
+    uint16_t flags_ = 0;
+    uint64_t ts_ = 0;
+    const char *pl_ = nullptr;
+    size_t pl_len_ = 0;
+};
+
+/**
+ * A key/value record, carried by data messages.
+ * Decoded in place: key and value point inside the packet buffer.
+ *
+ *  0          2           6      14
+ *  +----------+-----------+------+-----+-------
+ *  | key len  | value len |  ts  | key | value
+ *  +----------+-----------+------+-----+-------
+ */
+struct kv_rec {
+    const char *key_ = nullptr;
+    size_t key_len_ = 0;
+    const char *val_ = nullptr;
+    size_t val_len_ = 0;
+    uint64_t ts_ = 0;
+};
+
+#define WIRE_KV_HDR_SZ 14
+
+/**
+ * A shard requested by data request messages, with the version the requester already has:
+ * only keys newer than it are sent back.
+ * Data ack messages carry the shards just received, with the version the receiver has now.
+ *
+ *  0       2       10
+ *  +-------+-------+
+ *  | shard | since |
+ *  +-------+-------+
+ */
+struct shard_req {
+    unsigned shard_ = 0;
+    uint64_t since_ = 0;
+};
+
+#define WIRE_SHARD_REQ_SZ 10
+
+/**
+ * A key/value record inlined in an alive message, after the shard versions and the digest:
+ * the last write of a shard, along with the version of the shard before it.
+ * A node with at least that version of the shard is updated to the version announced
+ * by storing just the record.
+ *
+ *  0       2       10
+ *  +-------+-------+------------
+ *  | shard | since | kv record
+ *  +-------+-------+------------
+ */
+struct inline_rec {
+    shard_req req_;
+    kv_rec rec_;
+};
+
+/**
+ * The digests of the children of a node of the store digest tree, carried by digest messages.
+ * Digest request messages carry just the u16 nodes whose children are requested.
+ *
+ *  0      2       4
+ *  +------+-------+--------------------
+ *  | node | count | count u64 digests
+ *  +------+-------+--------------------
+ */
+struct digest_rec {
+    unsigned node_ = 0;
+    std::vector<uint64_t> digests_;
+};
+
+#define WIRE_DIGEST_HDR_SZ 4
+
+/**
+ * The keys a node has below a leaf of the store digest tree, with their versions,
+ * carried by reconcile request messages: the receiver sends back the records
+ * of that leaf missing or older in the list.
+ * Decoded in place: keys point inside the packet buffer.
+ *
+ *  0      2       6
+ *  +------+-------+-----------------------------------
+ *  | node | count | count * ( key len | ts | key )
+ *  +------+-------+-----------------------------------
+ */
+struct leaf_rec {
+    struct key_ver {
+        const char *key_ = nullptr;
+        size_t key_len_ = 0;
+        uint64_t ts_ = 0;
+    };
+    unsigned node_ = 0;
+    std::vector<key_ver> keys_;
+};
+
+#define WIRE_LEAF_HDR_SZ 6
+#define WIRE_KEY_VER_HDR_SZ 10
+
+/**
+ * A chunk of a multicast data transfer.
+ * A transfer is a whole framed binary data message, with the records of a shard, split in
+ * chunks of WIRE_CHUNK_SZ bytes (the last one can be shorter); it is identified by the
+ * timestamp of its data message, carried in the header of each chunk.
+ * Data announcements precede the chunks of a transfer: their payload is the chunk header
+ * alone, with seq 0 and no data.
+ * Data negative acknowledgements carry the u32 sequence numbers of the chunks missing.
+ * Decoded in place: data points inside the packet buffer.
+ *
+ *  0       2     6       10      14
+ *  +-------+-----+-------+-------+--------
+ *  | shard | seq | count | total | data
+ *  +-------+-----+-------+-------+--------
+ */
+struct chunk {
+    unsigned shard_ = 0;
+    uint32_t seq_ = 0;
+    uint32_t count_ = 0;
+    uint32_t total_ = 0;
+    const char *data_ = nullptr;
+    size_t len_ = 0;
+};
+
+#define WIRE_CHUNK_HDR_SZ 14
+
+//a chunk datagram fits in a 1500 bytes MTU.
+#define WIRE_CHUNK_SZ 1400
+
+//true if the packet body is a binary message.
+bool is_bin_msg(const char *body, size_t len);
+
+//decodes in place a binary message, without allocations.
+RetCode decode_bin_msg(const char *body, size_t len, msg &out);
+
+//writes the binary header of a message into out (WIRE_HDR_SZ bytes).
+void encode_bin_hdr(char *out, MsgType type, uint16_t lp, uint64_t ts, size_t pl_len, uint16_t flags = 0);
+
+//overwrites the timestamp of an encoded binary header.
+void patch_bin_ts(char *hdr, uint64_t ts);
+
+//encodes a binary message, framed with the 4 bytes length, into a pooled buffer.
+g_bbuf_ptr encode_bin_msg(MsgType type,
+                          uint16_t lp,
+                          uint64_t ts,
+                          const void *pl = nullptr,
+                          size_t pl_len = 0);
+
+//encodes the length and the header of a binary message, into a pooled buffer;
+//the pl_len bytes of payload are sent by the caller right after.
+g_bbuf_ptr encode_bin_msg_hdr(MsgType type,
+                              uint16_t lp,
+                              uint64_t ts,
+                              size_t pl_len,
+                              size_t capacity = 0);
+
+//appends/decodes a key/value record.
+RetCode append_kv_rec(g_bbuf &out, const std::string &key, const char *val, size_t val_len, uint64_t ts);
+RetCode decode_kv_recs(const char *pl, size_t len, std::vector<kv_rec> &out);
+
+//appends/decodes a shard request.
+RetCode append_shard_req(g_bbuf &out, const shard_req &req);
+RetCode decode_shard_reqs(const char *pl, size_t len, std::vector<shard_req> &out);
+
+//decodes the records inlined in an alive message.
+RetCode decode_inline_recs(const char *pl, size_t len, std::vector<inline_rec> &out);
+
+//appends/decodes an array of little-endian 16 bits integers.
+RetCode append_u16s(g_bbuf &out, const unsigned *vals, size_t cnt);
+RetCode decode_u16s(const char *pl, size_t len, std::vector<unsigned> &out);
+
+//appends/decodes the digests of the children of a node.
+RetCode append_digest_rec(g_bbuf &out, unsigned node, const uint64_t *digests, size_t cnt);
+RetCode decode_digest_recs(const char *pl, size_t len, std::vector<digest_rec> &out);
+
+//appends the header of a leaf, then each of its count keys; decodes leaves.
+RetCode append_leaf_hdr(g_bbuf &out, unsigned node, size_t cnt);
+RetCode append_key_ver(g_bbuf &out, const std::string &key, uint64_t ts);
+RetCode decode_leaf_recs(const char *pl, size_t len, std::vector<leaf_rec> &out);
+
+//appends/decodes an array of little-endian 32 bits integers.
+RetCode append_u32s(g_bbuf &out, const uint32_t *vals, size_t cnt);
+RetCode decode_u32s(const char *pl, size_t len, std::vector<uint32_t> &out);
+
+//encodes, into a pooled buffer, the chunk seq of a transfer of total bytes.
+g_bbuf_ptr encode_chunk_msg(uint16_t lp, uint64_t ts, unsigned shard, uint32_t seq,
+                            const char *xfer, size_t total);
+RetCode decode_chunk(const char *pl, size_t len, chunk &out);
+
+//encodes/decodes the announcement of a transfer of total bytes.
+g_bbuf_ptr encode_announce_msg(uint16_t lp, uint64_t ts, unsigned shard, size_t total);
+RetCode decode_announce(const char *pl, size_t len, chunk &out);
+
+//appends/decodes an array of little-endian 64 bits integers.
+RetCode append_u64s(g_bbuf &out, const uint64_t *vals, size_t cnt);
+RetCode decode_u64s(const char *pl, size_t len, std::vector<uint64_t> &out);
+
+//completes a binary message whose header has been reserved at the start of pkt
+//and whose payload has been appended after it, then sets pkt for reading.
+void seal_bin_msg(g_bbuf &pkt, MsgType type, uint16_t lp, uint64_t ts, uint16_t flags = 0);
+
+//serializes a Json message, framed with the 4 bytes length, into a pooled buffer.
+g_bbuf_ptr encode_json_msg(const Json::Value &msg);
+
+}